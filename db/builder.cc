@@ -4,7 +4,10 @@
 
 #include "db/builder.h"
 
+#include <algorithm>
+
 #include "db/dbformat.h"
+#include "db/fields.h"
 #include "db/filename.h"
 #include "db/table_cache.h"
 #include "db/version_edit.h"
@@ -12,6 +15,7 @@
 #include "leveldb/db.h"
 #include "leveldb/env.h"
 #include "leveldb/iterator.h"
+#include "leveldb/separation_policy.h"
 
 #include "table/vtable_builder.h"
 #include "table/vtable_manager.h"
@@ -44,32 +48,24 @@ Status BuildTable(const std::string& dbname, Env* env, const Options& options,
     VTableBuilder* vtb_builder = new VTableBuilder(options, vtb_file);
     meta->smallest.DecodeFrom(iter->key());
     Slice key;
+    std::string separated;
     for (; iter->Valid(); iter->Next()) {
       key = iter->key();
+      ParsedInternalKey parsed;
+      if (!ParseInternalKey(key, &parsed)) {
+        s = Status::Corruption("Fatal. Memtable Key Error");
+        builder->Abandon();
+        vtb_builder->Abandon();
+        return s;
+      }
       Slice value = iter->value();
-      if (value.size() < options.kv_sep_size) {
-        // No need to separate key and value
-        builder->Add(key, value);
+      if (SeparateValue(options, parsed.user_key, value, meta->number,
+                        vtb_builder, &separated)) {
+        builder->Add(key, separated);
       } else {
-        // Separate key value
-        ParsedInternalKey parsed;
-        if (!ParseInternalKey(key, &parsed)) {
-          s = Status::Corruption("Fatal. Memtable Key Error");
-          builder->Abandon();
-          vtb_builder->Abandon();
-          return s;
-        }
-        value.remove_prefix(1);
-        VTableRecord record {parsed.user_key, value};
-        VTableHandle handle;
-        VTableIndex index;
-        std::string value_index;
-        vtb_builder->Add(record, &handle);
-
-        index.file_number = meta->number;
-        index.vtable_handle = handle;
-        index.Encode(&value_index);
-        builder->Add(key, Slice(value_index));
+        // No need to separate key and value, or already separated (a
+        // record rewritten by vtable gc or separated on write)
+        builder->Add(key, value);
       }
     }
     if (!key.empty()) {
@@ -132,7 +128,7 @@ Status BuildTable(const std::string& dbname, Env* env, const Options& options,
   } else {
     env->RemoveFile(fname);
   }
-  if (s.ok() && vtable_meta->table_size > 0) {
+  if (s.ok() && vtable_meta->records_num > 0) {
     // Keep it
   } else {
     env->RemoveFile(vtb_name);
@@ -140,4 +136,57 @@ Status BuildTable(const std::string& dbname, Env* env, const Options& options,
   return s;
 }
 
+bool SeparateValue(const Options& options, const Slice& key,
+                   const Slice& value, uint64_t number, VTableBuilder* vtable,
+                   std::string* result) {
+  enum Type : unsigned char {
+    kNonIndexValue = 2,
+  };
+  if (value.empty() ||
+      static_cast<unsigned char>(value[0]) != kNonIndexValue) {
+    return false;
+  }
+  const Slice fields(value.data() + 1, value.size() - 1);
+  const SeparationPolicy* policy = options.separation_policy;
+  // The type byte has always been counted against kv_sep_size
+  if (policy != nullptr ? policy->ShouldSeparate(key, fields)
+                        : value.size() >= options.kv_sep_size) {
+    VTableIndex index;
+    index.file_number = number;
+    vtable->Add(VTableRecord{key, fields}, &index.vtable_handle);
+    result->clear();
+    index.Encode(result);
+    return true;
+  }
+  if (policy == nullptr) {
+    return false;
+  }
+
+  // Move the fields picked by the policy into one record of their own
+  FieldsIndex fields_index;
+  std::string kept, moved;
+  Slice input = fields;
+  Slice name, field_value;
+  while (GetField(&input, &name, &field_value)) {
+    if (policy->ShouldSeparateField(key, name, field_value)) {
+      PutField(&moved, name, field_value);
+      fields_index.separated_names.push_back(name);
+    } else {
+      PutField(&kept, name, field_value);
+    }
+  }
+  if (moved.empty()) {
+    return false;
+  }
+  std::sort(fields_index.separated_names.begin(),
+            fields_index.separated_names.end(),
+            [](const Slice& a, const Slice& b) { return a.compare(b) < 0; });
+  fields_index.index.file_number = number;
+  vtable->Add(VTableRecord{key, moved}, &fields_index.index.vtable_handle);
+  fields_index.inline_fields = kept;
+  result->clear();
+  fields_index.Encode(result);
+  return true;
+}
+
 }  // namespace leveldb
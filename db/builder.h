@@ -16,7 +16,9 @@ struct FileMetaData;
 
 class Env;
 class Iterator;
+class Slice;
 class TableCache;
+class VTableBuilder;
 class VersionEdit;
 
 // Build a Table file from the contents of *iter.  The generated file
@@ -28,6 +30,14 @@ Status BuildTable(const std::string& dbname, Env* env, const Options& options,
                   TableCache* table_cache, Iterator* iter, FileMetaData* meta,
                   VTableMeta* vtable_meta);
 
+// If "value", the raw value of user key "key", or some of its fields
+// are stored apart by options.separation_policy (or options.kv_sep_size),
+// add them to *vtable, the VTable numbered "number", set *result to the
+// raw value that replaces "value" and return true.
+bool SeparateValue(const Options& options, const Slice& key,
+                   const Slice& value, uint64_t number, VTableBuilder* vtable,
+                   std::string* result);
+
 }  // namespace leveldb
 
 #endif  // STORAGE_LEVELDB_DB_BUILDER_H_
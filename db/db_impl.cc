@@ -12,6 +12,7 @@
 #include "db/log_reader.h"
 #include "db/log_writer.h"
 #include "db/memtable.h"
+#include "db/secondary_index.h"
 #include "db/table_cache.h"
 #include "db/version_set.h"
 #include "db/write_batch_internal.h"
@@ -19,12 +20,15 @@
 #include <atomic>
 #include <cstdint>
 #include <cstdio>
+#include <map>
 #include <set>
 #include <string>
 #include <vector>
 
+#include "leveldb/comparator.h"
 #include "leveldb/db.h"
 #include "leveldb/env.h"
+#include "leveldb/field_predicate.h"
 #include "leveldb/status.h"
 #include "leveldb/table.h"
 #include "leveldb/table_builder.h"
@@ -34,12 +38,14 @@
 #include "table/merger.h"
 #include "table/two_level_iterator.h"
 #include "table/vtable_builder.h"
+#include "table/vtable_cache.h"
 #include "table/vtable_format.h"
 #include "table/vtable_manager.h"
 #include "table/vtable_reader.h"
 #include "util/coding.h"
 #include "util/logging.h"
 #include "util/mutexlock.h"
+#include "util/no_destructor.h"
 
 namespace leveldb {
 
@@ -57,6 +63,22 @@ struct DBImpl::Writer {
   port::CondVar cv;
 };
 
+// The VTable large values are appended to as they are written, see
+// Options::kv_sep_on_write.  It has the number of the log file written
+// along with it.
+struct DBImpl::ValueLog {
+  uint64_t number;
+  WritableFile* file;
+  VTableBuilder* builder;
+};
+
+struct DBImpl::Relocation {
+  std::string key;
+  std::string old_index;  // Raw value pointing to the old record
+  std::string new_index;  // Raw value pointing to its copy
+  uint64_t size;          // Size of the copy
+};
+
 struct DBImpl::CompactionState {
   // Files produced by compaction
   struct Output {
@@ -114,6 +136,10 @@ Options SanitizeOptions(const std::string& dbname,
   ClipToRange(&result.write_buffer_size, 64 << 10, 1 << 30);
   ClipToRange(&result.max_file_size, 1 << 20, 1 << 30);
   ClipToRange(&result.block_size, 1 << 10, 4 << 20);
+  if (result.kv_sep_on_write) {
+    // A reused log would need its value log reopened for appending
+    result.reuse_logs = false;
+  }
   if (result.info_log == nullptr) {
     // Open a log file in the same directory as the db
     src.env->CreateDir(dbname);  // In case it does not exist
@@ -130,9 +156,15 @@ Options SanitizeOptions(const std::string& dbname,
   return result;
 }
 
+static int VTableCacheSize(const Options& sanitized_options) {
+  // Reserve ten files or so for other uses and split the rest between
+  // TableCache and VTableCache.
+  return (sanitized_options.max_open_files - kNumNonTableCacheFiles) / 2;
+}
+
 static int TableCacheSize(const Options& sanitized_options) {
-  // Reserve ten files or so for other uses and give the rest to TableCache.
-  return sanitized_options.max_open_files - kNumNonTableCacheFiles;
+  return sanitized_options.max_open_files - kNumNonTableCacheFiles -
+         VTableCacheSize(sanitized_options);
 }
 
 DBImpl::DBImpl(const Options& raw_options, const std::string& dbname)
@@ -154,23 +186,46 @@ DBImpl::DBImpl(const Options& raw_options, const std::string& dbname)
       logfile_(nullptr),
       logfile_number_(0),
       log_(nullptr),
+      vlog_(nullptr),
+      imm_vlog_(nullptr),
       seed_(0),
       tmp_batch_(new WriteBatch),
+      vlog_batch_(new WriteBatch),
       background_compaction_scheduled_(false),
+      background_gc_scheduled_(false),
+      logging_edit_(false),
       manual_compaction_(nullptr),
       versions_(new VersionSet(dbname_, &options_, table_cache_,
                                &internal_comparator_)),
-      vtable_manager_(new VTableManager(dbname, raw_options.env, raw_options.gc_size_threshold)){}
+      vtable_manager_(new VTableManager(raw_options.gc_garbage_ratio)),
+      vtable_cache_(new VTableCache(dbname_, options_, VTableCacheSize(options_),
+                                    vtable_manager_)),
+      scan_cv_(&scan_mutex_),
+      scan_workers_(0),
+      idle_scan_workers_(0),
+      stopping_scan_workers_(false) {
+  vtable_manager_->SetVTableCache(vtable_cache_);
+  versions_->SetVTableManager(vtable_manager_);
+}
 
 DBImpl::~DBImpl() {
   // Wait for background work to finish.
   mutex_.Lock();
   shutting_down_.store(true, std::memory_order_release);
-  while (background_compaction_scheduled_) {
+  while (background_compaction_scheduled_ || background_gc_scheduled_) {
     background_work_finished_signal_.Wait();
   }
   mutex_.Unlock();
 
+  // No scan is running any longer, the workers are idle
+  scan_mutex_.Lock();
+  stopping_scan_workers_ = true;
+  scan_cv_.SignalAll();
+  while (scan_workers_ > 0) {
+    scan_cv_.Wait();
+  }
+  scan_mutex_.Unlock();
+
   if (db_lock_ != nullptr) {
     env_->UnlockFile(db_lock_);
   }
@@ -179,8 +234,19 @@ DBImpl::~DBImpl() {
   if (mem_ != nullptr) mem_->Unref();
   if (imm_ != nullptr) imm_->Unref();
   delete tmp_batch_;
+  delete vlog_batch_;
   delete log_;
   delete logfile_;
+  // Unsealed value logs are left without a footer, recovery reads them
+  // whole
+  for (ValueLog* vlog : {vlog_, imm_vlog_}) {
+    if (vlog != nullptr) {
+      if (vlog->builder != nullptr) vlog->builder->Abandon();
+      delete vlog->builder;
+      delete vlog->file;
+      delete vlog;
+    }
+  }
   delete table_cache_;
 
   if (owns_info_log_) {
@@ -189,6 +255,8 @@ DBImpl::~DBImpl() {
   if (owns_cache_) {
     delete options_.block_cache;
   }
+  // Cached readers drop their vtable references on deletion
+  delete vtable_cache_;
   delete vtable_manager_;
 }
 
@@ -270,6 +338,11 @@ void DBImpl::RemoveObsoleteFiles() {
         case kTableFile:
           keep = (live.find(number) != live.end());
           break;
+        case kVTableFile:
+          // Written by an unfinished flush, compaction or gc unless known
+          keep = (live.find(number) != live.end()) ||
+                 vtable_manager_->HasVTable(number);
+          break;
         case kTempFile:
           // Any temp files that are currently being written to must
           // be recorded in pending_outputs_, which is inserted into "live"
@@ -278,10 +351,13 @@ void DBImpl::RemoveObsoleteFiles() {
         case kCurrentFile:
         case kDBLockFile:
         case kInfoLogFile:
-        case kVTableFile:
-        case kVTableManagerFile:
           keep = true;
           break;
+        case kVTableManagerFile:
+          // Superseded by the vtable records in the MANIFEST, which
+          // Recover imported it into before this runs
+          keep = false;
+          break;
       }
 
       if (!keep) {
@@ -338,6 +414,9 @@ Status DBImpl::Recover(VersionEdit* edit, bool* save_manifest) {
   }
 
   s = versions_->Recover(save_manifest);
+  if (s.ok()) {
+    s = ImportVTableMeta(edit, save_manifest);
+  }
   if (!s.ok()) {
     return s;
   }
@@ -395,14 +474,94 @@ Status DBImpl::Recover(VersionEdit* edit, bool* save_manifest) {
     versions_->SetLastSequence(max_sequence);
   }
 
-  s = vtable_manager_->LoadVTableMeta();
+  return Status::OK();
+}
+
+Status DBImpl::ImportVTableMeta(VersionEdit* edit, bool* save_manifest) {
+  mutex_.AssertHeld();
+  const std::string fname = VTableManagerFileName(dbname_);
+  std::vector<VTableMeta> metas;
+  vtable_manager_->GetVTableMetas(&metas);
+  if (!metas.empty() || !env_->FileExists(fname)) {
+    return Status::OK();
+  }
+  std::string contents;
+  Status s = ReadFileToString(env_, fname, &contents);
   if (!s.ok()) {
-    return Status::Corruption("LoadVTableMeta failed");
+    return s;
   }
 
+  // varint64 count, then per vtable its number, records, invalid records
+  // and size, all varint64
+  Slice input(contents);
+  uint64_t count;
+  if (!GetVarint64(&input, &count)) {
+    return Status::Corruption("bad vtable count", fname);
+  }
+  for (uint64_t i = 0; i < count; i++) {
+    VTableMeta meta;
+    uint64_t invalid_num;
+    if (!GetVarint64(&input, &meta.number) ||
+        !GetVarint64(&input, &meta.records_num) ||
+        !GetVarint64(&input, &invalid_num) ||
+        !GetVarint64(&input, &meta.table_size)) {
+      return Status::Corruption("bad vtable entry", fname);
+    }
+    if (meta.number == 0) {
+      continue;
+    }
+    edit->AddVTable(meta);
+    if (invalid_num > 0 && meta.records_num > 0) {
+      // The bytes were not tracked, take the records to be of even size
+      const uint64_t invalid = std::min(invalid_num, meta.records_num);
+      edit->AddVTableGarbage(meta.number, invalid,
+                             meta.table_size / meta.records_num * invalid);
+    }
+    versions_->MarkFileNumberUsed(meta.number);
+  }
+  Log(options_.info_log, "Imported %llu vtables from %s",
+      static_cast<unsigned long long>(count), fname.c_str());
+  *save_manifest = true;
   return Status::OK();
 }
 
+namespace {
+
+// Counts the values of a logged batch that were separated into value log
+// "number" at write time, and checks that they made it to its file
+class ValueLogChecker : public WriteBatch::Handler {
+ public:
+  ValueLogChecker(uint64_t number, uint64_t file_size)
+      : number_(number), file_size_(file_size), records_(0),
+        complete_(true) {}
+
+  void Put(const Slice& key, const Slice& value) override {
+    VTableIndex index;
+    if (!GetVTableIndex(value, &index) || index.file_number != number_) {
+      return;
+    }
+    const VTableHandle& handle = index.vtable_handle;
+    if (handle.offset + handle.size > file_size_) {
+      complete_ = false;
+    } else {
+      records_++;
+    }
+  }
+
+  void Delete(const Slice& key) override {}
+
+  uint64_t records() const { return records_; }
+  bool complete() const { return complete_; }
+
+ private:
+  const uint64_t number_;
+  const uint64_t file_size_;
+  uint64_t records_;
+  bool complete_;
+};
+
+}  // namespace
+
 Status DBImpl::RecoverLogFile(uint64_t log_number, bool last_log,
                               bool* save_manifest, VersionEdit* edit,
                               SequenceNumber* max_sequence) {
@@ -444,6 +603,13 @@ Status DBImpl::RecoverLogFile(uint64_t log_number, bool last_log,
   Log(options_.info_log, "Recovering log #%llu",
       (unsigned long long)log_number);
 
+  // Values separated at write time are in the value log of the same
+  // number, which may have lost its tail with the log
+  const std::string vlog_name = VTableFileName(dbname_, log_number);
+  uint64_t vlog_size = 0;
+  const bool has_vlog = env_->GetFileSize(vlog_name, &vlog_size).ok();
+  uint64_t vlog_records = 0;
+
   // Read all the records and add to a memtable
   std::string scratch;
   Slice record;
@@ -458,6 +624,17 @@ Status DBImpl::RecoverLogFile(uint64_t log_number, bool last_log,
     }
     WriteBatchInternal::SetContents(&batch, record);
 
+    // Like a torn log tail: the value log lost the values of this batch
+    // and so of every later one, which are all dropped
+    ValueLogChecker checker(log_number, vlog_size);
+    batch.Iterate(&checker);
+    if (!checker.complete()) {
+      Log(options_.info_log, "%s: value log truncated, dropping the rest",
+          fname.c_str());
+      break;
+    }
+    vlog_records += checker.records();
+
     if (mem == nullptr) {
       mem = new MemTable(internal_comparator_);
       mem->Ref();
@@ -490,7 +667,8 @@ Status DBImpl::RecoverLogFile(uint64_t log_number, bool last_log,
   delete file;
 
   // See if we should keep reusing the last log file.
-  if (status.ok() && options_.reuse_logs && last_log && compactions == 0) {
+  if (status.ok() && options_.reuse_logs && !has_vlog && last_log &&
+      compactions == 0) {
     assert(logfile_ == nullptr);
     assert(log_ == nullptr);
     assert(mem_ == nullptr);
@@ -520,6 +698,18 @@ Status DBImpl::RecoverLogFile(uint64_t log_number, bool last_log,
     mem->Unref();
   }
 
+  // The tables written above point into the value log, it becomes a
+  // vtable like theirs.  Its unreferenced tail is left as garbage.
+  if (status.ok() && vlog_records > 0 &&
+      !vtable_manager_->HasVTable(log_number)) {
+    VTableMeta vlog_meta;
+    vlog_meta.number = log_number;
+    vlog_meta.records_num = vlog_records;
+    vlog_meta.table_size = vlog_size;
+    edit->AddVTable(vlog_meta);
+    *save_manifest = true;
+  }
+
   return status;
 }
 
@@ -559,8 +749,9 @@ Status DBImpl::WriteLevel0Table(MemTable* mem, VersionEdit* edit,
     }
     edit->AddFile(level, meta.number, meta.file_size, meta.smallest,
                   meta.largest);
-    if (vtable_meta.number > 0) {
-      vtable_manager_->AddVTable(vtable_meta);
+    if (vtable_meta.records_num > 0) {
+      // An empty vtable has been deleted already
+      edit->AddVTable(vtable_meta);
     }
   }
 
@@ -575,12 +766,27 @@ void DBImpl::CompactMemTable() {
   mutex_.AssertHeld();
   assert(imm_ != nullptr);
 
-  // Save the contents of the memtable as a new Table
+  // Seal the value log the memtable points into, it is registered along
+  // with the table
+  Status s;
   VersionEdit edit;
-  Version* base = versions_->current();
-  base->Ref();
-  Status s = WriteLevel0Table(imm_, &edit, base);
-  base->Unref();
+  if (imm_vlog_ != nullptr && imm_vlog_->builder != nullptr) {
+    VTableMeta vlog_meta;
+    mutex_.Unlock();
+    s = SealValueLog(imm_vlog_, &vlog_meta);
+    mutex_.Lock();
+    if (s.ok() && vlog_meta.records_num > 0) {
+      edit.AddVTable(vlog_meta);
+    }
+  }
+
+  // Save the contents of the memtable as a new Table
+  if (s.ok()) {
+    Version* base = versions_->current();
+    base->Ref();
+    s = WriteLevel0Table(imm_, &edit, base);
+    base->Unref();
+  }
 
   if (s.ok() && shutting_down_.load(std::memory_order_acquire)) {
     s = Status::IOError("Deleting DB during memtable compaction");
@@ -590,16 +796,21 @@ void DBImpl::CompactMemTable() {
   if (s.ok()) {
     edit.SetPrevLogNumber(0);
     edit.SetLogNumber(logfile_number_);  // Earlier logs no longer needed
-    s = versions_->LogAndApply(&edit, &mutex_);
-    if (s.ok()) {
-      s = vtable_manager_->SaveVTableMeta();
-    }
+    s = LogAndApply(&edit);
   }
 
   if (s.ok()) {
     // Commit to the new state
     imm_->Unref();
     imm_ = nullptr;
+    if (imm_vlog_ != nullptr) {
+      // Readers opened while it grew hold no reference, reopen them.  An
+      // empty value log is not registered and goes away here.
+      vtable_cache_->Evict(imm_vlog_->number);
+      pending_outputs_.erase(imm_vlog_->number);
+      delete imm_vlog_;
+      imm_vlog_ = nullptr;
+    }
     has_imm_.store(false, std::memory_order_release);
     RemoveObsoleteFiles();
   } else {
@@ -729,6 +940,8 @@ void DBImpl::BackgroundCall() {
   // Previous compaction may have produced too many files in a level,
   // so reschedule another compaction if needed.
   MaybeScheduleCompaction();
+  // It may also have left enough garbage in some vtables
+  MaybeScheduleGarbageCollect();
   background_work_finished_signal_.SignalAll();
 }
 
@@ -769,13 +982,7 @@ void DBImpl::BackgroundCompaction() {
     c->edit()->RemoveFile(c->level(), f->number);
     c->edit()->AddFile(c->level() + 1, f->number, f->file_size, f->smallest,
                        f->largest);
-    status = versions_->LogAndApply(c->edit(), &mutex_);
-    if (!status.ok()) {
-      RecordBackgroundError(status);
-    }
-
-    status = vtable_manager_->SaveVTableMeta();
-
+    status = LogAndApply(c->edit());
     if (!status.ok()) {
       RecordBackgroundError(status);
     }
@@ -899,14 +1106,13 @@ Status DBImpl::FinishCompactionOutputFile(CompactionState* compact,
   compact->outfile = nullptr;
 
   if (compact->vtable_builder != nullptr && s.ok()) {
+    s = compact->vtable_builder->Finish();
     VTableMeta meta;
     meta.invalid_num = 0;
     meta.number = compact->vtb_num;
     meta.records_num = compact->vtable_builder->RecordNumber();
     meta.table_size = compact->vtable_builder->FileSize();
     compact->total_bytes += meta.table_size;
-
-    s = compact->vtable_builder->Finish();
     delete compact->vtable_builder;
     compact->vtable_builder = nullptr;
     if (s.ok()) {
@@ -917,7 +1123,11 @@ Status DBImpl::FinishCompactionOutputFile(CompactionState* compact,
     }
     delete compact->vtb_file;
     compact->vtb_file = nullptr;
-    vtable_manager_->AddVTable(meta);
+    if (s.ok()) {
+      compact->compaction->edit()->AddVTable(meta);
+    }
+    // The next output gets a vtable of its own
+    compact->vtb_num = 0;
   }
 
   if (s.ok() && current_entries > 0) {
@@ -951,7 +1161,7 @@ Status DBImpl::InstallCompactionResults(CompactionState* compact) {
     compact->compaction->edit()->AddFile(level + 1, out.number, out.file_size,
                                          out.smallest, out.largest);
   }
-  return versions_->LogAndApply(compact->compaction->edit(), &mutex_);
+  return LogAndApply(compact->compaction->edit());
 }
 
 bool GetValueType(const Slice& input, unsigned char* value) {
@@ -1078,12 +1288,11 @@ Status DBImpl::DoCompactionWork(CompactionState* compact) {
 
       auto value = input->value();
       std::string new_value = value.ToString();
-      unsigned char type;
-      if(!GetValueType(value, &type)) {
-        break;
-      }
+      // Deletion markers have no value, and so no type
+      unsigned char type = 0;
+      GetValueType(value, &type);
 
-      if (type == kVTableIndex) {
+      if (type == kVTableIndex || type == FieldsIndex::kFieldsIndex) {
         if (compact->compaction->level() >= config::kNumLevels - config::kLevelMergeLevel) {
           if (compact->vtable_builder == nullptr) {
             auto fname = VTableFileName(dbname_, compact->vtb_num);
@@ -1094,21 +1303,42 @@ Status DBImpl::DoCompactionWork(CompactionState* compact) {
           VTableIndex index;
           VTableRecord record;
           VTableHandle handle;
+          PinnableSlice pinned;
+          ReadOptions read_options;
+          // The old record is about to become garbage; do not carry a
+          // damaged one over into the new vtable
+          read_options.fill_cache = false;
+          read_options.verify_checksums = true;
+
+          // Only the pointer of a partly separated value changes, its
+          // inline fields are kept
+          FieldsIndex fields_index;
+          if (type == kVTableIndex) {
+            status = index.Decode(&value);
+          } else {
+            status = fields_index.Decode(&value);
+            index = fields_index.index;
+          }
+          if (status.ok()) {
+            status = vtable_cache_->Get(read_options, index, &record, &pinned);
+          }
+          if (!status.ok()) {
+            break;
+          }
 
-          status = index.Decode(&value);
-
-          VTableReader reader(index.file_number, this->vtable_manager_);
-          std::string vtb_name = VTableFileName(this->dbname_, index.file_number);
-          status = reader.Open(this->options_, vtb_name);
-          status = reader.Get(index.vtable_handle, &record);
-
-          reader.Close();
-          vtable_manager_->AddInvalid(index.file_number);
+          compact->compaction->edit()->AddVTableGarbage(
+              index.file_number, 1, index.vtable_handle.size);
           compact->vtable_builder->Add(record, &handle);
           VTableIndex new_index;
           new_index.file_number = compact->vtb_num;
           new_index.vtable_handle = handle;
-          new_index.Encode(&new_value);
+          new_value.clear();
+          if (type == kVTableIndex) {
+            new_index.Encode(&new_value);
+          } else {
+            fields_index.index = new_index;
+            fields_index.Encode(&new_value);
+          }
         }
       }
 
@@ -1123,15 +1353,11 @@ Status DBImpl::DoCompactionWork(CompactionState* compact) {
         }
       }
     } else {
-      unsigned char type;
       auto value = input->value();
-      if(!GetValueType(value, &type)) {
-        break;
-      }
-      if (type == kVTableIndex) {
-        VTableIndex vtable_index;
-        vtable_index.Decode(&value);
-        vtable_manager_->AddInvalid(vtable_index.file_number);
+      VTableIndex vtable_index;
+      if (GetVTableIndex(value, &vtable_index)) {
+        compact->compaction->edit()->AddVTableGarbage(
+            vtable_index.file_number, 1, vtable_index.vtable_handle.size);
       }
     }
 
@@ -1170,191 +1396,596 @@ Status DBImpl::DoCompactionWork(CompactionState* compact) {
   if (!status.ok()) {
     RecordBackgroundError(status);
   }
-
-  status = vtable_manager_->SaveVTableMeta();
-  if (!status.ok()) {
-    RecordBackgroundError(status);
-  }
   VersionSet::LevelSummaryStorage tmp;
   Log(options_.info_log, "compacted to: %s", versions_->LevelSummary(&tmp));
   return status;
 }
 
-namespace {
-
-struct IterState {
-  port::Mutex* const mu;
-  Version* const version GUARDED_BY(mu);
-  MemTable* const mem GUARDED_BY(mu);
-  MemTable* const imm GUARDED_BY(mu);
-
-  IterState(port::Mutex* mutex, MemTable* mem, MemTable* imm, Version* version)
-      : mu(mutex), version(version), mem(mem), imm(imm) {}
-};
-
-static void CleanupIteratorState(void* arg1, void* arg2) {
-  IterState* state = reinterpret_cast<IterState*>(arg1);
-  state->mu->Lock();
-  state->mem->Unref();
-  if (state->imm != nullptr) state->imm->Unref();
-  state->version->Unref();
-  state->mu->Unlock();
-  delete state;
-}
-
-}  // anonymous namespace
-
-Iterator* DBImpl::NewInternalIterator(const ReadOptions& options,
-                                      SequenceNumber* latest_snapshot,
-                                      uint32_t* seed) {
-  mutex_.Lock();
-  *latest_snapshot = versions_->LastSequence();
-
-  // Collect together all needed child iterators
-  std::vector<Iterator*> list;
-  list.push_back(mem_->NewIterator());
-  mem_->Ref();
-  if (imm_ != nullptr) {
-    list.push_back(imm_->NewIterator());
-    imm_->Ref();
+void DBImpl::MaybeScheduleGarbageCollect() {
+  mutex_.AssertHeld();
+  if (background_gc_scheduled_) {
+    // Already running
+  } else if (shutting_down_.load(std::memory_order_acquire)) {
+    // DB is being deleted; no more background gc
+  } else if (!bg_error_.ok()) {
+    // Already got an error; no more changes
+  } else if (!vtable_manager_->NeedsGarbageCollect() &&
+             !HasReleasableVTables()) {
+    // No work to be done
+  } else {
+    background_gc_scheduled_ = true;
+    env_->StartThread(&DBImpl::BGGarbageCollectWork, this);
   }
-  versions_->current()->AddIterators(options, &list);
-  Iterator* internal_iter =
-      NewMergingIterator(&internal_comparator_, &list[0], list.size());
-  versions_->current()->Ref();
-
-  IterState* cleanup = new IterState(&mutex_, mem_, imm_, versions_->current());
-  internal_iter->RegisterCleanup(CleanupIteratorState, cleanup, nullptr);
-
-  *seed = ++seed_;
-  mutex_.Unlock();
-  return internal_iter;
 }
 
-Iterator* DBImpl::TEST_NewInternalIterator() {
-  SequenceNumber ignored;
-  uint32_t ignored_seed;
-  return NewInternalIterator(ReadOptions(), &ignored, &ignored_seed);
+void DBImpl::BGGarbageCollectWork(void* db) {
+  reinterpret_cast<DBImpl*>(db)->BackgroundGarbageCollectCall();
 }
 
-int64_t DBImpl::TEST_MaxNextLevelOverlappingBytes() {
+void DBImpl::BackgroundGarbageCollectCall() {
   MutexLock l(&mutex_);
-  return versions_->MaxNextLevelOverlappingBytes();
-}
-
-Status DBImpl::DecodeValue(std::string* value) const {
-  enum Type : unsigned char {
-    kVTableIndex = 1,
-    kNonIndexValue = 2,
-  };
-  std::string tmp = *value;
-  auto input = new Slice(tmp);
-  unsigned char type;
-  if (!GetValueType(*input, &type)) {
-    return Status::Corruption("Fatal Value Error");
-  }
-  if (type == kNonIndexValue) {
-    input->remove_prefix(1);
-    *value = input->ToString();
-    return Status::OK();
+  assert(background_gc_scheduled_);
+  if (!shutting_down_.load(std::memory_order_acquire) && bg_error_.ok()) {
+    BackgroundGarbageCollect();
   }
-  if (type == kVTableIndex) {
-    VTableIndex index;
-    VTableRecord record;
+  background_gc_scheduled_ = false;
+  MaybeScheduleGarbageCollect();
+  background_work_finished_signal_.SignalAll();
+}
 
-    Status s = index.Decode(input);
-    if (!s.ok()) {
-      return s;
-    }
+void DBImpl::BackgroundGarbageCollect() {
+  mutex_.AssertHeld();
+  ReleaseObsoleteVTables();
 
-    VTableReader reader(index.file_number, this->vtable_manager_);
-    std::string vtb_name = VTableFileName(this->dbname_, index.file_number);
-    s = reader.Open(this->options_, vtb_name);
-    if (!s.ok()) {
-      reader.Close();
-      return s;
+  std::vector<VTableMeta> victims;
+  vtable_manager_->PickGarbageCollect(options_.gc_max_bytes_per_run, &victims);
+  for (const VTableMeta& victim : victims) {
+    if (shutting_down_.load(std::memory_order_acquire)) {
+      // Picked vtables are not picked again until the DB is reopened
+      break;
     }
-
-    s = reader.Get(index.vtable_handle, &record);
-    if (!s.ok()) {
-      reader.Close();
-      return s;
+    Status s = RelocateVTable(victim);
+    if (s.IsNotFound()) {
+      // Its file is gone, drop it from the MANIFEST too
+      VersionEdit edit;
+      edit.DropVTable(victim.number);
+      s = LogAndApply(&edit);
+      if (!s.ok()) {
+        RecordBackgroundError(s);
+        break;
+      }
+    } else if (!s.ok()) {
+      // The vtable keeps its records and is retried after a reopen
+      Log(options_.info_log, "VTable #%llu gc error: %s",
+          static_cast<unsigned long long>(victim.number),
+          s.ToString().c_str());
     }
-    *value = record.value.ToString();
-    reader.Close();
-    return s;
   }
-  return Status::Corruption("Unsupported value type");
-
+  ReleaseObsoleteVTables();
 }
 
-
-Status DBImpl::Get(const ReadOptions& options, const Slice& key,
-                   std::string* value) {
+Status DBImpl::GetRawValue(MemTable* mem, MemTable* imm, Version* current,
+                           const Slice& key, SequenceNumber sequence,
+                           std::string* raw) {
   Status s;
-  MutexLock l(&mutex_);
-  SequenceNumber snapshot;
-  if (options.snapshot != nullptr) {
-    snapshot =
-        static_cast<const SnapshotImpl*>(options.snapshot)->sequence_number();
+  LookupKey lkey(key, sequence);
+  if (mem->Get(lkey, raw, &s)) {
+    // Done
+  } else if (imm != nullptr && imm->Get(lkey, raw, &s)) {
+    // Done
   } else {
-    snapshot = versions_->LastSequence();
+    ReadOptions options;
+    options.fill_cache = false;
+    Version::GetStats stats;
+    s = current->Get(options, lkey, raw, &stats);
   }
+  return s;
+}
 
+Status DBImpl::RelocateVTable(const VTableMeta& victim) {
+  mutex_.AssertHeld();
   MemTable* mem = mem_;
   MemTable* imm = imm_;
   Version* current = versions_->current();
   mem->Ref();
   if (imm != nullptr) imm->Ref();
   current->Ref();
+  const SequenceNumber sequence = versions_->LastSequence();
+  const uint64_t new_number = versions_->NewFileNumber();
+  pending_outputs_.insert(new_number);
 
-  bool have_stat_update = false;
-  Version::GetStats stats;
-
-  // Unlock while reading from files and memtables
+  std::vector<Relocation> relocations;
+  VTableMeta new_meta;
+  Status s;
   {
     mutex_.Unlock();
-    // First look in the memtable, then in the immutable memtable (if any).
-    LookupKey lkey(key, snapshot);
-    if (mem->Get(lkey, value, &s)) {
-      // Done
-    } else if (imm != nullptr && imm->Get(lkey, value, &s)) {
-      // Done
-    } else {
-      s = current->Get(options, lkey, value, &stats);
-      have_stat_update = true;
-    }
+    // Scan the victim front to back; a record is live iff its key, as of
+    // "sequence", still points to it
+    const std::string fname = VTableFileName(dbname_, victim.number);
+    const std::string new_fname = VTableFileName(dbname_, new_number);
+    VTableReader reader(victim.number);
+    s = reader.Open(options_, fname, /*use_mmap=*/false,
+                    RandomAccessFile::kSequential);
+    // Records end where the properties start; a vtable without footer
+    // holds nothing but records after the file header
+    uint64_t data_size = 0;
     if (s.ok()) {
-      s = DecodeValue(value);
+      VTableProperties properties;
+      s = reader.ReadProperties(&properties);
+      if (s.ok()) {
+        data_size = properties.data_size;
+      } else if (s.IsNotFound()) {
+        s = env_->GetFileSize(fname, &data_size);
+      }
     }
-    if (s.ok()) {
-      auto fields = Fields(Slice(*value));
-      *value = fields["1"];
-    } else {
-      *value = "";
+
+    WritableFile* file = nullptr;
+    VTableBuilder* builder = nullptr;
+    std::string scratch;
+    std::string buffer;
+    std::string raw;
+    uint64_t offset = reader.DataOffset();
+    while (s.ok() && offset < data_size &&
+           !shutting_down_.load(std::memory_order_acquire)) {
+      VTableIndex old_index;
+      old_index.file_number = victim.number;
+      VTableRecord record;
+      s = reader.ReadRecord(offset, data_size, &old_index.vtable_handle,
+                            &record, &scratch, &buffer);
+      if (!s.ok()) {
+        break;
+      }
+      offset += old_index.vtable_handle.size;
+
+      raw.clear();
+      VTableIndex current_index;
+      if (!GetRawValue(mem, imm, current, record.key, sequence, &raw).ok() ||
+          !GetVTableIndex(raw, &current_index) ||
+          !(current_index == old_index)) {
+        // Overwritten or deleted
+        continue;
+      }
+      Relocation relocation;
+      relocation.old_index = raw;
+
+      if (builder == nullptr) {
+        s = env_->NewWritableFile(new_fname, &file);
+        if (!s.ok()) {
+          break;
+        }
+        builder = new VTableBuilder(options_, file);
+      }
+      VTableIndex new_index;
+      new_index.file_number = new_number;
+      builder->Add(record, &new_index.vtable_handle);
+      if (static_cast<unsigned char>(raw[0]) == FieldsIndex::kFieldsIndex) {
+        // Keep the inline fields of a partly separated value
+        FieldsIndex fields_index;
+        Slice input(raw);
+        s = fields_index.Decode(&input);
+        if (!s.ok()) {
+          break;
+        }
+        fields_index.index = new_index;
+        fields_index.Encode(&relocation.new_index);
+      } else {
+        new_index.Encode(&relocation.new_index);
+      }
+      relocation.key = record.key.ToString();
+      relocation.size = new_index.vtable_handle.size;
+      relocations.push_back(std::move(relocation));
+    }
+    if (s.ok() && shutting_down_.load(std::memory_order_acquire)) {
+      s = Status::IOError("Deleting DB during vtable gc");
     }
-    mutex_.Lock();
-  }
 
-  if (have_stat_update && current->UpdateStats(stats)) {
-    MaybeScheduleCompaction();
+    if (builder != nullptr) {
+      if (s.ok()) {
+        s = builder->Finish();
+      } else {
+        builder->Abandon();
+      }
+      new_meta.number = new_number;
+      new_meta.records_num = builder->RecordNumber();
+      new_meta.table_size = builder->FileSize();
+      delete builder;
+      if (s.ok()) {
+        s = file->Sync();
+      }
+      if (s.ok()) {
+        s = file->Close();
+      }
+      delete file;
+      if (!s.ok()) {
+        env_->RemoveFile(new_fname);
+      }
+    }
+    mutex_.Lock();
   }
   mem->Unref();
   if (imm != nullptr) imm->Unref();
   current->Unref();
+
+  SequenceNumber obsolete_sequence = sequence;
+  if (s.ok() && !relocations.empty()) {
+    // Record the new vtable before any key points into it
+    VersionEdit edit;
+    edit.AddVTable(new_meta);
+    s = LogAndApply(&edit);
+    if (s.ok()) {
+      edit.Clear();
+      s = WriteRelocations(relocations, new_number, &edit,
+                           &obsolete_sequence);
+      if (s.ok()) {
+        s = LogAndApply(&edit);
+      }
+    }
+  }
+  pending_outputs_.erase(new_number);
+  if (!s.ok()) {
+    return s;
+  }
+  obsolete_vtables_.push_back(
+      ObsoleteVTable{victim.number, victim.table_size, obsolete_sequence});
+
+  Log(options_.info_log, "VTable #%llu gc: %zu live records moved to #%llu",
+      static_cast<unsigned long long>(victim.number), relocations.size(),
+      static_cast<unsigned long long>(new_number));
   return s;
 }
 
-Status DBImpl::Get(const ReadOptions& options, const Slice& key,
-                   Fields* fields) {
-  Status s;
-  MutexLock l(&mutex_);
-  SequenceNumber snapshot;
+Status DBImpl::WriteRelocations(const std::vector<Relocation>& relocations,
+                                uint64_t new_number, VersionEdit* edit,
+                                SequenceNumber* sequence) {
+  mutex_.AssertHeld();
+  // Become the only writer, so that no key changes between the check
+  // below and the write.  A writer without a batch may be swept into the
+  // group of an earlier sync writer and reported done, just queue up
+  // again.  The write is synced: the old vtable may be deleted as soon
+  // as it is applied.
+  Writer w(&mutex_);
+  w.sync = true;
+  do {
+    w.done = false;
+    writers_.push_back(&w);
+    while (!w.done && &w != writers_.front()) {
+      w.cv.Wait();
+    }
+  } while (w.done);
+
+  // Unlike Write(), do not wait in MakeRoomForWrite(), which would keep
+  // the destructor waiting if the DB is closed meanwhile.  A few small
+  // entries past the write buffer size do no harm.
+  Status status = bg_error_;
+  uint64_t last_sequence = versions_->LastSequence();
+  if (status.ok()) {
+    MemTable* mem = mem_;
+    MemTable* imm = imm_;
+    Version* current = versions_->current();
+    mem->Ref();
+    if (imm != nullptr) imm->Ref();
+    current->Ref();
+    mutex_.Unlock();
+    WriteBatch batch;
+    std::string raw;
+    for (const Relocation& relocation : relocations) {
+      raw.clear();
+      if (GetRawValue(mem, imm, current, relocation.key, last_sequence, &raw)
+              .ok() &&
+          raw == relocation.old_index) {
+        batch.Put(relocation.key, relocation.new_index);
+      } else {
+        // Changed since the scan, the copy is garbage from the start
+        edit->AddVTableGarbage(new_number, 1, relocation.size);
+      }
+    }
+    if (WriteBatchInternal::Count(&batch) > 0) {
+      WriteBatchInternal::SetSequence(&batch, last_sequence + 1);
+      last_sequence += WriteBatchInternal::Count(&batch);
+      status = log_->AddRecord(WriteBatchInternal::Contents(&batch));
+      if (status.ok()) {
+        status = logfile_->Sync();
+      }
+      if (status.ok()) {
+        status = WriteBatchInternal::InsertInto(&batch, mem);
+      }
+    }
+    mutex_.Lock();
+    mem->Unref();
+    if (imm != nullptr) imm->Unref();
+    current->Unref();
+    if (!status.ok()) {
+      // As for a failed sync in Write(), the log is in an unknown state
+      RecordBackgroundError(status);
+    }
+    versions_->SetLastSequence(last_sequence);
+  }
+
+  assert(writers_.front() == &w);
+  writers_.pop_front();
+  if (!writers_.empty()) {
+    writers_.front()->cv.Signal();
+  }
+  *sequence = last_sequence;
+  return status;
+}
+
+SequenceNumber DBImpl::OldestReadSequence() {
+  mutex_.AssertHeld();
+  SequenceNumber oldest = kMaxSequenceNumber;
+  if (!snapshots_.empty()) {
+    oldest = std::min(oldest, snapshots_.oldest()->sequence_number());
+  }
+  if (!read_pins_.empty()) {
+    oldest = std::min(oldest, read_pins_.oldest()->sequence_number());
+  }
+  return oldest;
+}
+
+const SnapshotImpl* DBImpl::PinReadSequence() {
+  mutex_.AssertHeld();
+  return read_pins_.New(versions_->LastSequence());
+}
+
+void DBImpl::UnpinReadSequence(const SnapshotImpl* pin) {
+  mutex_.AssertHeld();
+  read_pins_.Delete(pin);
+  if (!obsolete_vtables_.empty()) {
+    MaybeScheduleGarbageCollect();
+  }
+}
+
+void DBImpl::ReleaseReadPin(void* db, void* pin) {
+  DBImpl* impl = reinterpret_cast<DBImpl*>(db);
+  MutexLock l(&impl->mutex_);
+  impl->UnpinReadSequence(reinterpret_cast<const SnapshotImpl*>(pin));
+}
+
+bool DBImpl::HasReleasableVTables() {
+  mutex_.AssertHeld();
+  const SequenceNumber oldest = OldestReadSequence();
+  bool any = false;
+  uint64_t size = 0;
+  for (const ObsoleteVTable& obsolete : obsolete_vtables_) {
+    if (obsolete.sequence <= oldest) {
+      any = true;
+      size += obsolete.size;
+    }
+  }
+  return any && size >= options_.gc_size_threshold;
+}
+
+void DBImpl::ReleaseObsoleteVTables() {
+  mutex_.AssertHeld();
+  if (!HasReleasableVTables()) {
+    return;
+  }
+  const SequenceNumber oldest = OldestReadSequence();
+  VersionEdit edit;
+  std::vector<ObsoleteVTable> released;
+  std::vector<ObsoleteVTable> pending;
+  for (const ObsoleteVTable& obsolete : obsolete_vtables_) {
+    if (obsolete.sequence <= oldest) {
+      edit.DropVTable(obsolete.number);
+      released.push_back(obsolete);
+    } else {
+      pending.push_back(obsolete);
+    }
+  }
+  // LogAndApply() may queue more
+  obsolete_vtables_.swap(pending);
+  Status s = LogAndApply(&edit);
+  if (!s.ok()) {
+    obsolete_vtables_.insert(obsolete_vtables_.end(), released.begin(),
+                             released.end());
+    RecordBackgroundError(s);
+    return;
+  }
+  // Only remove the released files, a full RemoveObsoleteFiles() here would
+  // race with flushes whose outputs are not yet in a version
+  mutex_.Unlock();
+  for (const ObsoleteVTable& obsolete : released) {
+    env_->RemoveFile(VTableFileName(dbname_, obsolete.number));
+  }
+  mutex_.Lock();
+}
+
+void DBImpl::QueueInvalidVTables() {
+  mutex_.AssertHeld();
+  std::vector<VTableMeta> invalid;
+  vtable_manager_->TakeInvalidVTables(&invalid);
+  // A read pinned at the last sequence may still hold the version before
+  // the garbage, only later ones cannot
+  const SequenceNumber sequence = versions_->LastSequence() + 1;
+  for (const VTableMeta& meta : invalid) {
+    obsolete_vtables_.push_back(
+        ObsoleteVTable{meta.number, meta.table_size, sequence});
+  }
+  if (!invalid.empty()) {
+    MaybeScheduleGarbageCollect();
+  }
+}
+
+Status DBImpl::LogAndApply(VersionEdit* edit) {
+  mutex_.AssertHeld();
+  while (logging_edit_) {
+    background_work_finished_signal_.Wait();
+  }
+  logging_edit_ = true;
+  Status s = versions_->LogAndApply(edit, &mutex_);
+  logging_edit_ = false;
+  background_work_finished_signal_.SignalAll();
+  if (s.ok()) {
+    QueueInvalidVTables();
+  }
+  return s;
+}
+
+namespace {
+
+struct IterState {
+  port::Mutex* const mu;
+  Version* const version GUARDED_BY(mu);
+  MemTable* const mem GUARDED_BY(mu);
+  MemTable* const imm GUARDED_BY(mu);
+
+  IterState(port::Mutex* mutex, MemTable* mem, MemTable* imm, Version* version)
+      : mu(mutex), version(version), mem(mem), imm(imm) {}
+};
+
+static void CleanupIteratorState(void* arg1, void* arg2) {
+  IterState* state = reinterpret_cast<IterState*>(arg1);
+  state->mu->Lock();
+  state->mem->Unref();
+  if (state->imm != nullptr) state->imm->Unref();
+  state->version->Unref();
+  state->mu->Unlock();
+  delete state;
+}
+
+}  // anonymous namespace
+
+Iterator* DBImpl::NewInternalIterator(const ReadOptions& options,
+                                      SequenceNumber* latest_snapshot,
+                                      uint32_t* seed) {
+  mutex_.Lock();
+  *latest_snapshot = versions_->LastSequence();
+
+  // Collect together all needed child iterators
+  std::vector<Iterator*> list;
+  list.push_back(mem_->NewIterator());
+  mem_->Ref();
+  if (imm_ != nullptr) {
+    list.push_back(imm_->NewIterator());
+    imm_->Ref();
+  }
+  versions_->current()->AddIterators(options, &list);
+  Iterator* internal_iter =
+      NewMergingIterator(&internal_comparator_, &list[0], list.size());
+  versions_->current()->Ref();
+
+  IterState* cleanup = new IterState(&mutex_, mem_, imm_, versions_->current());
+  internal_iter->RegisterCleanup(CleanupIteratorState, cleanup, nullptr);
+
+  *seed = ++seed_;
+  mutex_.Unlock();
+  return internal_iter;
+}
+
+Iterator* DBImpl::TEST_NewInternalIterator() {
+  SequenceNumber ignored;
+  uint32_t ignored_seed;
+  return NewInternalIterator(ReadOptions(), &ignored, &ignored_seed);
+}
+
+int64_t DBImpl::TEST_MaxNextLevelOverlappingBytes() {
+  MutexLock l(&mutex_);
+  return versions_->MaxNextLevelOverlappingBytes();
+}
+
+Status DBImpl::DecodeValue(const ReadOptions& options, Slice raw,
+                           PinnableSlice* value) const {
+  enum Type : unsigned char {
+    kVTableIndex = 1,
+    kNonIndexValue = 2,
+  };
+  value->Reset();
+  unsigned char type;
+  if (!GetValueType(raw, &type)) {
+    return Status::Corruption("Fatal Value Error");
+  }
+  if (type == kNonIndexValue) {
+    raw.remove_prefix(1);
+    // Stays in the caller's buffer (possibly value->GetSelf())
+    value->PinSlice(raw, nullptr, nullptr, nullptr);
+    return Status::OK();
+  }
+  if (type == kVTableIndex) {
+    VTableIndex index;
+    VTableRecord record;
+
+    // Decode the index before the read may reuse the buffer holding raw
+    Status s = index.Decode(&raw);
+    if (!s.ok()) {
+      return s;
+    }
+
+    return vtable_cache_->Get(options, index, &record, value);
+  }
+  if (type == FieldsIndex::kFieldsIndex) {
+    FieldsIndex fields_index;
+    Status s = fields_index.Decode(&raw);
+    if (!s.ok()) {
+      return s;
+    }
+    if (options.fields != nullptr &&
+        std::none_of(options.fields->begin(), options.fields->end(),
+                     [&fields_index](const std::string& name) {
+                       return fields_index.IsSeparated(name);
+                     })) {
+      // The fields asked for are inline if they exist at all
+      value->PinSlice(fields_index.inline_fields, nullptr, nullptr, nullptr);
+      return Status::OK();
+    }
+
+    VTableRecord record;
+    PinnableSlice separated;
+    s = vtable_cache_->Get(options, fields_index.index, &record, &separated);
+    if (!s.ok()) {
+      return s;
+    }
+    // raw may live in value->GetSelf(), merge aside
+    std::string merged;
+    MergeFields(fields_index.inline_fields, separated, &merged);
+    value->GetSelf()->swap(merged);
+    value->PinSelf();
+    return Status::OK();
+  }
+  return Status::Corruption("Unsupported value type");
+}
+
+void DBImpl::DecodeValues(const ReadOptions& options, size_t n,
+                          const Slice* raws, PinnableSlice* values,
+                          Status* statuses) const {
+  std::vector<VTableCache::Read> reads;
+  for (size_t i = 0; i < n; i++) {
+    if (!statuses[i].ok()) {
+      continue;
+    }
+    Slice raw = raws[i];
+    unsigned char type;
+    if (GetValueType(raw, &type) && type == VTableIndex::kVTableIndex) {
+      VTableCache::Read read;
+      statuses[i] = read.index.Decode(&raw);
+      if (statuses[i].ok()) {
+        read.value = &values[i];
+        read.status = &statuses[i];
+        reads.push_back(read);
+        continue;
+      }
+      values[i].Reset();
+      continue;
+    }
+    statuses[i] = DecodeValue(options, raw, &values[i]);
+  }
+  if (!reads.empty()) {
+    vtable_cache_->MultiGet(options, &reads);
+  }
+}
+
+Status DBImpl::GetEncodedFields(const ReadOptions& options, const Slice& key,
+                                PinnableSlice* value) {
+  Status s;
+  MutexLock l(&mutex_);
+  SequenceNumber snapshot;
+  // Keeps vtable gc from dropping the vtable the index read points into
+  const SnapshotImpl* pin = nullptr;
   if (options.snapshot != nullptr) {
     snapshot =
         static_cast<const SnapshotImpl*>(options.snapshot)->sequence_number();
   } else {
-    snapshot = versions_->LastSequence();
+    pin = PinReadSequence();
+    snapshot = pin->sequence_number();
   }
 
   MemTable* mem = mem_;
@@ -1370,24 +2001,22 @@ Status DBImpl::Get(const ReadOptions& options, const Slice& key,
   // Unlock while reading from files and memtables
   {
     mutex_.Unlock();
-    auto value = new std::string();
+    value->Reset();
+    // The raw value is small for separated values, read it into the
+    // buffer the final value may end up in
+    std::string* raw = value->GetSelf();
     // First look in the memtable, then in the immutable memtable (if any).
     LookupKey lkey(key, snapshot);
-    if (mem->Get(lkey, value, &s)) {
+    if (mem->Get(lkey, raw, &s)) {
       // Done
-    } else if (imm != nullptr && imm->Get(lkey, value, &s)) {
+    } else if (imm != nullptr && imm->Get(lkey, raw, &s)) {
       // Done
     } else {
-      s = current->Get(options, lkey, value, &stats);
+      s = current->Get(options, lkey, raw, &stats);
       have_stat_update = true;
     }
     if (s.ok()) {
-      s = DecodeValue(value);
-    }
-    if (s.ok()) {
-      *fields = Fields(Slice(*value));
-    } else {
-      *fields = Fields();
+      s = DecodeValue(options, Slice(*raw), value);
     }
     mutex_.Lock();
   }
@@ -1398,36 +2027,404 @@ Status DBImpl::Get(const ReadOptions& options, const Slice& key,
   mem->Unref();
   if (imm != nullptr) imm->Unref();
   current->Unref();
+  if (pin != nullptr) {
+    UnpinReadSequence(pin);
+  }
   return s;
 }
 
-std::vector<std::string> DBImpl::FindKeysByField(Field &field) {
+void DBImpl::MultiGetEncodedFields(const ReadOptions& options, size_t n,
+                                   const Slice* keys, PinnableSlice* values,
+                                   Status* statuses) {
+  MutexLock l(&mutex_);
+  SequenceNumber snapshot;
+  const SnapshotImpl* pin = nullptr;
+  if (options.snapshot != nullptr) {
+    snapshot =
+        static_cast<const SnapshotImpl*>(options.snapshot)->sequence_number();
+  } else {
+    pin = PinReadSequence();
+    snapshot = pin->sequence_number();
+  }
+
+  MemTable* mem = mem_;
+  MemTable* imm = imm_;
+  Version* current = versions_->current();
+  mem->Ref();
+  if (imm != nullptr) imm->Ref();
+  current->Ref();
+
+  std::vector<Version::GetStats> stats;
+
+  // Unlock while reading from files and memtables
+  {
+    mutex_.Unlock();
+    std::vector<Slice> raws(n);
+    for (size_t i = 0; i < n; i++) {
+      values[i].Reset();
+      statuses[i] = Status::OK();
+      std::string* raw = values[i].GetSelf();
+      LookupKey lkey(keys[i], snapshot);
+      if (mem->Get(lkey, raw, &statuses[i])) {
+        // Done
+      } else if (imm != nullptr && imm->Get(lkey, raw, &statuses[i])) {
+        // Done
+      } else {
+        Version::GetStats key_stats;
+        statuses[i] = current->Get(options, lkey, raw, &key_stats);
+        stats.push_back(key_stats);
+      }
+      raws[i] = Slice(*raw);
+    }
+    // Lookups that failed are skipped here
+    DecodeValues(options, n, raws.data(), values, statuses);
+    mutex_.Lock();
+  }
+
+  bool need_compaction = false;
+  for (const Version::GetStats& key_stats : stats) {
+    if (current->UpdateStats(key_stats)) {
+      need_compaction = true;
+    }
+  }
+  if (need_compaction) {
+    MaybeScheduleCompaction();
+  }
+  mem->Unref();
+  if (imm != nullptr) imm->Unref();
+  current->Unref();
+  if (pin != nullptr) {
+    UnpinReadSequence(pin);
+  }
+}
+
+std::vector<Status> DBImpl::MultiGet(const ReadOptions& options,
+                                     const std::vector<Slice>& keys,
+                                     std::vector<std::string>* values) {
+  std::vector<PinnableSlice> encoded(keys.size());
+  std::vector<Status> statuses(keys.size());
+  MultiGetEncodedFields(options, keys.size(), keys.data(), encoded.data(),
+                        statuses.data());
+  values->resize(keys.size());
+  for (size_t i = 0; i < keys.size(); i++) {
+    Slice field;
+    if (statuses[i].ok() && FindField(encoded[i], "1", &field)) {
+      (*values)[i].assign(field.data(), field.size());
+    } else {
+      (*values)[i].clear();
+    }
+  }
+  return statuses;
+}
+
+std::vector<Status> DBImpl::MultiGet(const ReadOptions& options,
+                                     const std::vector<Slice>& keys,
+                                     std::vector<Fields>* fields) {
+  std::vector<PinnableSlice> encoded(keys.size());
+  std::vector<Status> statuses(keys.size());
+  MultiGetEncodedFields(options, keys.size(), keys.data(), encoded.data(),
+                        statuses.data());
+  fields->resize(keys.size());
+  for (size_t i = 0; i < keys.size(); i++) {
+    if (statuses[i].ok()) {
+      (*fields)[i] = options.fields != nullptr
+                         ? Fields(encoded[i], *options.fields)
+                         : Fields(encoded[i]);
+    } else {
+      (*fields)[i] = Fields();
+    }
+  }
+  return statuses;
+}
+
+Status DBImpl::Get(const ReadOptions& options, const Slice& key,
+                   PinnableSlice* value) {
+  static NoDestructor<std::vector<std::string>> value_field(
+      std::vector<std::string>{"1"});
+  ReadOptions value_options = options;
+  value_options.fields = value_field.get();
+  Status s = GetEncodedFields(value_options, key, value);
+  Slice field;
+  if (s.ok() && FindField(*value, "1", &field)) {
+    // Narrow the pinned fields down to field "1" without copying it
+    value->remove_prefix(field.data() - value->data());
+    value->remove_suffix(value->size() - field.size());
+  } else {
+    value->Reset();
+  }
+  return s;
+}
+
+Status DBImpl::Get(const ReadOptions& options, const Slice& key,
+                   std::string* value) {
+  PinnableSlice pinned;
+  Status s = Get(options, key, &pinned);
+  value->assign(pinned.data(), pinned.size());
+  return s;
+}
+
+Status DBImpl::Get(const ReadOptions& options, const Slice& key,
+                   Fields* fields) {
+  PinnableSlice value;
+  Status s = GetEncodedFields(options, key, &value);
+  if (!s.ok()) {
+    *fields = Fields();
+  } else if (options.fields != nullptr) {
+    *fields = Fields(value, *options.fields);
+  } else {
+    *fields = Fields(value);
+  }
+  return s;
+}
+
+Status DBImpl::Get(const ReadOptions& options, const Slice& key,
+                   const std::vector<std::string>& field_names,
+                   Fields* fields) {
+  ReadOptions projection = options;
+  projection.fields = &field_names;
+  return Get(projection, key, fields);
+}
+
+Status DBImpl::Get(const ReadOptions& options, const Slice& key,
+                   FieldsView* fields) {
+  PinnableSlice* value = fields->pinnable();
+  Status s = GetEncodedFields(options, key, value);
+  fields->Reset(s.ok() ? Slice(*value) : Slice());
+  return s;
+}
+
+std::vector<std::string> DBImpl::FindKeysByField(Field &field,
+                                                 Status* status) {
   std::vector<std::string> keys;
-  Iterator *iter = this->NewIterator(ReadOptions());
-  iter->SeekToFirst();
-  while (iter->Valid()) {
-    std::string key = iter->key().ToString();
-    Fields fields = iter->fields();
+  Status s = FindKeysByField(ReadOptions(), field, [&keys](const Slice& key) {
+    keys.emplace_back(key.data(), key.size());
+    return true;
+  });
+  if (status != nullptr) {
+    *status = s;
+  }
+  return keys;
+}
+
+// Most scan worker threads a DB starts, see scan_queue_
+static const int kMaxScanWorkers = 8;
+
+// The range [*start,*limit) of a FindKeysByField scan, null meaning
+// unbounded
+struct DBImpl::FieldScanRange {
+  FieldScan* scan;
+  const std::string* start;
+  const std::string* limit;
+};
+
+// A FindKeysByField scan, split among threads by key range
+struct DBImpl::FieldScan {
+  FieldScan(DBImpl* db, const ReadOptions& options,
+            const std::function<bool(const Slice& key)>& callback)
+      : db(db), options(options), callback(callback), done_cv(&mu) {}
+
+  DBImpl* const db;
+  // Holds the predicate the keys must satisfy
+  const ReadOptions& options;
+  const std::function<bool(const Slice& key)>& callback;
+  // Set once the callback returns false or a range fails
+  std::atomic<bool> stop{false};
+  port::Mutex mu;  // Held while calling the callback
+  port::CondVar done_cv;
+  int running GUARDED_BY(mu) = 0;
+  Status status GUARDED_BY(mu);
+};
+
+Status DBImpl::FindKeysByField(
+    const ReadOptions& options, const Field& field,
+    const std::function<bool(const Slice& key)>& callback) {
+  ReadOptions scan_options = options;
+  // Only the raw values are needed, the field is looked up in place
+  scan_options.keys_only = true;
+  const std::vector<std::string>& indexed = options_.indexed_fields;
+  if (std::find(indexed.begin(), indexed.end(), field.first) !=
+      indexed.end()) {
+    // The index entries of the value end with the keys holding it
+    std::string prefix;
+    AppendIndexPrefix(&prefix, field.first, field.second);
+    Iterator* iter = NewIterator(scan_options, true);
+    for (iter->Seek(prefix);
+         iter->Valid() && iter->key().starts_with(prefix); iter->Next()) {
+      Slice key = iter->key();
+      key.remove_prefix(prefix.size());
+      if (!callback(key)) {
+        break;
+      }
+    }
+    Status s = iter->status();
+    delete iter;
+    return s;
+  }
+
+  // Every range is read as of the same sequence
+  const SnapshotImpl* pin = nullptr;
+  std::vector<std::string> split_keys;
+  {
+    MutexLock l(&mutex_);
+    if (options.snapshot == nullptr) {
+      pin = PinReadSequence();
+      scan_options.snapshot = pin;
+    }
+    if (options.scan_threads > 1) {
+      versions_->current()->GetSplitKeys(options.scan_threads, &split_keys);
+    }
+  }
+  // Only the matches come out of the iterators
+  const FieldPredicate predicate =
+      FieldPredicate::Equal(field.first, field.second);
+  scan_options.predicate = &predicate;
+
+  FieldScan scan(this, scan_options, callback);
+  std::vector<FieldScanRange> ranges(split_keys.size() + 1);
+  for (size_t i = 0; i < ranges.size(); i++) {
+    ranges[i].scan = &scan;
+    ranges[i].start = (i > 0) ? &split_keys[i - 1] : nullptr;
+    ranges[i].limit = (i < split_keys.size()) ? &split_keys[i] : nullptr;
+  }
+  scan.mu.Lock();
+  scan.running = ranges.size();
+  scan.mu.Unlock();
+  if (ranges.size() > 1) {
+    MutexLock l(&scan_mutex_);
+    for (size_t i = 1; i < ranges.size(); i++) {
+      scan_queue_.push_back(&ranges[i]);
+    }
+    int wanted = static_cast<int>(scan_queue_.size()) - idle_scan_workers_;
+    while (wanted-- > 0 && scan_workers_ < kMaxScanWorkers) {
+      scan_workers_++;
+      env_->StartThread(&DBImpl::ScanWorkerMain, this);
+    }
+    scan_cv_.SignalAll();
+  }
+  FieldScanWork(&ranges[0]);
+  // Scan the ranges no worker took meanwhile
+  while (ranges.size() > 1) {
+    FieldScanRange* range = nullptr;
+    {
+      MutexLock l(&scan_mutex_);
+      for (auto it = scan_queue_.begin(); it != scan_queue_.end(); ++it) {
+        if ((*it)->scan == &scan) {
+          range = *it;
+          scan_queue_.erase(it);
+          break;
+        }
+      }
+    }
+    if (range == nullptr) {
+      break;
+    }
+    FieldScanWork(range);
+  }
+  Status s;
+  {
+    MutexLock l(&scan.mu);
+    while (scan.running > 0) {
+      scan.done_cv.Wait();
+    }
+    s = scan.status;
+  }
+  if (pin != nullptr) {
+    MutexLock l(&mutex_);
+    UnpinReadSequence(pin);
+  }
+  return s;
+}
+
+void DBImpl::ScanWorkerMain(void* db) {
+  reinterpret_cast<DBImpl*>(db)->ScanWorkerLoop();
+}
+
+void DBImpl::ScanWorkerLoop() {
+  MutexLock l(&scan_mutex_);
+  while (!stopping_scan_workers_) {
+    if (scan_queue_.empty()) {
+      idle_scan_workers_++;
+      scan_cv_.Wait();
+      idle_scan_workers_--;
+      continue;
+    }
+    FieldScanRange* range = scan_queue_.front();
+    scan_queue_.pop_front();
+    scan_mutex_.Unlock();
+    FieldScanWork(range);
+    scan_mutex_.Lock();
+  }
+  scan_workers_--;
+  scan_cv_.SignalAll();
+}
+
+void DBImpl::FieldScanWork(FieldScanRange* range) {
+  FieldScan* scan = range->scan;
+  scan->db->ScanForField(scan, range->start, range->limit);
+  MutexLock l(&scan->mu);
+  if (--scan->running == 0) {
+    scan->done_cv.SignalAll();
+  }
+}
 
-    if (fields[field.first] == field.second) {
-      keys.emplace_back(key);
+void DBImpl::ScanForField(FieldScan* scan, const std::string* start,
+                          const std::string* limit) {
+  const Comparator* ucmp = user_comparator();
+  Iterator* iter = NewIterator(scan->options);
+  if (start == nullptr) {
+    iter->SeekToFirst();
+  } else {
+    iter->Seek(*start);
+  }
+  for (; iter->Valid() && !scan->stop.load(std::memory_order_acquire);
+       iter->Next()) {
+    if (limit != nullptr && ucmp->Compare(iter->key(), *limit) >= 0) {
+      break;
+    }
+    MutexLock l(&scan->mu);
+    if (!scan->stop.load(std::memory_order_relaxed) &&
+        !scan->callback(iter->key())) {
+      scan->stop.store(true, std::memory_order_release);
     }
-    iter->Next();
   }
+  Status s = iter->status();
   delete iter;
-  return keys;
+  if (!s.ok()) {
+    MutexLock l(&scan->mu);
+    if (scan->status.ok()) {
+      scan->status = s;
+    }
+    scan->stop.store(true, std::memory_order_release);
+  }
 }
 
 Iterator* DBImpl::NewIterator(const ReadOptions& options) {
+  return NewIterator(options, false);
+}
+
+Iterator* DBImpl::NewIterator(const ReadOptions& options, bool index_keys) {
+  ReadOptions iter_options = options;
+  const SnapshotImpl* pin = nullptr;
+  if (options.snapshot == nullptr) {
+    // Pin the sequence, so that vtable gc keeps the vtables this iterator
+    // may still read from.  Compactions still drop what it cannot see.
+    MutexLock l(&mutex_);
+    pin = PinReadSequence();
+    iter_options.snapshot = pin;
+  }
   SequenceNumber latest_snapshot;
   uint32_t seed;
-  Iterator* iter = NewInternalIterator(options, &latest_snapshot, &seed);
-  return NewDBIterator(this, user_comparator(), iter,
-                       (options.snapshot != nullptr
-                            ? static_cast<const SnapshotImpl*>(options.snapshot)
-                                  ->sequence_number()
-                            : latest_snapshot),
-                       seed);
+  Iterator* iter = NewInternalIterator(iter_options, &latest_snapshot, &seed);
+  Iterator* db_iter = NewDBIterator(
+      this, iter_options, user_comparator(), iter,
+      static_cast<const SnapshotImpl*>(iter_options.snapshot)
+          ->sequence_number(),
+      seed, index_keys);
+  if (pin != nullptr) {
+    db_iter->RegisterCleanup(&DBImpl::ReleaseReadPin, this,
+                             const_cast<SnapshotImpl*>(pin));
+  }
+  return db_iter;
 }
 
 void DBImpl::RecordReadSample(Slice key) {
@@ -1445,6 +2442,10 @@ const Snapshot* DBImpl::GetSnapshot() {
 void DBImpl::ReleaseSnapshot(const Snapshot* snapshot) {
   MutexLock l(&mutex_);
   snapshots_.Delete(static_cast<const SnapshotImpl*>(snapshot));
+  if (!obsolete_vtables_.empty()) {
+    // Let the gc thread drop the vtables nobody can see any longer
+    MaybeScheduleGarbageCollect();
+  }
 }
 
 // Convenience methods
@@ -1486,32 +2487,68 @@ Status DBImpl::Write(const WriteOptions& options, WriteBatch* updates) {
   Writer* last_writer = &w;
   if (status.ok() && updates != nullptr) {  // nullptr batch is for compactions
     WriteBatch* write_batch = BuildBatchGroup(&last_writer);
-    WriteBatchInternal::SetSequence(write_batch, last_sequence + 1);
-    last_sequence += WriteBatchInternal::Count(write_batch);
-
-    // Add to log and apply to memtable.  We can release the lock
-    // during this phase since &w is currently responsible for logging
-    // and protects against concurrent loggers and concurrent writes
-    // into mem_.
-    {
+    if (!options_.indexed_fields.empty()) {
+      // The index updates are logged and applied with the group.  The
+      // values it replaces are read unlocked: as the front writer, &w
+      // keeps them from changing meanwhile.
+      WriteBatch index_updates;
       mutex_.Unlock();
-      status = log_->AddRecord(WriteBatchInternal::Contents(write_batch));
-      bool sync_error = false;
-      if (status.ok() && options.sync) {
-        status = logfile_->Sync();
-        if (!status.ok()) {
-          sync_error = true;
+      status = IndexUpdates(write_batch, &index_updates);
+      mutex_.Lock();
+      if (status.ok() && WriteBatchInternal::Count(&index_updates) > 0) {
+        if (write_batch != tmp_batch_) {
+          // Leave the caller's batch alone
+          WriteBatchInternal::Append(tmp_batch_, write_batch);
+          write_batch = tmp_batch_;
         }
+        WriteBatchInternal::Append(write_batch, &index_updates);
       }
-      if (status.ok()) {
-        status = WriteBatchInternal::InsertInto(write_batch, mem_);
-      }
-      mutex_.Lock();
-      if (sync_error) {
-        // The state of the log file is indeterminate: the log record we
-        // just added may or may not show up when the DB is re-opened.
-        // So we force the DB into a mode where all future writes fail.
-        RecordBackgroundError(status);
+    }
+    if (status.ok()) {
+      WriteBatchInternal::SetSequence(write_batch, last_sequence + 1);
+      last_sequence += WriteBatchInternal::Count(write_batch);
+
+      // Add to log and apply to memtable.  We can release the lock
+      // during this phase since &w is currently responsible for logging
+      // and protects against concurrent loggers and concurrent writes
+      // into mem_.
+      {
+        mutex_.Unlock();
+        bool sync_error = false;
+        WriteBatch* logged_batch = write_batch;
+        if (vlog_ != nullptr) {
+          // Large values go to the value log first, the log and memtable
+          // only get their index.  A failed append leaves the offsets of
+          // the builder out of step with the file, so it is fatal too.
+          int separated = 0;
+          status = SeparateValues(write_batch, options.sync, vlog_batch_,
+                                  &separated);
+          if (!status.ok()) {
+            sync_error = true;
+          } else if (separated > 0) {
+            logged_batch = vlog_batch_;
+          }
+        }
+        if (status.ok()) {
+          status = log_->AddRecord(WriteBatchInternal::Contents(logged_batch));
+        }
+        if (status.ok() && options.sync) {
+          status = logfile_->Sync();
+          if (!status.ok()) {
+            sync_error = true;
+          }
+        }
+        if (status.ok()) {
+          status = WriteBatchInternal::InsertInto(logged_batch, mem_);
+        }
+        if (logged_batch == vlog_batch_) vlog_batch_->Clear();
+        mutex_.Lock();
+        if (sync_error) {
+          // The state of the log file is indeterminate: the log record we
+          // just added may or may not show up when the DB is re-opened.
+          // So we force the DB into a mode where all future writes fail.
+          RecordBackgroundError(status);
+        }
       }
     }
     if (write_batch == tmp_batch_) tmp_batch_->Clear();
@@ -1588,6 +2625,290 @@ WriteBatch* DBImpl::BuildBatchGroup(Writer** last_writer) {
   return result;
 }
 
+namespace {
+
+// Copies a batch, moving the values separated at write time into a
+// value log and putting their index in their place
+class ValueSeparator : public WriteBatch::Handler {
+ public:
+  ValueSeparator(const Options& options, uint64_t number,
+                 VTableBuilder* builder, WriteBatch* result)
+      : options_(options), number_(number), builder_(builder),
+        result_(result), separated_(0) {}
+
+  void Put(const Slice& key, const Slice& value) override {
+    if (SeparateValue(options_, key, value, number_, builder_, &index_)) {
+      result_->Put(key, index_);
+      separated_++;
+    } else {
+      result_->Put(key, value);
+    }
+  }
+
+  void Delete(const Slice& key) override { result_->Delete(key); }
+
+  int separated() const { return separated_; }
+
+ private:
+  const Options& options_;
+  const uint64_t number_;
+  VTableBuilder* const builder_;
+  WriteBatch* const result_;
+  std::string index_;
+  int separated_;
+};
+
+// Collects the last update of every key of a batch but index entries
+class LastUpdates : public WriteBatch::Handler {
+ public:
+  // User key -> whether it is put, and its value if so
+  using Updates = std::map<std::string, std::pair<bool, std::string>>;
+
+  void Put(const Slice& key, const Slice& value) override {
+    if (!IsIndexKey(key)) {
+      updates_[key.ToString()] = {true, value.ToString()};
+    }
+  }
+
+  void Delete(const Slice& key) override {
+    if (!IsIndexKey(key)) {
+      updates_[key.ToString()] = {false, std::string()};
+    }
+  }
+
+  const Updates& updates() const { return updates_; }
+
+ private:
+  Updates updates_;
+};
+
+}  // namespace
+
+Status DBImpl::IndexUpdates(const WriteBatch* batch, WriteBatch* result) {
+  enum Type : unsigned char {
+    kNonIndexValue = 2,
+  };
+  LastUpdates last_updates;
+  Status s = batch->Iterate(&last_updates);
+  if (!s.ok()) {
+    return s;
+  }
+  ReadOptions options;
+  options.fields = &options_.indexed_fields;
+  const std::string empty_value(1, kNonIndexValue);
+  FieldsView before, after;
+  Slice old_value, new_value;
+  std::string index_key;
+  for (const auto& update : last_updates.updates()) {
+    const std::string& key = update.first;
+    s = Get(options, key, &before);
+    if (s.IsNotFound()) {
+      s = Status::OK();
+    } else if (!s.ok()) {
+      return s;
+    }
+    after.Reset(Slice());
+    if (update.second.first) {
+      s = DecodeValue(options, update.second.second, after.pinnable());
+      if (!s.ok()) {
+        return s;
+      }
+      after.Reset(*after.pinnable());
+    }
+    for (const std::string& name : options_.indexed_fields) {
+      const bool had = before.Get(name, &old_value);
+      const bool has = after.Get(name, &new_value);
+      if (had && has && old_value == new_value) {
+        continue;
+      }
+      if (had) {
+        index_key.clear();
+        AppendIndexKey(&index_key, name, old_value, key);
+        result->Delete(index_key);
+      }
+      if (has) {
+        index_key.clear();
+        AppendIndexKey(&index_key, name, new_value, key);
+        result->Put(index_key, empty_value);
+      }
+    }
+  }
+  return s;
+}
+
+namespace {
+
+// Smallest key after every key starting with "prefix"
+std::string PrefixSuccessor(std::string prefix) {
+  while (!prefix.empty() && static_cast<unsigned char>(prefix.back()) == 0xff) {
+    prefix.pop_back();
+  }
+  if (!prefix.empty()) {
+    prefix.back()++;
+  }
+  return prefix;
+}
+
+}  // namespace
+
+Status DBImpl::SyncIndexes() {
+  enum Type : unsigned char {
+    kNonIndexValue = 2,
+  };
+  // Index keys are grouped by field only under the bytewise order, no
+  // other database can hold any
+  if (user_comparator() != BytewiseComparator()) {
+    return Status::OK();
+  }
+  ReadOptions options;
+  options.keys_only = true;
+  const std::vector<std::string>& declared = options_.indexed_fields;
+
+  // Find the fields with index keys, one seek per field
+  std::set<std::string> complete, stale;
+  Iterator* iter = NewIterator(options, true);
+  iter->Seek(kIndexKeyPrefix);
+  while (iter->Valid()) {
+    Slice name;
+    bool is_marker;
+    if (!ParseIndexKey(iter->key(), &name, &is_marker)) {
+      break;
+    }
+    if (is_marker &&
+        std::find(declared.begin(), declared.end(), name) != declared.end()) {
+      complete.insert(name.ToString());
+    } else {
+      stale.insert(name.ToString());
+    }
+    std::string marker;
+    AppendIndexMarker(&marker, name);
+    iter->Seek(PrefixSuccessor(marker));
+  }
+  Status s = iter->status();
+  std::vector<std::string> missing;
+  for (const std::string& name : declared) {
+    if (complete.count(name) == 0) {
+      missing.push_back(name);
+    }
+  }
+
+  // Drop whatever index keys a field not indexed in full has, including
+  // those left behind by a build that did not finish
+  const WriteOptions write_options;
+  WriteBatch batch;
+  for (const std::string& name : stale) {
+    std::string marker;
+    AppendIndexMarker(&marker, name);
+    for (iter->Seek(marker); s.ok() && iter->Valid() &&
+                             iter->key().starts_with(marker);
+         iter->Next()) {
+      batch.Delete(iter->key());
+      if (WriteBatchInternal::Count(&batch) >= 1000) {
+        s = Write(write_options, &batch);
+        batch.Clear();
+      }
+    }
+  }
+  delete iter;
+  if (s.ok()) {
+    s = Write(write_options, &batch);
+    batch.Clear();
+  }
+  if (!s.ok() || missing.empty()) {
+    return s;
+  }
+
+  // Index the missing fields of every value, then mark them complete
+  Log(options_.info_log, "Building %d secondary indexes",
+      static_cast<int>(missing.size()));
+  options.keys_only = false;
+  options.fields = &missing;
+  const std::string empty_value(1, kNonIndexValue);
+  FieldsView fields;
+  Slice value;
+  std::string index_key;
+  iter = NewIterator(options);
+  for (iter->SeekToFirst(); s.ok() && iter->Valid(); iter->Next()) {
+    s = iter->fields_view(&fields);
+    for (const std::string& name : missing) {
+      if (s.ok() && fields.Get(name, &value)) {
+        index_key.clear();
+        AppendIndexKey(&index_key, name, value, iter->key());
+        batch.Put(index_key, empty_value);
+      }
+    }
+    if (s.ok() && WriteBatchInternal::Count(&batch) >= 1000) {
+      s = Write(write_options, &batch);
+      batch.Clear();
+    }
+  }
+  if (s.ok()) {
+    s = iter->status();
+  }
+  delete iter;
+  if (s.ok()) {
+    for (const std::string& name : missing) {
+      index_key.clear();
+      AppendIndexMarker(&index_key, name);
+      batch.Put(index_key, empty_value);
+    }
+    s = Write(write_options, &batch);
+  }
+  return s;
+}
+
+Status DBImpl::NewValueLog(uint64_t number, ValueLog** vlog) {
+  mutex_.AssertHeld();
+  WritableFile* file;
+  Status s = env_->NewWritableFile(VTableFileName(dbname_, number), &file);
+  if (s.ok()) {
+    // Readers open a value log before it has a footer, so it cannot keep
+    // a dictionary there
+    Options options = options_;
+    options.vtable_zstd_dict_size = 0;
+    *vlog = new ValueLog{number, file, new VTableBuilder(options, file)};
+    pending_outputs_.insert(number);
+  }
+  return s;
+}
+
+Status DBImpl::SeparateValues(const WriteBatch* batch, bool sync,
+                              WriteBatch* result, int* separated) {
+  result->Clear();
+  ValueSeparator separator(options_, vlog_->number, vlog_->builder, result);
+  Status s = batch->Iterate(&separator);
+  *separated = separator.separated();
+  if (s.ok() && *separated > 0) {
+    WriteBatchInternal::SetSequence(result,
+                                    WriteBatchInternal::Sequence(batch));
+    s = vlog_->builder->Flush();
+    if (s.ok() && sync) {
+      s = vlog_->file->Sync();
+    }
+  }
+  return s;
+}
+
+Status DBImpl::SealValueLog(ValueLog* vlog, VTableMeta* meta) {
+  Status s = vlog->builder->Finish();
+  if (s.ok()) {
+    s = vlog->file->Sync();
+  }
+  if (s.ok()) {
+    s = vlog->file->Close();
+  }
+  if (s.ok()) {
+    meta->number = vlog->number;
+    meta->records_num = vlog->builder->RecordNumber();
+    meta->table_size = vlog->builder->FileSize();
+    delete vlog->builder;
+    delete vlog->file;
+    vlog->builder = nullptr;
+    vlog->file = nullptr;
+  }
+  return s;
+}
+
 // REQUIRES: mutex_ is held
 // REQUIRES: this thread is currently at the front of the writer queue
 Status DBImpl::MakeRoomForWrite(bool force) {
@@ -1636,6 +2957,16 @@ Status DBImpl::MakeRoomForWrite(bool force) {
         versions_->ReuseFileNumber(new_log_number);
         break;
       }
+      ValueLog* new_vlog = nullptr;
+      if (options_.kv_sep_on_write) {
+        s = NewValueLog(new_log_number, &new_vlog);
+        if (!s.ok()) {
+          delete lfile;
+          env_->RemoveFile(LogFileName(dbname_, new_log_number));
+          versions_->ReuseFileNumber(new_log_number);
+          break;
+        }
+      }
 
       delete log_;
 
@@ -1656,6 +2987,8 @@ Status DBImpl::MakeRoomForWrite(bool force) {
       logfile_number_ = new_log_number;
       log_ = new log::Writer(lfile);
       imm_ = mem_;
+      imm_vlog_ = vlog_;
+      vlog_ = new_vlog;
       has_imm_.store(true, std::memory_order_release);
       mem_ = new MemTable(internal_comparator_);
       mem_->Ref();
@@ -1710,6 +3043,69 @@ bool DBImpl::GetProperty(const Slice& property, std::string* value) {
   } else if (in == "sstables") {
     *value = versions_->current()->DebugString();
     return true;
+  } else if (in == "vtable-stats") {
+    std::vector<VTableMeta> metas;
+    vtable_manager_->GetVTableMetas(&metas);
+    // Files bucketed by the percentage of their bytes that is live
+    const int kBuckets = 10;
+    int histogram[kBuckets] = {};
+    uint64_t records = 0, invalid = 0, live_bytes = 0, garbage_bytes = 0;
+    for (const VTableMeta& meta : metas) {
+      records += meta.records_num;
+      invalid += meta.invalid_num;
+      live_bytes += meta.live_size();
+      garbage_bytes += meta.table_size - meta.live_size();
+      int bucket = meta.table_size == 0
+                       ? 0
+                       : static_cast<int>(meta.live_size() * kBuckets /
+                                          meta.table_size);
+      histogram[std::min(bucket, kBuckets - 1)]++;
+    }
+    char buf[300];
+    std::snprintf(buf, sizeof(buf),
+                  "                         VTables\n"
+                  "Files  Records  Invalid  Live(MB) Garbage(MB)\n"
+                  "---------------------------------------------\n"
+                  "%5zu %8llu %8llu %9.1f %11.1f\n"
+                  "\nLive bytes  Files\n",
+                  metas.size(), static_cast<unsigned long long>(records),
+                  static_cast<unsigned long long>(invalid),
+                  live_bytes / 1048576.0, garbage_bytes / 1048576.0);
+    value->append(buf);
+    for (int i = 0; i < kBuckets; i++) {
+      std::snprintf(buf, sizeof(buf), "%3d-%3d%% %7d\n", i * 100 / kBuckets,
+                    (i + 1) * 100 / kBuckets, histogram[i]);
+      value->append(buf);
+    }
+    return true;
+  } else if (in == "vtables") {
+    std::vector<VTableMeta> metas;
+    vtable_manager_->GetVTableMetas(&metas);
+    char buf[200];
+    for (const VTableMeta& meta : metas) {
+      std::snprintf(buf, sizeof(buf),
+                    "#%llu records=%llu invalid=%llu bytes=%llu live=%llu\n",
+                    static_cast<unsigned long long>(meta.number),
+                    static_cast<unsigned long long>(meta.records_num),
+                    static_cast<unsigned long long>(meta.invalid_num),
+                    static_cast<unsigned long long>(meta.table_size),
+                    static_cast<unsigned long long>(meta.live_size()));
+      value->append(buf);
+    }
+    return true;
+  } else if (in == "vtable-live-bytes" || in == "vtable-garbage-bytes") {
+    std::vector<VTableMeta> metas;
+    vtable_manager_->GetVTableMetas(&metas);
+    uint64_t bytes = 0;
+    for (const VTableMeta& meta : metas) {
+      bytes += in == "vtable-live-bytes" ? meta.live_size()
+                                         : meta.table_size - meta.live_size();
+    }
+    char buf[50];
+    std::snprintf(buf, sizeof(buf), "%llu",
+                  static_cast<unsigned long long>(bytes));
+    value->append(buf);
+    return true;
   } else if (in == "approximate-memory-usage") {
     size_t total_usage = options_.block_cache->TotalCharge();
     if (mem_) {
@@ -1778,6 +3174,11 @@ DB::~DB() = default;
 
 Status DB::Open(const Options& options, const std::string& dbname, DB** dbptr) {
   *dbptr = nullptr;
+  if (!options.indexed_fields.empty() &&
+      options.comparator != BytewiseComparator()) {
+    return Status::InvalidArgument(
+        dbname, "secondary indexes need the bytewise comparator");
+  }
 
   DBImpl* impl = new DBImpl(options, dbname);
   impl->mutex_.Lock();
@@ -1798,21 +3199,27 @@ Status DB::Open(const Options& options, const std::string& dbname, DB** dbptr) {
       impl->log_ = new log::Writer(lfile);
       impl->mem_ = new MemTable(impl->internal_comparator_);
       impl->mem_->Ref();
+      if (options.kv_sep_on_write) {
+        s = impl->NewValueLog(new_log_number, &impl->vlog_);
+      }
     }
   }
   if (s.ok() && save_manifest) {
     edit.SetPrevLogNumber(0);  // No older logs needed after recovery.
     edit.SetLogNumber(impl->logfile_number_);
-    s = impl->versions_->LogAndApply(&edit, &impl->mutex_);
-    if (s.ok()) {
-      s = impl->vtable_manager_->SaveVTableMeta();
-    }
+    s = impl->LogAndApply(&edit);
   }
   if (s.ok()) {
+    // Recover only collects the fully invalid vtables, queue them now
+    impl->QueueInvalidVTables();
     impl->RemoveObsoleteFiles();
     impl->MaybeScheduleCompaction();
+    impl->MaybeScheduleGarbageCollect();
   }
   impl->mutex_.Unlock();
+  if (s.ok()) {
+    s = impl->SyncIndexes();
+  }
   if (s.ok()) {
     assert(impl->mem_ != nullptr);
     *dbptr = impl;
@@ -26,6 +26,7 @@ class TableCache;
 class Version;
 class VersionEdit;
 class VersionSet;
+class VTableCache;
 class Fields;
 
 class DBImpl : public DB {
@@ -44,12 +45,39 @@ class DBImpl : public DB {
              const Fields& fields) override;
   Status Delete(const WriteOptions&, const Slice& key) override;
   Status Write(const WriteOptions& options, WriteBatch* updates) override;
-  Status DecodeValue(std::string* value) const;
+  // Resolve "raw", a value as stored in the memtable or an sstable, into
+  // the encoded Fields it stands for, reading the VTable if necessary.
+  // *value may point into "raw", which must outlive it.  With
+  // options.fields set, *value only needs to hold those fields: fields
+  // separated on their own are not read unless one of them is asked for.
+  Status DecodeValue(const ReadOptions& options, Slice raw,
+                     PinnableSlice* value) const;
+  // Same as DecodeValue for raws[0,n-1], batching the VTable reads.
+  // Entries whose statuses[i] is not ok on entry are skipped.
+  void DecodeValues(const ReadOptions& options, size_t n, const Slice* raws,
+                    PinnableSlice* values, Status* statuses) const;
   Status Get(const ReadOptions& options, const Slice& key,
              Fields* fields) override;
   Status Get(const ReadOptions& options, const Slice& key,
              std::string *value) override;
-  std::vector<std::string> FindKeysByField(Field &field) override;
+  Status Get(const ReadOptions& options, const Slice& key,
+             FieldsView* fields) override;
+  Status Get(const ReadOptions& options, const Slice& key,
+             const std::vector<std::string>& field_names,
+             Fields* fields) override;
+  Status Get(const ReadOptions& options, const Slice& key,
+             PinnableSlice* value) override;
+  std::vector<Status> MultiGet(const ReadOptions& options,
+                               const std::vector<Slice>& keys,
+                               std::vector<std::string>* values) override;
+  std::vector<Status> MultiGet(const ReadOptions& options,
+                               const std::vector<Slice>& keys,
+                               std::vector<Fields>* fields) override;
+  std::vector<std::string> FindKeysByField(Field &field,
+                                           Status* status) override;
+  Status FindKeysByField(
+      const ReadOptions& options, const Field& field,
+      const std::function<bool(const Slice& key)>& callback) override;
   Iterator* NewIterator(const ReadOptions&) override;
   const Snapshot* GetSnapshot() override;
   void ReleaseSnapshot(const Snapshot* snapshot) override;
@@ -83,6 +111,10 @@ class DBImpl : public DB {
   friend class DB;
   struct CompactionState;
   struct Writer;
+  struct Relocation;
+  struct ValueLog;
+  struct FieldScan;
+  struct FieldScanRange;
 
   // Information for a manual compaction
   struct ManualCompaction {
@@ -109,6 +141,17 @@ class DBImpl : public DB {
     int64_t bytes_written;
   };
 
+  // Look up "key" and point *value at its encoded Fields, or at least at
+  // options.fields (see DecodeValue)
+  Status GetEncodedFields(const ReadOptions& options, const Slice& key,
+                          PinnableSlice* value);
+
+  // Look up keys[0,n-1] as of one snapshot and point values[i] at the
+  // encoded Fields of keys[i]
+  void MultiGetEncodedFields(const ReadOptions& options, size_t n,
+                             const Slice* keys, PinnableSlice* values,
+                             Status* statuses);
+
   Iterator* NewInternalIterator(const ReadOptions&,
                                 SequenceNumber* latest_snapshot,
                                 uint32_t* seed);
@@ -121,6 +164,13 @@ class DBImpl : public DB {
   Status Recover(VersionEdit* edit, bool* save_manifest)
       EXCLUSIVE_LOCKS_REQUIRED(mutex_);
 
+  // Add to *edit the vtables listed in the VTableMeta file a database
+  // written before the MANIFEST kept vtable records has, unless the
+  // MANIFEST already has some.  The file is deleted as obsolete once
+  // *edit is logged.
+  Status ImportVTableMeta(VersionEdit* edit, bool* save_manifest)
+      EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+
   void MaybeIgnoreError(Status* s) const;
 
   // Delete any unneeded files and stale in-memory entries.
@@ -143,6 +193,37 @@ class DBImpl : public DB {
   WriteBatch* BuildBatchGroup(Writer** last_writer)
       EXCLUSIVE_LOCKS_REQUIRED(mutex_);
 
+  // Create the value log paired with log file "number", see
+  // Options::kv_sep_on_write
+  Status NewValueLog(uint64_t number, ValueLog** vlog)
+      EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+  // Append the large values of "batch" to vlog_ and build *result with
+  // them replaced by their index.  Sets *separated to the number of
+  // values moved, *result is only valid when it is positive.
+  Status SeparateValues(const WriteBatch* batch, bool sync,
+                        WriteBatch* result, int* separated);
+  // Write the footer of "vlog" and describe it in *meta
+  Status SealValueLog(ValueLog* vlog, VTableMeta* meta);
+
+  // Add to *result the secondary index updates "batch" implies, see
+  // Options::indexed_fields.  Reads the values "batch" replaces, so it
+  // must run before any later write is applied.
+  Status IndexUpdates(const WriteBatch* batch, WriteBatch* result);
+  // Build the secondary indexes added to Options::indexed_fields since
+  // the database was last opened and drop those removed from it.
+  Status SyncIndexes();
+  // Same as NewIterator, but over the secondary index entries instead of
+  // the user entries if "index_keys" is set
+  Iterator* NewIterator(const ReadOptions& options, bool index_keys);
+
+  // Scan one key range of a FindKeysByField
+  static void FieldScanWork(FieldScanRange* range);
+  void ScanForField(FieldScan* scan, const std::string* start,
+                    const std::string* limit);
+  // Body of the scan worker threads, see scan_queue_
+  static void ScanWorkerMain(void* db);
+  void ScanWorkerLoop();
+
   void RecordBackgroundError(const Status& s);
 
   void MaybeScheduleCompaction() EXCLUSIVE_LOCKS_REQUIRED(mutex_);
@@ -159,6 +240,51 @@ class DBImpl : public DB {
   Status InstallCompactionResults(CompactionState* compact)
       EXCLUSIVE_LOCKS_REQUIRED(mutex_);
 
+  // VTable garbage collection runs on a thread of its own, so that
+  // repointing keys can wait for foreground writers, which may in turn
+  // wait for the compaction thread
+  void MaybeScheduleGarbageCollect() EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+  static void BGGarbageCollectWork(void* db);
+  void BackgroundGarbageCollectCall();
+  // Rewrite the live records of the vtables picked for garbage collection
+  // into new vtables, up to options_.gc_max_bytes_per_run bytes of them
+  void BackgroundGarbageCollect() EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+  Status RelocateVTable(const VTableMeta& victim)
+      EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+  // Repoint the keys in "relocations" that still point to their old
+  // record and add the copies of the others to *edit as garbage.  Sets
+  // *sequence to the last sequence once they are written.
+  Status WriteRelocations(const std::vector<Relocation>& relocations,
+                          uint64_t new_number, VersionEdit* edit,
+                          SequenceNumber* sequence)
+      EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+  // Log the drop of the obsolete vtables no snapshot or read can see any
+  // longer, once they add up to options_.gc_size_threshold bytes, and
+  // delete their files
+  void ReleaseObsoleteVTables() EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+  bool HasReleasableVTables() EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+  // Oldest sequence a snapshot or a pinned read may still see,
+  // kMaxSequenceNumber if there is none
+  SequenceNumber OldestReadSequence() EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+  // Queue the vtables compactions left entirely invalid as obsolete
+  void QueueInvalidVTables() EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+
+  // Pin the latest sequence for a read without snapshot, see read_pins_
+  const SnapshotImpl* PinReadSequence() EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+  void UnpinReadSequence(const SnapshotImpl* pin)
+      EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+  // Iterator cleanup function unpinning "pin"
+  static void ReleaseReadPin(void* db, void* pin);
+
+  // versions_->LogAndApply() for the compaction and vtable gc threads,
+  // which must not call it concurrently
+  Status LogAndApply(VersionEdit* edit) EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+
+  // Look up the raw value of "key" as of "sequence"
+  Status GetRawValue(MemTable* mem, MemTable* imm, Version* current,
+                     const Slice& key, SequenceNumber sequence,
+                     std::string* raw);
+
   const Comparator* user_comparator() const {
     return internal_comparator_.user_comparator();
   }
@@ -188,14 +314,24 @@ class DBImpl : public DB {
   WritableFile* logfile_;
   uint64_t logfile_number_ GUARDED_BY(mutex_);
   log::Writer* log_;
+  // Value logs of mem_ and imm_, null unless options_.kv_sep_on_write
+  ValueLog* vlog_;
+  ValueLog* imm_vlog_ GUARDED_BY(mutex_);
   uint32_t seed_ GUARDED_BY(mutex_);  // For sampling.
 
   // Queue of writers.
   std::deque<Writer*> writers_ GUARDED_BY(mutex_);
   WriteBatch* tmp_batch_ GUARDED_BY(mutex_);
+  WriteBatch* vlog_batch_;  // Used by the front writer only
 
   SnapshotList snapshots_ GUARDED_BY(mutex_);
 
+  // Sequences read as of by lookups and iterators without a snapshot.
+  // Unlike snapshots_ they do not keep compactions from dropping
+  // overwritten entries, only vtable gc from dropping the relocated
+  // vtables the reads may still point into.
+  SnapshotList read_pins_ GUARDED_BY(mutex_);
+
   // Set of table files to protect from deletion because they are
   // part of ongoing compactions.
   std::set<uint64_t> pending_outputs_ GUARDED_BY(mutex_);
@@ -203,6 +339,12 @@ class DBImpl : public DB {
   // Has a background compaction been scheduled or is running?
   bool background_compaction_scheduled_ GUARDED_BY(mutex_);
 
+  // Is a background vtable gc running?
+  bool background_gc_scheduled_ GUARDED_BY(mutex_);
+
+  // Is some thread inside LogAndApply()?
+  bool logging_edit_ GUARDED_BY(mutex_);
+
   ManualCompaction* manual_compaction_ GUARDED_BY(mutex_);
 
   VersionSet* const versions_ GUARDED_BY(mutex_);
@@ -213,6 +355,30 @@ class DBImpl : public DB {
   CompactionStats stats_[config::kNumLevels] GUARDED_BY(mutex_);
 
   VTableManager* vtable_manager_ {};
+
+  // VTables no key points into as of "sequence": their live records were
+  // relocated, or compactions left none.  Reads at older sequences may
+  // still need them, see ReleaseObsoleteVTables.
+  struct ObsoleteVTable {
+    uint64_t number;
+    uint64_t size;
+    SequenceNumber sequence;
+  };
+  std::vector<ObsoleteVTable> obsolete_vtables_ GUARDED_BY(mutex_);
+
+  // vtable_cache_ provides its own synchronization
+  VTableCache* vtable_cache_ {};
+
+  // Key ranges of FindKeysByField calls waiting for a scan worker.  The
+  // workers are shared by all calls, started on demand up to a fixed
+  // number and stopped by the destructor.  A call scans the ranges no
+  // worker took in time itself.
+  port::Mutex scan_mutex_;
+  port::CondVar scan_cv_ GUARDED_BY(scan_mutex_);
+  std::deque<FieldScanRange*> scan_queue_ GUARDED_BY(scan_mutex_);
+  int scan_workers_ GUARDED_BY(scan_mutex_);
+  int idle_scan_workers_ GUARDED_BY(scan_mutex_);
+  bool stopping_scan_workers_ GUARDED_BY(scan_mutex_);
 };
 
 // Sanitize db options.  The caller should delete result.info_log if
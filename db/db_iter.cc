@@ -4,12 +4,18 @@
 
 #include "db/db_iter.h"
 
+#include <memory>
+#include <vector>
+
 #include "db/db_impl.h"
 #include "db/dbformat.h"
 #include "db/filename.h"
+#include "db/secondary_index.h"
 #include "leveldb/env.h"
+#include "leveldb/field_predicate.h"
 #include "leveldb/iterator.h"
 #include "port/port.h"
+#include "table/vtable_format.h"
 #include "util/logging.h"
 #include "util/mutexlock.h"
 #include "util/random.h"
@@ -45,16 +51,35 @@ class DBIter : public Iterator {
   //     just before all entries whose user key == this->key().
   enum Direction { kForward, kReverse };
 
-  DBIter(DBImpl* db, const Comparator* cmp, Iterator* iter, SequenceNumber s,
-         uint32_t seed)
+  DBIter(DBImpl* db, const ReadOptions& options, const Comparator* cmp,
+         Iterator* iter, SequenceNumber s, uint32_t seed, bool index_keys)
       : db_(db),
+        options_(options),
         user_comparator_(cmp),
         iter_(iter),
         sequence_(s),
+        index_keys_(index_keys),
         direction_(kForward),
         valid_(false),
         rnd_(seed),
-        bytes_until_read_sampling_(RandomCompactionPeriod()) {}
+        bytes_until_read_sampling_(RandomCompactionPeriod()),
+        prefetch_depth_(
+            options.prefetch_values > 0 && !options.keys_only
+                ? options.prefetch_values
+                : 0),
+        prefetched_(0),
+        prefetch_pos_(0),
+        prefetch_more_(false),
+        prefetched_keys_(prefetch_depth_),
+        prefetched_raws_(prefetch_depth_),
+        prefetched_values_(new PinnableSlice[prefetch_depth_]),
+        prefetched_statuses_(prefetch_depth_),
+        predicate_options_(options) {
+    if (options.predicate != nullptr) {
+      predicate_field_.push_back(options.predicate->field_name());
+      predicate_options_.fields = &predicate_field_;
+    }
+  }
 
   DBIter(const DBIter&) = delete;
   DBIter& operator=(const DBIter&) = delete;
@@ -63,23 +88,94 @@ class DBIter : public Iterator {
   bool Valid() const override { return valid_; }
   Slice key() const override {
     assert(valid_);
+    if (prefetch_pos_ < prefetched_) {
+      return prefetched_keys_[prefetch_pos_];
+    }
     return (direction_ == kForward) ? ExtractUserKey(iter_->key()) : saved_key_;
   }
   Slice value() const override {
     assert(valid_);
+    if (prefetch_pos_ < prefetched_) {
+      return prefetched_raws_[prefetch_pos_];
+    }
     return (direction_ == kForward) ? iter_->value() : saved_value_;
   }
   Fields fields() const override {
     assert(valid_);
-    if (direction_ == kForward) {
-      std::string field_str = iter_->value().ToString();
-      db_->DecodeValue(&field_str);
-      return Fields(Slice(field_str));
+    if (options_.keys_only) {
+      return Fields();
+    }
+    if (prefetch_pos_ < prefetched_) {
+      if (!prefetched_statuses_[prefetch_pos_].ok()) {
+        // Already recorded by Prefetch()
+        return Fields();
+      }
+      return MakeFields(prefetched_values_[prefetch_pos_]);
+    }
+    Slice raw = (direction_ == kForward) ? iter_->value() : saved_value_;
+    PinnableSlice value;
+    Status s = db_->DecodeValue(options_, raw, &value);
+    if (!s.ok()) {
+      RecordError(s);
+      return Fields();
+    }
+    return MakeFields(value);
+  }
+  Status fields_view(FieldsView* view) const override {
+    assert(valid_);
+    PinnableSlice* value = view->pinnable();
+    value->Reset();
+    Status s;
+    if (options_.keys_only) {
+      // Nothing is read, like fields()
+    } else if (prefetch_pos_ < prefetched_) {
+      s = prefetched_statuses_[prefetch_pos_];
+      if (s.ok()) {
+        view->Reset(prefetched_values_[prefetch_pos_]);
+        return s;
+      }
     } else {
-      std::string field_str = saved_value_;
-      db_->DecodeValue(&field_str);
-      return Fields(Slice(field_str));
+      Slice raw = (direction_ == kForward) ? iter_->value() : saved_value_;
+      s = db_->DecodeValue(options_, raw, value);
+      if (s.ok()) {
+        view->Reset(*value);
+        return s;
+      }
+      RecordError(s);
+    }
+    view->Reset(Slice());
+    return s;
+  }
+  uint64_t value_size() const override {
+    Slice raw = value();
+    if (!raw.empty() &&
+        static_cast<unsigned char>(raw[0]) == FieldsIndex::kFieldsIndex) {
+      // The inline fields plus those separated together
+      FieldsIndex fields_index;
+      if (fields_index.Decode(&raw).ok()) {
+        return fields_index.inline_fields.size() +
+               ValueSizeFromHandle(fields_index.index.vtable_handle,
+                                   key().size());
+      }
+      return 0;
     }
+    VTableIndex index;
+    if (DecodeIndex(&index)) {
+      return ValueSizeFromHandle(index.vtable_handle, key().size());
+    }
+    // Leave out the value type
+    return raw.empty() ? 0 : raw.size() - 1;
+  }
+  bool value_handle(uint64_t* file_number, uint64_t* offset,
+                    uint64_t* size) const override {
+    VTableIndex index;
+    if (!DecodeIndex(&index)) {
+      return false;
+    }
+    *file_number = index.file_number;
+    *offset = index.vtable_handle.offset;
+    *size = index.vtable_handle.size;
+    return true;
   }
   Status status() const override {
     if (status_.ok()) {
@@ -99,6 +195,37 @@ class DBIter : public Iterator {
   void FindNextUserEntry(bool skipping, std::string* skip);
   void FindPrevUserEntry();
   bool ParseKey(ParsedInternalKey* key);
+  // Move iter_ past the entries index_keys_ excludes, starting with the
+  // current one whose user key is "user_key", in one seek.
+  void SkipExcluded(const Slice& user_key, bool forward);
+  // Position iter_ at the last entry before "user_key" if "before", at
+  // the first one at or after it otherwise.
+  void SeekUserKey(const Slice& user_key, bool before);
+  void StepForward();
+  // Decode the current value into *index if it points into a VTable
+  bool DecodeIndex(VTableIndex* index) const;
+  // Return true iff "raw", a value as stored, satisfies
+  // options_.predicate, if any.  Sets status_ if it cannot be read.
+  bool Matches(const Slice& raw);
+  // Keep "s" in status_ unless an error is recorded already
+  void RecordError(const Status& s) const {
+    if (status_.ok() && !s.ok()) {
+      status_ = s;
+    }
+  }
+  // Decode encoded Fields, keeping only options_.fields if set
+  Fields MakeFields(const Slice& encoded) const {
+    return options_.fields != nullptr ? Fields(encoded, *options_.fields)
+                                      : Fields(encoded);
+  }
+
+  // Buffer the current entry and up to prefetch_depth_-1 entries after
+  // it, resolving their values in one batch.  Leaves iter_ positioned
+  // as if the last buffered entry had been stepped past.
+  // REQUIRES: valid_ && direction_ == kForward && prefetch_depth_ > 0
+  void Prefetch();
+  // Drop the buffered entries, repositioning iter_ at the current one.
+  void ClearPrefetched();
 
   inline void SaveKey(const Slice& k, std::string* dst) {
     dst->assign(k.data(), k.size());
@@ -119,16 +246,36 @@ class DBIter : public Iterator {
   }
 
   DBImpl* db_;
+  const ReadOptions options_;
   const Comparator* const user_comparator_;
   Iterator* const iter_;
   SequenceNumber const sequence_;
-  Status status_;
+  // Yield secondary index entries instead of user entries
+  const bool index_keys_;
+  // Also set by the const value readers when a value cannot be read
+  mutable Status status_;
   std::string saved_key_;    // == current key when direction_==kReverse
   std::string saved_value_;  // == current raw value when direction_==kReverse
   Direction direction_;
   bool valid_;
   Random rnd_;
   size_t bytes_until_read_sampling_;
+
+  // Entries buffered by Prefetch(); the current one is at prefetch_pos_.
+  // Nothing is buffered iff prefetch_pos_ >= prefetched_.
+  const size_t prefetch_depth_;
+  size_t prefetched_;
+  size_t prefetch_pos_;
+  bool prefetch_more_;  // Whether iter_ is at an entry past the buffer
+  std::vector<std::string> prefetched_keys_;
+  std::vector<std::string> prefetched_raws_;
+  std::unique_ptr<PinnableSlice[]> prefetched_values_;
+  std::vector<Status> prefetched_statuses_;
+
+  // options_ with the field options_.predicate tests as projection
+  ReadOptions predicate_options_;
+  std::vector<std::string> predicate_field_;
+  PinnableSlice predicate_value_;
 };
 
 inline bool DBIter::ParseKey(ParsedInternalKey* ikey) {
@@ -150,9 +297,39 @@ inline bool DBIter::ParseKey(ParsedInternalKey* ikey) {
   }
 }
 
+bool DBIter::DecodeIndex(VTableIndex* index) const {
+  return GetVTableIndex(value(), index);
+}
+
+bool DBIter::Matches(const Slice& raw) {
+  if (options_.predicate == nullptr) {
+    return true;
+  }
+  // Inline fields are only pinned, and only the tested field is read
+  // from a VTable
+  Status s = db_->DecodeValue(predicate_options_, raw, &predicate_value_);
+  if (!s.ok()) {
+    status_ = s;
+    return false;
+  }
+  return options_.predicate->MatchesFields(predicate_value_);
+}
+
 void DBIter::Next() {
   assert(valid_);
 
+  if (prefetch_pos_ < prefetched_) {
+    if (++prefetch_pos_ < prefetched_) {
+      return;
+    }
+    prefetched_ = prefetch_pos_ = 0;
+    valid_ = prefetch_more_;
+    if (valid_) {
+      Prefetch();
+    }
+    return;
+  }
+
   if (direction_ == kReverse) {  // Switch directions?
     direction_ = kForward;
     // iter_ is pointing just before the entries for this->key(),
@@ -169,30 +346,88 @@ void DBIter::Next() {
       return;
     }
     // saved_key_ already contains the key to skip past.
+    FindNextUserEntry(true, &saved_key_);
   } else {
-    // Store in saved_key_ the current key so we skip it below.
-    SaveKey(ExtractUserKey(iter_->key()), &saved_key_);
+    StepForward();
+  }
+  if (valid_ && prefetch_depth_ > 0) {
+    Prefetch();
+  }
+}
 
-    // iter_ is pointing to current key. We can now safely move to the next to
-    // avoid checking current key.
-    iter_->Next();
-    if (!iter_->Valid()) {
-      valid_ = false;
-      saved_key_.clear();
-      return;
-    }
+void DBIter::StepForward() {
+  assert(valid_ && direction_ == kForward);
+  // Store in saved_key_ the current key so we skip it below.
+  SaveKey(ExtractUserKey(iter_->key()), &saved_key_);
+
+  // iter_ is pointing to current key. We can now safely move to the next to
+  // avoid checking current key.
+  iter_->Next();
+  if (!iter_->Valid()) {
+    valid_ = false;
+    saved_key_.clear();
+    return;
   }
 
   FindNextUserEntry(true, &saved_key_);
 }
 
+void DBIter::Prefetch() {
+  assert(valid_ && direction_ == kForward && prefetch_depth_ > 0);
+  size_t n = 0;
+  while (valid_ && n < prefetch_depth_) {
+    SaveKey(ExtractUserKey(iter_->key()), &prefetched_keys_[n]);
+    Slice raw_value = iter_->value();
+    prefetched_raws_[n].assign(raw_value.data(), raw_value.size());
+    n++;
+    StepForward();
+  }
+
+  std::vector<Slice> raws(prefetched_raws_.begin(),
+                          prefetched_raws_.begin() + n);
+  for (size_t i = 0; i < n; i++) {
+    prefetched_statuses_[i] = Status::OK();
+  }
+  db_->DecodeValues(options_, n, raws.data(), prefetched_values_.get(),
+                    prefetched_statuses_.data());
+  for (size_t i = 0; i < n; i++) {
+    RecordError(prefetched_statuses_[i]);
+  }
+  prefetched_ = n;
+  prefetch_pos_ = 0;
+  prefetch_more_ = valid_;
+  valid_ = true;
+}
+
+void DBIter::ClearPrefetched() {
+  if (prefetch_pos_ >= prefetched_) {
+    return;
+  }
+  std::string current = prefetched_keys_[prefetch_pos_];
+  prefetched_ = prefetch_pos_ = 0;
+  // The entry is still visible at sequence_, so this lands right on it
+  saved_key_.clear();
+  AppendInternalKey(&saved_key_,
+                    ParsedInternalKey(current, sequence_, kValueTypeForSeek));
+  iter_->Seek(saved_key_);
+  valid_ = iter_->Valid();
+  if (valid_) {
+    FindNextUserEntry(false, &saved_key_ /* temporary storage */);
+  }
+}
+
 void DBIter::FindNextUserEntry(bool skipping, std::string* skip) {
   // Loop until we hit an acceptable entry to yield
   assert(iter_->Valid());
   assert(direction_ == kForward);
   do {
     ParsedInternalKey ikey;
-    if (ParseKey(&ikey) && ikey.sequence <= sequence_) {
+    if (!ParseKey(&ikey)) {
+      // Skip it
+    } else if (IsIndexKey(ikey.user_key) != index_keys_) {
+      SkipExcluded(ikey.user_key, true);
+      continue;
+    } else if (ikey.sequence <= sequence_) {
       switch (ikey.type) {
         case kTypeDeletion:
           // Arrange to skip all upcoming entries for this key since
@@ -204,6 +439,10 @@ void DBIter::FindNextUserEntry(bool skipping, std::string* skip) {
           if (skipping &&
               user_comparator_->Compare(ikey.user_key, *skip) <= 0) {
             // Entry hidden
+          } else if (!Matches(iter_->value())) {
+            // So are the older entries for this key
+            SaveKey(ikey.user_key, skip);
+            skipping = true;
           } else {
             valid_ = true;
             saved_key_.clear();
@@ -221,6 +460,11 @@ void DBIter::FindNextUserEntry(bool skipping, std::string* skip) {
 void DBIter::Prev() {
   assert(valid_);
 
+  ClearPrefetched();
+  if (!valid_) {
+    return;
+  }
+
   if (direction_ == kForward) {  // Switch directions?
     // iter_ is pointing at the current entry.  Scan backwards until
     // the key changes so we can use the normal reverse scanning code.
@@ -249,10 +493,15 @@ void DBIter::FindPrevUserEntry() {
   assert(direction_ == kReverse);
 
   ValueType value_type = kTypeDeletion;
-  if (iter_->Valid()) {
+  while (iter_->Valid()) {
     do {
       ParsedInternalKey ikey;
-      if (ParseKey(&ikey) && ikey.sequence <= sequence_) {
+      if (!ParseKey(&ikey)) {
+        // Skip it
+      } else if (IsIndexKey(ikey.user_key) != index_keys_) {
+        SkipExcluded(ikey.user_key, false);
+        continue;
+      } else if (ikey.sequence <= sequence_) {
         if ((value_type != kTypeDeletion) &&
             user_comparator_->Compare(ikey.user_key, saved_key_) < 0) {
           // We encountered a non-deleted value in entries for previous keys,
@@ -274,6 +523,13 @@ void DBIter::FindPrevUserEntry() {
       }
       iter_->Prev();
     } while (iter_->Valid());
+    if (value_type == kTypeDeletion || Matches(saved_value_)) {
+      break;
+    }
+    // Look for the previous key, iter_ is already at one of its entries
+    value_type = kTypeDeletion;
+    saved_key_.clear();
+    ClearSavedValue();
   }
 
   if (value_type == kTypeDeletion) {
@@ -287,7 +543,45 @@ void DBIter::FindPrevUserEntry() {
   }
 }
 
+void DBIter::SkipExcluded(const Slice& user_key, bool forward) {
+  if (user_comparator_ != BytewiseComparator()) {
+    // Index keys are not adjacent then, step over this one alone
+    forward ? iter_->Next() : iter_->Prev();
+    return;
+  }
+  if (!index_keys_) {
+    // Jump over the range of index keys
+    SeekUserKey(forward ? kIndexKeyLimit : kIndexKeyPrefix, !forward);
+  } else if ((user_key.compare(kIndexKeyPrefix) < 0) == forward) {
+    // Jump to the range of index keys
+    SeekUserKey(forward ? kIndexKeyPrefix : kIndexKeyLimit, !forward);
+  } else if (forward) {
+    // Past the range of index keys, there is nothing left
+    iter_->SeekToLast();
+    if (iter_->Valid()) iter_->Next();
+  } else {
+    iter_->SeekToFirst();
+    if (iter_->Valid()) iter_->Prev();
+  }
+}
+
+void DBIter::SeekUserKey(const Slice& user_key, bool before) {
+  std::string target;
+  AppendInternalKey(&target, ParsedInternalKey(user_key, kMaxSequenceNumber,
+                                               kValueTypeForSeek));
+  iter_->Seek(target);
+  if (!before) {
+    return;
+  }
+  if (iter_->Valid()) {
+    iter_->Prev();
+  } else {
+    iter_->SeekToLast();
+  }
+}
+
 void DBIter::Seek(const Slice& target) {
+  prefetched_ = prefetch_pos_ = 0;
   direction_ = kForward;
   ClearSavedValue();
   saved_key_.clear();
@@ -299,9 +593,13 @@ void DBIter::Seek(const Slice& target) {
   } else {
     valid_ = false;
   }
+  if (valid_ && prefetch_depth_ > 0) {
+    Prefetch();
+  }
 }
 
 void DBIter::SeekToFirst() {
+  prefetched_ = prefetch_pos_ = 0;
   direction_ = kForward;
   ClearSavedValue();
   iter_->SeekToFirst();
@@ -310,9 +608,13 @@ void DBIter::SeekToFirst() {
   } else {
     valid_ = false;
   }
+  if (valid_ && prefetch_depth_ > 0) {
+    Prefetch();
+  }
 }
 
 void DBIter::SeekToLast() {
+  prefetched_ = prefetch_pos_ = 0;
   direction_ = kReverse;
   ClearSavedValue();
   iter_->SeekToLast();
@@ -321,10 +623,12 @@ void DBIter::SeekToLast() {
 
 }  // anonymous namespace
 
-Iterator* NewDBIterator(DBImpl* db, const Comparator* user_key_comparator,
+Iterator* NewDBIterator(DBImpl* db, const ReadOptions& options,
+                        const Comparator* user_key_comparator,
                         Iterator* internal_iter, SequenceNumber sequence,
-                        uint32_t seed) {
-  return new DBIter(db, user_key_comparator, internal_iter, sequence, seed);
+                        uint32_t seed, bool index_keys) {
+  return new DBIter(db, options, user_key_comparator, internal_iter, sequence,
+                    seed, index_keys);
 }
 
 }  // namespace leveldb
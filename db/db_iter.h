@@ -16,10 +16,13 @@ class DBImpl;
 
 // Return a new iterator that converts internal keys (yielded by
 // "*internal_iter") that were live at the specified "sequence" number
-// into appropriate user keys.
-Iterator* NewDBIterator(DBImpl* db, const Comparator* user_key_comparator,
+// into appropriate user keys.  "options" controls how values are read.
+// Secondary index entries are skipped, unless "index_keys" is set, in
+// which case they are the only keys yielded.
+Iterator* NewDBIterator(DBImpl* db, const ReadOptions& options,
+                        const Comparator* user_key_comparator,
                         Iterator* internal_iter, SequenceNumber sequence,
-                        uint32_t seed);
+                        uint32_t seed, bool index_keys = false);
 
 }  // namespace leveldb
 
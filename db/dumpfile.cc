@@ -17,6 +17,7 @@
 #include "leveldb/status.h"
 #include "leveldb/table.h"
 #include "leveldb/write_batch.h"
+#include "table/vtable_reader.h"
 #include "util/logging.h"
 
 namespace leveldb {
@@ -209,6 +210,66 @@ Status DumpTable(Env* env, const std::string& fname, WritableFile* dst) {
   return Status::OK();
 }
 
+Status DumpVTable(Env* env, const std::string& fname, WritableFile* dst) {
+  Options options;
+  options.env = env;
+  VTableReader reader;
+  Status s = reader.Open(options, fname, /*use_mmap=*/false,
+                         RandomAccessFile::kSequential);
+  uint64_t data_size = 0;
+  std::string r;
+  if (s.ok()) {
+    VTableProperties properties;
+    s = reader.ReadProperties(&properties);
+    if (s.ok()) {
+      data_size = properties.data_size;
+      r = "records: ";
+      AppendNumberTo(&r, properties.records_num);
+      r += ", keys: '";
+      AppendEscapedStringTo(&r, properties.smallest_key);
+      r += "' .. '";
+      AppendEscapedStringTo(&r, properties.largest_key);
+      r += "', blocks: ";
+      AppendNumberTo(&r, properties.block_offsets.size());
+      r += "\n";
+    } else if (s.IsNotFound()) {
+      // A legacy vtable or a value log
+      s = env->GetFileSize(fname, &data_size);
+      r = "format: ";
+      AppendNumberTo(&r, reader.FormatVersion());
+      r += ", no footer\n";
+    }
+  }
+  if (!s.ok()) {
+    return s;
+  }
+  dst->Append(r);
+
+  std::string scratch;
+  std::string buffer;
+  uint64_t offset = reader.DataOffset();
+  while (offset < data_size) {
+    VTableHandle handle;
+    VTableRecord record;
+    s = reader.ReadRecord(offset, data_size, &handle, &record, &scratch,
+                          &buffer);
+    if (!s.ok()) {
+      dst->Append("record error: " + s.ToString() + "\n");
+      break;
+    }
+    r = "@ ";
+    AppendNumberTo(&r, offset);
+    r += " '";
+    AppendEscapedStringTo(&r, record.key);
+    r += "' => '";
+    AppendEscapedStringTo(&r, record.value);
+    r += "'\n";
+    dst->Append(r);
+    offset += handle.size;
+  }
+  return Status::OK();
+}
+
 }  // namespace
 
 Status DumpFile(Env* env, const std::string& fname, WritableFile* dst) {
@@ -223,6 +284,8 @@ Status DumpFile(Env* env, const std::string& fname, WritableFile* dst) {
       return DumpDescriptor(env, fname, dst);
     case kTableFile:
       return DumpTable(env, fname, dst);
+    case kVTableFile:
+      return DumpVTable(env, fname, dst);
     default:
       break;
   }
@@ -31,6 +31,18 @@ namespace leveldb {
     }
   }
 
+  Fields::Fields(const Slice& fields_str,
+                 const std::vector<std::string>& field_names) {
+    FieldsView view(fields_str);
+    Slice value;
+    for (const std::string& name : field_names) {
+      if (view.Get(name, &value)) {
+        this->_fields[name] = value.ToString();
+        this->size_ += name.size() + value.size();
+      }
+    }
+  }
+
   Fields::~Fields() {
     this->_fields.clear();
   }
@@ -70,4 +82,136 @@ namespace leveldb {
 
     return field_array;
   }
-}  // namespace leveldb
\ No newline at end of file
+
+  bool FindField(const Slice& fields_str, const Slice& field_name,
+                 Slice* field_value) {
+    Slice fields = fields_str;
+    while (fields.size() > 0) {
+      uint64_t field_size;
+      uint64_t name_size;
+      if (!GetVarint64(&fields, &field_size) || field_size > fields.size()) {
+        return false;
+      }
+
+      Slice field = Slice(fields.data(), field_size);
+      fields.remove_prefix(field_size);
+      if (!GetVarint64(&field, &name_size) || name_size > field.size()) {
+        return false;
+      }
+
+      if (Slice(field.data(), name_size) == field_name) {
+        field.remove_prefix(name_size);
+        *field_value = field;
+        return true;
+      }
+    }
+    return false;
+  }
+  bool FieldsView::Reset(const Slice& fields_str) {
+    data_ = fields_str;
+    num_fields_ = 0;
+    sorted_ = true;
+    overflow_.clear();
+
+    Slice input = data_;
+    Slice name, value, last_name;
+    while (!input.empty()) {
+      const uint32_t offset =
+          static_cast<uint32_t>(input.data() - data_.data());
+      if (!GetField(&input, &name, &value)) {
+        data_ = Slice(data_.data(), offset);
+        return false;
+      }
+      if (num_fields_ > 0 && name.compare(last_name) <= 0) {
+        sorted_ = false;
+      }
+      last_name = name;
+
+      if (num_fields_ < kInlineFields) {
+        inline_offsets_[num_fields_] = offset;
+      } else {
+        if (overflow_.empty()) {
+          overflow_.assign(inline_offsets_, inline_offsets_ + kInlineFields);
+        }
+        overflow_.push_back(offset);
+      }
+      num_fields_++;
+    }
+    return true;
+  }
+
+  void FieldsView::field(size_t i, Slice* name, Slice* value) const {
+    assert(i < num_fields_);
+    const uint32_t offset = offsets()[i];
+    Slice input(data_.data() + offset, data_.size() - offset);
+    GetField(&input, name, value);
+  }
+
+  bool FieldsView::Get(const Slice& name, Slice* value) const {
+    Slice field_name;
+    if (!sorted_) {
+      for (size_t i = 0; i < num_fields_; i++) {
+        field(i, &field_name, value);
+        if (field_name == name) {
+          return true;
+        }
+      }
+      return false;
+    }
+
+    size_t left = 0;
+    size_t right = num_fields_;
+    while (left < right) {
+      const size_t mid = left + (right - left) / 2;
+      field(mid, &field_name, value);
+      const int cmp = field_name.compare(name);
+      if (cmp == 0) {
+        return true;
+      } else if (cmp < 0) {
+        left = mid + 1;
+      } else {
+        right = mid;
+      }
+    }
+    return false;
+  }
+
+  bool GetField(Slice* input, Slice* name, Slice* value) {
+    uint64_t field_size;
+    uint64_t name_size;
+    if (!GetVarint64(input, &field_size) || field_size > input->size()) {
+      return false;
+    }
+    Slice field = Slice(input->data(), field_size);
+    input->remove_prefix(field_size);
+    if (!GetVarint64(&field, &name_size) || name_size > field.size()) {
+      return false;
+    }
+    *name = Slice(field.data(), name_size);
+    *value = Slice(field.data() + name_size, field.size() - name_size);
+    return true;
+  }
+
+  void PutField(std::string* dst, const Slice& name, const Slice& value) {
+    PutVarint64(dst, VarintLength(name.size()) + name.size() + value.size());
+    PutVarint64(dst, name.size());
+    dst->append(name.data(), name.size());
+    dst->append(value.data(), value.size());
+  }
+
+  void MergeFields(const Slice& a, const Slice& b, std::string* dst) {
+    Slice input_a = a, input_b = b;
+    Slice name_a, value_a, name_b, value_b;
+    bool has_a = GetField(&input_a, &name_a, &value_a);
+    bool has_b = GetField(&input_b, &name_b, &value_b);
+    while (has_a || has_b) {
+      if (has_a && (!has_b || name_a.compare(name_b) <= 0)) {
+        PutField(dst, name_a, value_a);
+        has_a = GetField(&input_a, &name_a, &value_a);
+      } else {
+        PutField(dst, name_b, value_b);
+        has_b = GetField(&input_b, &name_b, &value_b);
+      }
+    }
+  }
+}  // namespace leveldb
@@ -5,6 +5,7 @@
 #include <string>
 #include <vector>
 
+#include "leveldb/pinnable_slice.h"
 #include "leveldb/slice.h"
 
 namespace leveldb {
@@ -20,6 +21,10 @@ namespace leveldb {
     // 从LevelDB存储的Value中解码出Fields
     explicit Fields(const Slice& fields_str);
 
+    // 只解码field_names中存在的字段，其余字段不拷贝
+    Fields(const Slice& fields_str,
+           const std::vector<std::string>& field_names);
+
     Fields() = default;
 
     ~Fields();
@@ -39,5 +44,67 @@ namespace leveldb {
     std::map<std::string, std::string> _fields;
     uint64_t size_ = 0;
   };
+
+  // 编码后Fields上的只读视图：不建map也不拷贝，字段名和字段值都指向编码
+  // 内部。Reset时记下每个字段的偏移，字段按名字有序时（Serialize的结果总是
+  // 有序的）按名字二分查找，否则顺序查找。不超过kInlineFields个字段时不
+  // 分配内存，重复使用同一个视图时也不会
+  class FieldsView {
+  public:
+    FieldsView() = default;
+
+    explicit FieldsView(const Slice& fields_str) { Reset(fields_str); }
+
+    FieldsView(const FieldsView&) = delete;
+    FieldsView& operator=(const FieldsView&) = delete;
+
+    // 改为查看fields_str，它必须比视图活得久。编码损坏时返回false，
+    // 视图只含损坏处之前的字段
+    bool Reset(const Slice& fields_str);
+
+    // DB填入编码的缓冲区，由视图持有，之后以Reset(*pinnable())查看它
+    PinnableSlice* pinnable() { return &pinnable_; }
+
+    // 字段数
+    size_t size() const { return num_fields_; }
+
+    // 第i个字段，0 <= i < size()
+    void field(size_t i, Slice* name, Slice* value) const;
+
+    // 查找字段，找到时*value指向编码内部并返回true
+    bool Get(const Slice& name, Slice* value) const;
+
+    // 视图查看的编码
+    Slice data() const { return data_; }
+
+  private:
+    static const size_t kInlineFields = 16;
+
+    const uint32_t* offsets() const {
+      return overflow_.empty() ? inline_offsets_ : overflow_.data();
+    }
+
+    Slice data_;
+    size_t num_fields_{0};
+    bool sorted_{true};
+    // 每个字段在data_中的偏移，多于kInlineFields个时全部放在overflow_中
+    uint32_t inline_offsets_[kInlineFields];
+    std::vector<uint32_t> overflow_;
+    PinnableSlice pinnable_;
+  };
+
+  // 在编码后的Fields中查找单个字段，不解码其余字段也不拷贝字段值
+  // 找到时*field_value指向fields_str内部并返回true
+  bool FindField(const Slice& fields_str, const Slice& field_name,
+                 Slice* field_value);
+
+  // 解码编码后Fields中的下一个字段，*name和*value指向input内部
+  bool GetField(Slice* input, Slice* name, Slice* value);
+
+  // 按Fields的编码追加一个字段
+  void PutField(std::string* dst, const Slice& name, const Slice& value);
+
+  // 合并两个按字段名排序的编码后Fields，结果仍然有序
+  void MergeFields(const Slice& a, const Slice& b, std::string* dst);
 }  // namespace leveldb
 #endif //STORAGE_LEVELDB_FIELDS_H_
@@ -14,6 +14,8 @@
 //        all tables (see 2c)
 //      - compaction pointers are cleared
 //      - every table file is added at level 0
+//      - every vtable is added as fully live, its record count taken
+//        from its footer
 //
 // Possible optimization 1:
 //   (a) Compute total size and use to pick appropriate max-level M
@@ -37,6 +39,7 @@
 #include "leveldb/comparator.h"
 #include "leveldb/db.h"
 #include "leveldb/env.h"
+#include "table/vtable_reader.h"
 
 namespace leveldb {
 
@@ -72,6 +75,7 @@ class Repairer {
     if (status.ok()) {
       ConvertLogFilesToTables();
       ExtractMetaData();
+      ExtractVTableMetaData();
       status = WriteDescriptor();
     }
     if (status.ok()) {
@@ -119,6 +123,8 @@ class Repairer {
             logs_.push_back(number);
           } else if (type == kTableFile) {
             table_numbers_.push_back(number);
+          } else if (type == kVTableFile) {
+            vtable_numbers_.push_back(number);
           } else {
             // Ignore other files
           }
@@ -212,6 +218,9 @@ class Repairer {
       if (meta.file_size > 0) {
         table_numbers_.push_back(meta.number);
       }
+      if (vtable_meta.records_num > 0) {
+        vtable_numbers_.push_back(vtable_meta.number);
+      }
     }
 
     Log(options_.info_log, "Log #%llu: %d ops saved to Table #%llu %s",
@@ -226,6 +235,58 @@ class Repairer {
     }
   }
 
+  void ExtractVTableMetaData() {
+    for (size_t i = 0; i < vtable_numbers_.size(); i++) {
+      ScanVTable(vtable_numbers_[i]);
+    }
+  }
+
+  void ScanVTable(uint64_t number) {
+    // Which records are still referenced is unknown, they all count as
+    // live until compactions drop them again
+    VTableMeta meta;
+    meta.number = number;
+    std::string fname = VTableFileName(dbname_, number);
+    VTableReader reader;
+    Status status = env_->GetFileSize(fname, &meta.table_size);
+    if (status.ok()) {
+      status = reader.Open(options_, fname, /*use_mmap=*/false,
+                           RandomAccessFile::kSequential);
+    }
+    if (status.ok()) {
+      VTableProperties properties;
+      status = reader.ReadProperties(&properties);
+      if (status.ok()) {
+        meta.records_num = properties.records_num;
+      } else {
+        // A legacy vtable, a value log or a damaged footer: count the
+        // records up to the first one that does not parse
+        status = Status::OK();
+        std::string scratch;
+        std::string buffer;
+        uint64_t offset = reader.DataOffset();
+        while (status.ok() && offset < meta.table_size) {
+          VTableHandle handle;
+          VTableRecord record;
+          status = reader.ReadRecord(offset, meta.table_size, &handle,
+                                     &record, &scratch, &buffer);
+          if (status.ok()) {
+            offset += handle.size;
+            meta.records_num++;
+          }
+        }
+      }
+    }
+    Log(options_.info_log, "VTable #%llu: %llu records %s",
+        (unsigned long long)number, (unsigned long long)meta.records_num,
+        status.ToString().c_str());
+    if (meta.records_num > 0) {
+      vtables_.push_back(meta);
+    } else {
+      ArchiveFile(fname);
+    }
+  }
+
   Iterator* NewTableIterator(const FileMetaData& meta) {
     // Same as compaction iterators: if paranoid_checks are on, turn
     // on checksum verification.
@@ -373,6 +434,9 @@ class Repairer {
       edit_.AddFile(0, t.meta.number, t.meta.file_size, t.meta.smallest,
                     t.meta.largest);
     }
+    for (size_t i = 0; i < vtables_.size(); i++) {
+      edit_.AddVTable(vtables_[i]);
+    }
 
     // std::fprintf(stderr,
     //              "NewDescriptor:\n%s\n", edit_.DebugString().c_str());
@@ -441,6 +505,8 @@ class Repairer {
   std::vector<uint64_t> table_numbers_;
   std::vector<uint64_t> logs_;
   std::vector<TableInfo> tables_;
+  std::vector<uint64_t> vtable_numbers_;
+  std::vector<VTableMeta> vtables_;
   uint64_t next_file_number_;
 };
 }  // namespace
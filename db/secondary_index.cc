@@ -0,0 +1,48 @@
+#include "db/secondary_index.h"
+
+#include "util/coding.h"
+
+namespace leveldb {
+
+const char kIndexKeyPrefix[] = "\xff\xff" "idx";
+const char kIndexKeyLimit[] = "\xff\xff" "idy";
+
+static const size_t kIndexKeyPrefixSize = sizeof(kIndexKeyPrefix) - 1;
+
+bool IsIndexKey(const Slice& user_key) {
+  return user_key.starts_with(Slice(kIndexKeyPrefix, kIndexKeyPrefixSize));
+}
+
+void AppendIndexMarker(std::string* dst, const Slice& field_name) {
+  dst->append(kIndexKeyPrefix, kIndexKeyPrefixSize);
+  PutLengthPrefixedSlice(dst, field_name);
+}
+
+void AppendIndexPrefix(std::string* dst, const Slice& field_name,
+                       const Slice& field_value) {
+  AppendIndexMarker(dst, field_name);
+  PutLengthPrefixedSlice(dst, field_value);
+}
+
+void AppendIndexKey(std::string* dst, const Slice& field_name,
+                    const Slice& field_value, const Slice& primary_key) {
+  AppendIndexPrefix(dst, field_name, field_value);
+  dst->append(primary_key.data(), primary_key.size());
+}
+
+bool ParseIndexKey(const Slice& index_key, Slice* field_name,
+                   bool* is_marker) {
+  if (!IsIndexKey(index_key)) {
+    return false;
+  }
+  Slice input = index_key;
+  input.remove_prefix(kIndexKeyPrefixSize);
+  if (!GetLengthPrefixedSlice(&input, field_name)) {
+    return false;
+  }
+  *is_marker = input.empty();
+  Slice field_value;
+  return *is_marker || GetLengthPrefixedSlice(&input, &field_value);
+}
+
+}  // namespace leveldb
@@ -0,0 +1,49 @@
+// Secondary index entries share the key space of the user keys, under a
+// prefix user keys must not start with:
+//
+//    kIndexKeyPrefix | varint32 name size | field name
+//                    | varint32 value size | field value | primary key
+//
+// and hold an empty value.  All the entries of one field value are then
+// adjacent, ordered by primary key.  Besides its entries, every field
+// indexed in full has a marker, the key made of the prefix and its name
+// alone, so that an index added to an existing database is noticed and
+// built on open.
+
+#ifndef STORAGE_LEVELDB_DB_SECONDARY_INDEX_H_
+#define STORAGE_LEVELDB_DB_SECONDARY_INDEX_H_
+
+#include <string>
+
+#include "leveldb/slice.h"
+
+namespace leveldb {
+
+extern const char kIndexKeyPrefix[];
+// Smallest key after every index key
+extern const char kIndexKeyLimit[];
+
+// Return true iff "user_key" is a secondary index entry or marker.
+bool IsIndexKey(const Slice& user_key);
+
+// Append the marker of the index on "field_name" to *dst.  The marker is
+// also the common prefix of all its entries.
+void AppendIndexMarker(std::string* dst, const Slice& field_name);
+
+// Append the common prefix of the entries of "field_value" to *dst.
+void AppendIndexPrefix(std::string* dst, const Slice& field_name,
+                       const Slice& field_value);
+
+// Append the entry of "primary_key" holding "field_value" to *dst.
+void AppendIndexKey(std::string* dst, const Slice& field_name,
+                    const Slice& field_value, const Slice& primary_key);
+
+// Parse the name of the field "index_key" belongs to into *field_name
+// and set *is_marker iff it is the marker of that field.  Returns false
+// on a key that is not well formed.
+bool ParseIndexKey(const Slice& index_key, Slice* field_name,
+                   bool* is_marker);
+
+}  // namespace leveldb
+
+#endif  // STORAGE_LEVELDB_DB_SECONDARY_INDEX_H_
@@ -5,6 +5,7 @@
 #include "db/version_edit.h"
 
 #include "db/version_set.h"
+#include "table/vtable_format.h"
 #include "util/coding.h"
 
 namespace leveldb {
@@ -20,7 +21,10 @@ enum Tag {
   kDeletedFile = 6,
   kNewFile = 7,
   // 8 was used for large value refs
-  kPrevLogNumber = 9
+  kPrevLogNumber = 9,
+  kNewVTable = 10,
+  kVTableGarbage = 11,
+  kDroppedVTable = 12
 };
 
 void VersionEdit::Clear() {
@@ -37,6 +41,9 @@ void VersionEdit::Clear() {
   compact_pointers_.clear();
   deleted_files_.clear();
   new_files_.clear();
+  new_vtables_.clear();
+  vtable_garbage_.clear();
+  dropped_vtables_.clear();
 }
 
 void VersionEdit::EncodeTo(std::string* dst) const {
@@ -82,6 +89,25 @@ void VersionEdit::EncodeTo(std::string* dst) const {
     PutLengthPrefixedSlice(dst, f.smallest.Encode());
     PutLengthPrefixedSlice(dst, f.largest.Encode());
   }
+
+  for (const VTableMeta& meta : new_vtables_) {
+    PutVarint32(dst, kNewVTable);
+    std::string encoded;
+    meta.Encode(&encoded);
+    PutLengthPrefixedSlice(dst, encoded);
+  }
+
+  for (const auto& garbage_kvp : vtable_garbage_) {
+    PutVarint32(dst, kVTableGarbage);
+    PutVarint64(dst, garbage_kvp.first);          // file number
+    PutVarint64(dst, garbage_kvp.second.first);   // records
+    PutVarint64(dst, garbage_kvp.second.second);  // bytes
+  }
+
+  for (uint64_t file : dropped_vtables_) {
+    PutVarint32(dst, kDroppedVTable);
+    PutVarint64(dst, file);
+  }
 }
 
 static bool GetInternalKey(Slice* input, InternalKey* dst) {
@@ -115,6 +141,8 @@ Status VersionEdit::DecodeFrom(const Slice& src) {
   FileMetaData f;
   Slice str;
   InternalKey key;
+  VTableMeta vtable_meta;
+  uint64_t records, bytes;
 
   while (msg == nullptr && GetVarint32(&input, &tag)) {
     switch (tag) {
@@ -186,6 +214,32 @@ Status VersionEdit::DecodeFrom(const Slice& src) {
         }
         break;
 
+      case kNewVTable:
+        if (GetLengthPrefixedSlice(&input, &str) &&
+            DecodeSrcIntoObj(str, &vtable_meta).ok()) {
+          new_vtables_.push_back(vtable_meta);
+        } else {
+          msg = "new-vtable entry";
+        }
+        break;
+
+      case kVTableGarbage:
+        if (GetVarint64(&input, &number) && GetVarint64(&input, &records) &&
+            GetVarint64(&input, &bytes)) {
+          AddVTableGarbage(number, records, bytes);
+        } else {
+          msg = "vtable garbage";
+        }
+        break;
+
+      case kDroppedVTable:
+        if (GetVarint64(&input, &number)) {
+          dropped_vtables_.insert(number);
+        } else {
+          msg = "dropped vtable";
+        }
+        break;
+
       default:
         msg = "unknown tag";
         break;
@@ -251,6 +305,26 @@ std::string VersionEdit::DebugString() const {
     r.append(" .. ");
     r.append(f.largest.DebugString());
   }
+  for (const VTableMeta& meta : new_vtables_) {
+    r.append("\n  AddVTable: ");
+    AppendNumberTo(&r, meta.number);
+    r.append(" ");
+    AppendNumberTo(&r, meta.records_num);
+    r.append(" ");
+    AppendNumberTo(&r, meta.table_size);
+  }
+  for (const auto& garbage_kvp : vtable_garbage_) {
+    r.append("\n  VTableGarbage: ");
+    AppendNumberTo(&r, garbage_kvp.first);
+    r.append(" ");
+    AppendNumberTo(&r, garbage_kvp.second.first);
+    r.append(" ");
+    AppendNumberTo(&r, garbage_kvp.second.second);
+  }
+  for (uint64_t file : dropped_vtables_) {
+    r.append("\n  DropVTable: ");
+    AppendNumberTo(&r, file);
+  }
   r.append("\n}\n");
   return r;
 }
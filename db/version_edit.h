@@ -5,11 +5,13 @@
 #ifndef STORAGE_LEVELDB_DB_VERSION_EDIT_H_
 #define STORAGE_LEVELDB_DB_VERSION_EDIT_H_
 
+#include <map>
 #include <set>
 #include <utility>
 #include <vector>
 
 #include "db/dbformat.h"
+#include "table/vtable_manager.h"
 
 namespace leveldb {
 
@@ -75,6 +77,20 @@ class VersionEdit {
     deleted_files_.insert(std::make_pair(level, file));
   }
 
+  // Add the vtable described by "meta".
+  void AddVTable(const VTableMeta& meta) { new_vtables_.push_back(meta); }
+
+  // Record that "records" more records, taking "bytes" bytes, of vtable
+  // "file" are no longer referenced.
+  void AddVTableGarbage(uint64_t file, uint64_t records, uint64_t bytes) {
+    std::pair<uint64_t, uint64_t>& garbage = vtable_garbage_[file];
+    garbage.first += records;
+    garbage.second += bytes;
+  }
+
+  // Record that no record of vtable "file" is referenced any longer.
+  void DropVTable(uint64_t file) { dropped_vtables_.insert(file); }
+
   void EncodeTo(std::string* dst) const;
   Status DecodeFrom(const Slice& src);
 
@@ -99,6 +115,10 @@ class VersionEdit {
   std::vector<std::pair<int, InternalKey>> compact_pointers_;
   DeletedFileSet deleted_files_;
   std::vector<std::pair<int, FileMetaData>> new_files_;
+  std::vector<VTableMeta> new_vtables_;
+  // file number -> (records, bytes) that became garbage
+  std::map<uint64_t, std::pair<uint64_t, uint64_t>> vtable_garbage_;
+  std::set<uint64_t> dropped_vtables_;
 };
 
 }  // namespace leveldb
@@ -29,6 +29,13 @@ TEST(VersionEditTest, EncodeDecode) {
                  InternalKey("zoo", kBig + 600 + i, kTypeDeletion));
     edit.RemoveFile(4, kBig + 700 + i);
     edit.SetCompactPointer(i, InternalKey("x", kBig + 900 + i, kTypeValue));
+    VTableMeta meta;
+    meta.number = kBig + 300 + i;
+    meta.records_num = 1000 + i;
+    meta.table_size = kBig + 800 + i;
+    edit.AddVTable(meta);
+    edit.AddVTableGarbage(kBig + 300 + i, 10 + i, 4096 + i);
+    edit.DropVTable(kBig + 700 + i);
   }
 
   edit.SetComparatorName("foo");
@@ -159,12 +159,18 @@ bool SomeFileOverlapsRange(const InternalKeyComparator& icmp,
 // information about the files in the level.  For a given entry, key()
 // is the largest key that occurs in the file, and value() is an
 // 16-byte value containing the file number and file size, both
-// encoded using EncodeFixed64.
+// encoded using EncodeFixed64.  If "may_skip" is given, value() has
+// a 17th byte, 1 if the file's zone map may skip entries (see
+// GetFileIterator).
 class Version::LevelFileNumIterator : public Iterator {
  public:
   LevelFileNumIterator(const InternalKeyComparator& icmp,
-                       const std::vector<FileMetaData*>* flist)
-      : icmp_(icmp), flist_(flist), index_(flist->size()) {  // Marks as invalid
+                       const std::vector<FileMetaData*>* flist,
+                       std::vector<bool> may_skip = std::vector<bool>())
+      : icmp_(icmp),
+        flist_(flist),
+        may_skip_(std::move(may_skip)),
+        index_(flist->size()) {  // Marks as invalid
   }
   bool Valid() const override { return index_ < flist_->size(); }
   void Seek(const Slice& target) override {
@@ -194,6 +200,10 @@ class Version::LevelFileNumIterator : public Iterator {
     assert(Valid());
     EncodeFixed64(value_buf_, (*flist_)[index_]->number);
     EncodeFixed64(value_buf_ + 8, (*flist_)[index_]->file_size);
+    if (may_skip_.empty()) {
+      return Slice(value_buf_, 16);
+    }
+    value_buf_[16] = may_skip_[index_] ? 1 : 0;
     return Slice(value_buf_, sizeof(value_buf_));
   }
   Fields fields() const override { assert(false); }
@@ -202,18 +212,28 @@ class Version::LevelFileNumIterator : public Iterator {
  private:
   const InternalKeyComparator icmp_;
   const std::vector<FileMetaData*>* const flist_;
+  const std::vector<bool> may_skip_;
   uint32_t index_;
 
   // Backing store for value().  Holds the file number and size.
-  mutable char value_buf_[16];
+  mutable char value_buf_[17];
 };
 
+// A table iterator given a predicate leaves out the entries its zone map
+// shows cannot match.  That is only safe if they hide no older entry of
+// the same key, so the predicate is kept only for the files marked so.
 static Iterator* GetFileIterator(void* arg, const ReadOptions& options,
                                  const Slice& file_value) {
   TableCache* cache = reinterpret_cast<TableCache*>(arg);
-  if (file_value.size() != 16) {
+  if (file_value.size() != 16 && file_value.size() != 17) {
     return NewErrorIterator(
         Status::Corruption("FileReader invoked with unexpected value"));
+  } else if (options.predicate != nullptr &&
+             (file_value.size() != 17 || file_value[16] != 1)) {
+    ReadOptions file_options = options;
+    file_options.predicate = nullptr;
+    return cache->NewIterator(file_options, DecodeFixed64(file_value.data()),
+                              DecodeFixed64(file_value.data() + 8));
   } else {
     return cache->NewIterator(options, DecodeFixed64(file_value.data()),
                               DecodeFixed64(file_value.data() + 8));
@@ -222,17 +242,45 @@ static Iterator* GetFileIterator(void* arg, const ReadOptions& options,
 
 Iterator* Version::NewConcatenatingIterator(const ReadOptions& options,
                                             int level) const {
+  std::vector<bool> may_skip;
+  if (options.predicate != nullptr) {
+    // A file may skip entries unless a deeper level holds older entries
+    // of its keys, or the next file continues its last key.
+    const Comparator* ucmp = vset_->icmp_.user_comparator();
+    const std::vector<FileMetaData*>& files = files_[level];
+    may_skip.resize(files.size());
+    for (size_t i = 0; i < files.size(); i++) {
+      Slice smallest = files[i]->smallest.user_key();
+      Slice largest = files[i]->largest.user_key();
+      bool skip = true;
+      if (i + 1 < files.size() &&
+          ucmp->Compare(files[i + 1]->smallest.user_key(), largest) == 0) {
+        skip = false;
+      }
+      for (int l = level + 1; skip && l < config::kNumLevels; l++) {
+        if (SomeFileOverlapsRange(vset_->icmp_, true, files_[l], &smallest,
+                                  &largest)) {
+          skip = false;
+        }
+      }
+      may_skip[i] = skip;
+    }
+  }
   return NewTwoLevelIterator(
-      new LevelFileNumIterator(vset_->icmp_, &files_[level]), &GetFileIterator,
-      vset_->table_cache_, options);
+      new LevelFileNumIterator(vset_->icmp_, &files_[level],
+                               std::move(may_skip)),
+      &GetFileIterator, vset_->table_cache_, options);
 }
 
 void Version::AddIterators(const ReadOptions& options,
                            std::vector<Iterator*>* iters) {
-  // Merge all level zero files together since they may overlap
+  // Merge all level zero files together since they may overlap.  Their
+  // zone maps can skip nothing, as older files may hide behind them.
+  ReadOptions level0_options = options;
+  level0_options.predicate = nullptr;
   for (size_t i = 0; i < files_[0].size(); i++) {
     iters->push_back(vset_->table_cache_->NewIterator(
-        options, files_[0][i]->number, files_[0][i]->file_size));
+        level0_options, files_[0][i]->number, files_[0][i]->file_size));
   }
 
   // For levels > 0, we can use a concatenating iterator that sequentially
@@ -538,6 +586,34 @@ void Version::GetOverlappingInputs(int level, const InternalKey* begin,
   }
 }
 
+void Version::GetSplitKeys(int n, std::vector<std::string>* split_keys) const {
+  int level = 0;
+  int64_t total = 0;
+  for (int l = 1; l < config::kNumLevels; l++) {
+    const int64_t bytes = TotalFileSize(files_[l]);
+    if (bytes > total) {
+      level = l;
+      total = bytes;
+    }
+  }
+  if (level == 0 || n <= 1) {
+    return;
+  }
+  // Cut after the file that reaches the next n-th of the bytes
+  const std::vector<FileMetaData*>& files = files_[level];
+  int64_t sum = 0;
+  int pieces = 1;
+  for (size_t i = 0; i + 1 < files.size() && pieces < n; i++) {
+    sum += files[i]->file_size;
+    const Slice key = files[i]->largest.user_key();
+    if (sum * n >= total * pieces &&
+        (split_keys->empty() || split_keys->back() != key)) {
+      split_keys->push_back(key.ToString());
+      pieces++;
+    }
+  }
+}
+
 std::string Version::DebugString() const {
   std::string r;
   for (int level = 0; level < config::kNumLevels; level++) {
@@ -741,13 +817,15 @@ VersionSet::VersionSet(const std::string& dbname, const Options* options,
       icmp_(*cmp),
       next_file_number_(2),
       manifest_file_number_(0),  // Filled by Recover()
+      manifest_size_(0),
       last_sequence_(0),
       log_number_(0),
       prev_log_number_(0),
       descriptor_file_(nullptr),
       descriptor_log_(nullptr),
       dummy_versions_(this),
-      current_(nullptr) {
+      current_(nullptr),
+      vtable_manager_(nullptr) {
   AppendVersion(new Version(this));
 }
 
@@ -810,18 +888,49 @@ Status VersionSet::LogAndApply(VersionEdit* edit, port::Mutex* mu) {
     s = env_->NewWritableFile(new_manifest_file, &descriptor_file_);
     if (s.ok()) {
       descriptor_log_ = new log::Writer(descriptor_file_);
+      manifest_size_ = 0;
       s = WriteSnapshot(descriptor_log_);
     }
   }
 
+  // Once the descriptor log has grown past max_manifest_file_size,
+  // continue in a new one that starts with a snapshot, so that recovery
+  // replays a bounded number of edits.  The old log stays current until
+  // the new one is complete.
+  const uint64_t old_manifest_file_number = manifest_file_number_;
+  WritableFile* old_descriptor_file = nullptr;
+  log::Writer* old_descriptor_log = nullptr;
+  std::string snapshot;
+  if (s.ok() && new_manifest_file.empty() &&
+      manifest_size_ >= options_->max_manifest_file_size) {
+    old_descriptor_file = descriptor_file_;
+    old_descriptor_log = descriptor_log_;
+    descriptor_file_ = nullptr;
+    descriptor_log_ = nullptr;
+    manifest_file_number_ = NewFileNumber();
+    edit->SetNextFile(next_file_number_);
+    new_manifest_file = DescriptorFileName(dbname_, manifest_file_number_);
+    EncodeSnapshot(&snapshot);
+  }
+
   // Unlock during expensive MANIFEST log write
   {
     mu->Unlock();
 
+    if (!snapshot.empty()) {
+      s = env_->NewWritableFile(new_manifest_file, &descriptor_file_);
+      if (s.ok()) {
+        descriptor_log_ = new log::Writer(descriptor_file_);
+        manifest_size_ = snapshot.size();
+        s = descriptor_log_->AddRecord(snapshot);
+      }
+    }
+
     // Write new record to MANIFEST log
     if (s.ok()) {
       std::string record;
       edit->EncodeTo(&record);
+      manifest_size_ += record.size();
       s = descriptor_log_->AddRecord(record);
       if (s.ok()) {
         s = descriptor_file_->Sync();
@@ -845,13 +954,17 @@ Status VersionSet::LogAndApply(VersionEdit* edit, port::Mutex* mu) {
     AppendVersion(v);
     log_number_ = edit->log_number_;
     prev_log_number_ = edit->prev_log_number_;
+    ApplyVTableEdit(*edit);
+    delete old_descriptor_log;
+    delete old_descriptor_file;
   } else {
     delete v;
     if (!new_manifest_file.empty()) {
       delete descriptor_log_;
       delete descriptor_file_;
-      descriptor_log_ = nullptr;
-      descriptor_file_ = nullptr;
+      descriptor_log_ = old_descriptor_log;
+      descriptor_file_ = old_descriptor_file;
+      manifest_file_number_ = old_manifest_file_number;
       env_->RemoveFile(new_manifest_file);
     }
   }
@@ -922,6 +1035,7 @@ Status VersionSet::Recover(bool* save_manifest) {
 
       if (s.ok()) {
         builder.Apply(&edit);
+        ApplyVTableEdit(edit);
       }
 
       if (edit.has_log_number_) {
@@ -1020,6 +1134,7 @@ bool VersionSet::ReuseManifest(const std::string& dscname,
   Log(options_->info_log, "Reusing MANIFEST %s\n", dscname.c_str());
   descriptor_log_ = new log::Writer(descriptor_file_, manifest_size);
   manifest_file_number_ = manifest_number;
+  manifest_size_ = manifest_size;
   return true;
 }
 
@@ -1068,6 +1183,13 @@ void VersionSet::Finalize(Version* v) {
 }
 
 Status VersionSet::WriteSnapshot(log::Writer* log) {
+  std::string record;
+  EncodeSnapshot(&record);
+  manifest_size_ += record.size();
+  return log->AddRecord(record);
+}
+
+void VersionSet::EncodeSnapshot(std::string* record) {
   // TODO: Break up into multiple records to reduce memory usage on recovery?
 
   // Save metadata
@@ -1092,9 +1214,33 @@ Status VersionSet::WriteSnapshot(log::Writer* log) {
     }
   }
 
-  std::string record;
-  edit.EncodeTo(&record);
-  return log->AddRecord(record);
+  // Save vtables
+  if (vtable_manager_ != nullptr) {
+    std::vector<VTableMeta> metas;
+    vtable_manager_->GetVTableMetas(&metas);
+    for (const VTableMeta& meta : metas) {
+      edit.AddVTable(meta);
+    }
+  }
+
+  edit.EncodeTo(record);
+}
+
+void VersionSet::ApplyVTableEdit(const VersionEdit& edit) {
+  if (vtable_manager_ == nullptr) {
+    return;
+  }
+  for (const VTableMeta& meta : edit.new_vtables_) {
+    vtable_manager_->AddVTable(meta);
+  }
+  for (const auto& garbage_kvp : edit.vtable_garbage_) {
+    // The vtable may have been deleted already
+    vtable_manager_->AddInvalid(garbage_kvp.first, garbage_kvp.second.second,
+                                garbage_kvp.second.first);
+  }
+  for (uint64_t file : edit.dropped_vtables_) {
+    vtable_manager_->RemoveVTable(file);
+  }
 }
 
 int VersionSet::NumLevelFiles(int level) const {
@@ -111,6 +111,11 @@ class Version {
 
   int NumFiles(int level) const { return files_[level].size(); }
 
+  // Append to *split_keys at most n-1 sorted user keys that cut the key
+  // space into ranges holding about as many bytes of the largest sorted
+  // level each.  Appends nothing if only level-0 holds files.
+  void GetSplitKeys(int n, std::vector<std::string>* split_keys) const;
+
   // Return a human readable string that describes this version's contents.
   std::string DebugString() const;
 
@@ -184,6 +189,13 @@ class VersionSet {
   // Recover the last saved descriptor from persistent storage.
   Status Recover(bool* save_manifest);
 
+  // Keep "vtable_manager" in sync with the vtable records of the edits
+  // applied or recovered from now on, and save its vtables with every
+  // new descriptor.
+  void SetVTableManager(VTableManager* vtable_manager) {
+    vtable_manager_ = vtable_manager;
+  }
+
   // Return the current version.
   Version* current() const { return current_; }
 
@@ -291,6 +303,12 @@ class VersionSet {
   // Save current contents to *log
   Status WriteSnapshot(log::Writer* log);
 
+  // Encode the current contents as a single edit into *record
+  void EncodeSnapshot(std::string* record);
+
+  // Apply the vtable records of "edit" to vtable_manager_
+  void ApplyVTableEdit(const VersionEdit& edit);
+
   void AppendVersion(Version* v);
 
   Env* const env_;
@@ -300,6 +318,7 @@ class VersionSet {
   const InternalKeyComparator icmp_;
   uint64_t next_file_number_;
   uint64_t manifest_file_number_;
+  uint64_t manifest_size_;  // Bytes of edits in the current MANIFEST
   uint64_t last_sequence_;
   uint64_t log_number_;
   uint64_t prev_log_number_;  // 0 or backing store for memtable being compacted
@@ -309,6 +328,7 @@ class VersionSet {
   log::Writer* descriptor_log_;
   Version dummy_versions_;  // Head of circular doubly-linked list of versions.
   Version* current_;        // == dummy_versions_.prev_
+  VTableManager* vtable_manager_;
 
   // Per-level key at which the next compaction at that level should start.
   // Either an empty string, or a valid InternalKey.
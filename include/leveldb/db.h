@@ -8,10 +8,12 @@
 #include "db/fields.h"
 #include <cstdint>
 #include <cstdio>
+#include <functional>
 
 #include "leveldb/export.h"
 #include "leveldb/iterator.h"
 #include "leveldb/options.h"
+#include "leveldb/pinnable_slice.h"
 
 namespace leveldb {
 
@@ -95,8 +97,53 @@ class LEVELDB_EXPORT DB {
   virtual Status Get(const ReadOptions& options, const Slice& key,
                      std::string *value) = 0;
 
-  // Search keys from value
-  virtual std::vector<std::string> FindKeysByField(Field &field) = 0;
+  // Same as Get(..., Fields*) with options.fields set to "field_names":
+  // *fields holds only those of the named fields that exist, and fields
+  // stored apart from the others are read only if one of them is named.
+  virtual Status Get(const ReadOptions& options, const Slice& key,
+                     const std::vector<std::string>& field_names,
+                     Fields* fields) = 0;
+
+  // Same as Get(..., Fields*), but *fields views the encoded Fields in
+  // place instead of decoding them into a map.  The encoding is kept in
+  // fields->pinnable().  On error *fields is left empty.
+  virtual Status Get(const ReadOptions& options, const Slice& key,
+                     FieldsView* fields) = 0;
+
+  // Same as above, but *value is not copied out of the database when it
+  // can be pinned instead: it points into memory kept alive by *value
+  // until it is reset or destroyed.
+  virtual Status Get(const ReadOptions& options, const Slice& key,
+                     PinnableSlice* value) = 0;
+
+  // Look up every key in "keys" as of a single snapshot.  The i-th
+  // returned status and (*values)[i] are what Get would have produced
+  // for keys[i].  Values stored apart from their keys are read in as few
+  // VTable reads as possible.
+  virtual std::vector<Status> MultiGet(const ReadOptions& options,
+                                       const std::vector<Slice>& keys,
+                                       std::vector<std::string>* values) = 0;
+
+  virtual std::vector<Status> MultiGet(const ReadOptions& options,
+                                       const std::vector<Slice>& keys,
+                                       std::vector<Fields>* fields) = 0;
+
+  // Search keys from value.  Seeks the secondary index of field.first if
+  // it is in Options::indexed_fields, scans the whole database otherwise.
+  // If "status" is not null it is set to the status of the search, which
+  // stops at the first error with the keys found so far.
+  virtual std::vector<std::string> FindKeysByField(
+      Field &field, Status* status = nullptr) = 0;
+
+  // Same as above, but "callback" is called with every key found instead
+  // of collecting them, and the search stops once it returns false.  A
+  // scan is split among options.scan_threads threads, each over its own
+  // key range of one snapshot: keys then come in no particular order,
+  // but "callback" is called by one thread at a time.  The calling thread
+  // is one of them, the others come from a pool shared by all searches.
+  virtual Status FindKeysByField(
+      const ReadOptions& options, const Field& field,
+      const std::function<bool(const Slice& key)>& callback) = 0;
 
   // Return a heap-allocated iterator over the contents of the database.
   // The result of NewIterator() is initially invalid (caller must
@@ -132,6 +179,13 @@ class LEVELDB_EXPORT DB {
   //     of the sstables that make up the db contents.
   //  "leveldb.approximate-memory-usage" - returns the approximate number of
   //     bytes of memory in use by the DB.
+  //  "leveldb.vtable-stats" - returns a multi-line string that sums up the
+  //     live and garbage bytes of the vtables, with a histogram of the
+  //     vtables by the fraction of their bytes that is live.
+  //  "leveldb.vtables" - returns a multi-line string that describes the
+  //     records and live bytes of every vtable.
+  //  "leveldb.vtable-live-bytes" / "leveldb.vtable-garbage-bytes" - return
+  //     the number of vtable bytes still referenced / no longer referenced.
   virtual bool GetProperty(const Slice& property, std::string* value) = 0;
 
   // For each i in [0,n-1], store in "sizes[i]", the approximate
@@ -85,6 +85,16 @@ class LEVELDB_EXPORT Env {
   virtual Status NewRandomAccessFile(const std::string& fname,
                                      RandomAccessFile** result) = 0;
 
+  // Like NewRandomAccessFile, but reads the file through a read-only
+  // memory mapping of its current contents.  The file must not be
+  // modified while the returned object is alive.  Unlike
+  // NewRandomAccessFile, this does not draw on the Env's own mmap budget;
+  // callers are expected to limit how many files they map.
+  //
+  // The default implementation falls back to NewRandomAccessFile.
+  virtual Status NewMmapReadableFile(const std::string& fname,
+                                     RandomAccessFile** result);
+
   // Create an object that writes to a new file with the specified
   // name.  Deletes any existing file with the same name and creates a
   // new file.  On success, stores a pointer to the new file in
@@ -269,6 +279,15 @@ class LEVELDB_EXPORT RandomAccessFile {
   // Safe for concurrent use by multiple threads.
   virtual Status Read(uint64_t offset, size_t n, Slice* result,
                       char* scratch) const = 0;
+
+  // How the caller expects to read the file, see Hint().
+  enum AccessPattern { kNormal, kRandom, kSequential };
+
+  // Advise the implementation of the access pattern to expect, e.g. to
+  // tune or disable readahead.  This is only a hint.
+  //
+  // The default implementation does nothing.
+  virtual void Hint(AccessPattern pattern);
 };
 
 // A file abstraction for sequential writing.  The implementation
@@ -349,6 +368,10 @@ class LEVELDB_EXPORT EnvWrapper : public Env {
                              RandomAccessFile** r) override {
     return target_->NewRandomAccessFile(f, r);
   }
+  Status NewMmapReadableFile(const std::string& f,
+                             RandomAccessFile** r) override {
+    return target_->NewMmapReadableFile(f, r);
+  }
   Status NewWritableFile(const std::string& f, WritableFile** r) override {
     return target_->NewWritableFile(f, r);
   }
@@ -0,0 +1,62 @@
+// A FieldPredicate is a condition on one field of a value: it equals a
+// given string, starts with one, or lies in a range of them.  Set as
+// ReadOptions::predicate, it is evaluated by iterators on the encoded
+// Fields as they are found, and only the entries satisfying it are
+// yielded.  Inline values are tested where they lie without being copied
+// or decoded.
+
+#ifndef STORAGE_LEVELDB_INCLUDE_FIELD_PREDICATE_H_
+#define STORAGE_LEVELDB_INCLUDE_FIELD_PREDICATE_H_
+
+#include <string>
+
+#include "leveldb/export.h"
+#include "leveldb/slice.h"
+
+namespace leveldb {
+
+class LEVELDB_EXPORT FieldPredicate {
+ public:
+  // Field "field_name" equals "value".
+  static FieldPredicate Equal(const Slice& field_name, const Slice& value);
+
+  // Field "field_name" starts with "prefix".
+  static FieldPredicate Prefix(const Slice& field_name, const Slice& prefix);
+
+  // Field "field_name" is in ["lower", "upper") in bytewise order.  An
+  // empty "upper" sets no upper bound.
+  static FieldPredicate Range(const Slice& field_name, const Slice& lower,
+                              const Slice& upper);
+
+  const std::string& field_name() const { return field_name_; }
+
+  // Return true iff "field_value", the value of the field, satisfies
+  // the predicate.
+  bool Matches(const Slice& field_value) const;
+
+  // Return true iff "fields_str", encoded Fields, holds the field and
+  // its value satisfies the predicate.
+  bool MatchesFields(const Slice& fields_str) const;
+
+  // Return false only if no value in ["smallest", "largest"] satisfies the
+  // predicate.
+  bool MayMatch(const Slice& smallest, const Slice& largest) const;
+
+ private:
+  enum Type { kEqual, kPrefix, kRange };
+
+  FieldPredicate(Type type, const Slice& field_name, const Slice& operand,
+                 const Slice& upper);
+
+  Type type_;
+  std::string field_name_;
+  std::string operand_;  // Value, prefix or lower bound
+  std::string upper_;
+  // Bytes any encoding of a matching field contains: the encoded name,
+  // followed by the value or prefix to compare with if any
+  std::string needle_;
+};
+
+}  // namespace leveldb
+
+#endif  // STORAGE_LEVELDB_INCLUDE_FIELD_PREDICATE_H_
@@ -73,6 +73,28 @@ class LEVELDB_EXPORT Iterator {
 
   virtual Fields fields() const = 0;
 
+  // Point *view at the encoded Fields of the current entry without
+  // building a Fields map, reading the value into view->pinnable() if it
+  // is stored apart.  The view stays valid until it is reset or the
+  // iterator is modified, whichever comes first.  Iterators that do not
+  // hold Fields return a non-ok status.
+  // REQUIRES: Valid()
+  virtual Status fields_view(FieldsView* view) const;
+
+  // Return the size of the current entry's value without reading it if
+  // it is stored apart from its key.  For a value compressed in its
+  // VTable (see Options::vtable_compression) that is the compressed size.
+  // REQUIRES: Valid()
+  virtual uint64_t value_size() const;
+
+  // If the current entry's value, or some of its fields, is stored apart
+  // from its key, set *file_number, *offset and *size to where it (or
+  // they) live and return true.
+  // Otherwise return false.  Never reads the value.
+  // REQUIRES: Valid()
+  virtual bool value_handle(uint64_t* file_number, uint64_t* offset,
+                            uint64_t* size) const;
+
   // If an error has occurred, return it.  Else return an ok status.
   virtual Status status() const = 0;
 
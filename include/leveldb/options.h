@@ -6,6 +6,8 @@
 #define STORAGE_LEVELDB_INCLUDE_OPTIONS_H_
 
 #include <cstddef>
+#include <string>
+#include <vector>
 
 #include "leveldb/export.h"
 
@@ -14,8 +16,10 @@ namespace leveldb {
 class Cache;
 class Comparator;
 class Env;
+class FieldPredicate;
 class FilterPolicy;
 class Logger;
+class SeparationPolicy;
 class Snapshot;
 
 // DB contents are stored in a set of blocks, each of which holds a
@@ -84,7 +88,10 @@ struct LEVELDB_EXPORT Options {
 
   // Number of open files that can be used by the DB.  You may need to
   // increase this if your database has a large working set (budget
-  // one open file per 2MB of working set).
+  // one open file per 2MB of working set).  Besides ten files kept for
+  // other uses, half of them hold tables open and half hold VTables
+  // open, so a DB keeps about half as many tables open as it would
+  // without VTables.
   int max_open_files = 1000;
 
   // Control over blocks (user data is stored in a set of blocks, and
@@ -94,6 +101,12 @@ struct LEVELDB_EXPORT Options {
   // If null, leveldb will automatically create and use an 8MB internal cache.
   Cache* block_cache = nullptr;
 
+  // If non-null, use the specified cache for values stored in VTables,
+  // charged by their size.  Repeat reads of a hot separated value are
+  // then served from memory instead of from its VTable.
+  // If null, separated values are not cached.
+  Cache* blob_cache = nullptr;
+
   // Approximate size of user data packed per block.  Note that the
   // block size specified here corresponds to uncompressed data.  The
   // actual size of the unit read from disk may be smaller if
@@ -103,6 +116,43 @@ struct LEVELDB_EXPORT Options {
   // Threshold of value size that decide whether to separate the key and value
   size_t kv_sep_size = 1000;
 
+  // If non-null, decides which values are separated from their keys
+  // instead of kv_sep_size, e.g. by key prefix or by field.  See
+  // separation_policy.h.
+  const SeparationPolicy* separation_policy = nullptr;
+
+  // If true, the values picked by separation_policy (or kv_sep_size) are
+  // separated as they are written instead of when their memtable is
+  // flushed: DB::Write appends them to a value log, a VTable paired with
+  // the current log file, and logs and inserts only their VTableIndex.
+  // Each large value is then written once, and a memtable holds many
+  // more of them.  The value log becomes a regular VTable once its
+  // memtable is flushed.
+  // Incompatible with reuse_logs, which is ignored when set.
+  //
+  // Default: false
+  bool kv_sep_on_write = false;
+
+  // Fields with a secondary index.  Every write also updates, in the
+  // same log record, an index entry per indexed field it sets or
+  // changes, and FindKeysByField on an indexed field seeks its entries
+  // instead of scanning the whole database.  Each write then reads the
+  // previous value of its keys.  An index added here is built when the
+  // database is opened, one removed is dropped.
+  // Keys starting with "\xff\xffidx" are reserved for the index entries,
+  // which iterators skip.  Requires the default comparator.
+  //
+  // Default: empty, no field is indexed.
+  std::vector<std::string> indexed_fields;
+
+  // Maximum number of sealed VTable files the DB keeps memory-mapped.
+  // Reads from a mapped VTable skip the read syscall and the copy into a
+  // caller buffer.  This budget is separate from the one the Env applies
+  // to table files.  Files beyond the budget are read with pread.
+  //
+  // Default: 0, which never maps VTable files.
+  int max_vtable_mmaps = 0;
+
   // Number of keys between restart points for delta encoding of keys.
   // This parameter can be changed dynamically.  Most clients should
   // leave this parameter alone.
@@ -120,6 +170,23 @@ struct LEVELDB_EXPORT Options {
 
   size_t gc_size_threshold =  1024 * 1024 * 1024;
 
+  // Once the MANIFEST, which also logs every VTable change, grows past
+  // this many bytes, it is checkpointed: a new MANIFEST starts with a
+  // snapshot of the current state, and the old one is deleted.  This
+  // bounds both its size and the number of edits replayed on open.
+  size_t max_manifest_file_size = 64 * 1024 * 1024;
+
+  // A VTable whose invalid records take at least this fraction of its
+  // bytes is rewritten in the background: its live records are copied
+  // into a new VTable, their keys are repointed there, and the old file
+  // is dropped once no snapshot or iterator can see it any longer.
+  // Values of 1 or more only drop VTables that are entirely invalid.
+  double gc_garbage_ratio = 0.5;
+
+  // Upper bound on the VTable bytes one background rewrite reads.  The
+  // VTable with the most garbage is rewritten even if it is larger.
+  size_t gc_max_bytes_per_run = 64 * 1024 * 1024;
+
   // Compress blocks using the specified compression algorithm.  This
   // parameter can be changed dynamically.
   //
@@ -140,12 +207,44 @@ struct LEVELDB_EXPORT Options {
   // Currently only the range [-5,22] is supported. Default is 1.
   int zstd_compression_level = 1;
 
+  // Compress every value stored in a VTable on its own with the specified
+  // algorithm, so it can still be read without its neighbours.  Values
+  // that shrink by less than 12.5% are stored uncompressed.  Once set,
+  // Iterator::value_size() reports the compressed size of separated
+  // values.  This parameter can be changed dynamically, a VTable may mix
+  // records of every type.
+  //
+  // Default: kNoCompression
+  CompressionType vtable_compression = kNoCompression;
+
+  // If positive and vtable_compression is kZstdCompression, every VTable
+  // trains a zstd dictionary of at most this many bytes on its first
+  // vtable_zstd_dict_samples values, keeps it in its footer and
+  // compresses the later values with it.  Pays off for many small values
+  // sharing structure, which compress poorly one by one.
+  //
+  // Default: 0, which trains no dictionary
+  size_t vtable_zstd_dict_size = 0;
+
+  // Number of values a VTable samples to train its zstd dictionary.
+  int vtable_zstd_dict_samples = 100;
+
   // EXPERIMENTAL: If true, append to existing MANIFEST and log files
   // when a database is opened.  This can significantly speed up open.
   //
   // Default: currently false, but may become true later.
   bool reuse_logs = false;
 
+  // Fields whose smallest and largest values every table records, per
+  // data block and for the whole table, in a zone map next to its filter
+  // block.  An iterator with a ReadOptions::predicate on one of them
+  // then passes over the tables and blocks that hold no match, unless
+  // they may hide older entries of the same keys, e.g. in level-0.
+  // Values stored apart from their keys widen the bounds to anything.
+  //
+  // Default: empty, no zone maps.
+  std::vector<std::string> zone_map_fields;
+
   // If non-null, use the specified filter policy to reduce disk reads.
   // Many applications will benefit from passing the result of
   // NewBloomFilterPolicy() here.
@@ -167,6 +266,44 @@ struct LEVELDB_EXPORT ReadOptions {
   // not have been released).  If "snapshot" is null, use an implicit
   // snapshot of the state at the beginning of this read operation.
   const Snapshot* snapshot = nullptr;
+
+  // If positive, an iterator moving forward looks this many entries
+  // ahead and resolves their separated values together, merging reads
+  // that are close in the same VTable.  Speeds up scans that read the
+  // values of most entries at the cost of buffering that many values.
+  //
+  // Default: 0, which resolves values one at a time when asked for.
+  int prefetch_values = 0;
+
+  // If true, iterators never read values stored apart from their keys
+  // but to test predicate: fields() returns empty Fields, while
+  // value_size() and value_handle() stay available.  Overrides
+  // prefetch_values.
+  bool keys_only = false;
+
+  // If non-null, reads only need these fields: Get(..., Fields*) and
+  // Iterator::fields() return only those of them that exist, and fields
+  // separated on their own (see SeparationPolicy::ShouldSeparateField)
+  // are read only if one of them is asked for.  Iterator::fields_view()
+  // may see more fields than asked for.  Must outlive the read or
+  // iterator.
+  //
+  // Default: nullptr, which reads every field.
+  const std::vector<std::string>* fields = nullptr;
+
+  // If non-null, iterators skip the entries whose value does not satisfy
+  // it (see field_predicate.h), so only matches are yielded.  Inline
+  // values are tested in place, values stored apart are read to be
+  // tested.  Other reads ignore it.  Must outlive the iterator.
+  //
+  // Default: nullptr, which yields every entry.
+  const FieldPredicate* predicate = nullptr;
+
+  // Number of threads DB::FindKeysByField splits a scan of the database
+  // among, each over a key range holding about the same amount of data.
+  // Besides the calling thread, a DB runs at most 8 of them at a time;
+  // ranges left waiting are scanned by the calling thread.
+  int scan_threads = 1;
 };
 
 // Options that control write operations
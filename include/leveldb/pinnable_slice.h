@@ -0,0 +1,89 @@
+// PinnableSlice is a Slice that may keep the memory it refers to alive.
+// Reads that can hand out a pointer into memory owned by the database
+// (e.g. a memory-mapped VTable) pin that memory instead of copying out of
+// it; other reads fill the slice's own buffer.  Either way the data stays
+// valid until Reset() is called or the PinnableSlice is destroyed.
+//
+// Multiple threads can invoke const methods on a PinnableSlice without
+// external synchronization, but if any of the threads may call a
+// non-const method, all threads accessing the same PinnableSlice must use
+// external synchronization.
+
+#ifndef STORAGE_LEVELDB_INCLUDE_PINNABLE_SLICE_H_
+#define STORAGE_LEVELDB_INCLUDE_PINNABLE_SLICE_H_
+
+#include <cassert>
+#include <string>
+
+#include "leveldb/export.h"
+#include "leveldb/slice.h"
+
+namespace leveldb {
+
+class LEVELDB_EXPORT PinnableSlice : public Slice {
+ public:
+  using CleanupFunction = void (*)(void* arg1, void* arg2);
+
+  PinnableSlice() : cleanup_(nullptr), arg1_(nullptr), arg2_(nullptr) {}
+
+  PinnableSlice(const PinnableSlice&) = delete;
+  PinnableSlice& operator=(const PinnableSlice&) = delete;
+
+  ~PinnableSlice() { Reset(); }
+
+  // Refer to "s", whose storage stays valid until (*function)(arg1, arg2)
+  // is invoked by Reset() or the destructor.  "function" may be null if
+  // the storage of "s" outlives this object anyway.
+  void PinSlice(const Slice& s, CleanupFunction function, void* arg1,
+                void* arg2) {
+    assert(cleanup_ == nullptr);
+    Slice::operator=(s);
+    cleanup_ = function;
+    arg1_ = arg1;
+    arg2_ = arg2;
+  }
+
+  // Refer to "s", which must lie within the buffer returned by GetSelf().
+  void PinSelf(const Slice& s) {
+    assert(cleanup_ == nullptr);
+    assert(s.data() >= self_.data() &&
+           s.data() + s.size() <= self_.data() + self_.size());
+    Slice::operator=(s);
+  }
+
+  // Refer to the whole buffer returned by GetSelf().
+  void PinSelf() { PinSelf(Slice(self_)); }
+
+  // Drop the last "n" bytes from the referenced data.
+  void remove_suffix(size_t n) {
+    assert(n <= size());
+    Slice::operator=(Slice(data(), size() - n));
+  }
+
+  // Return the buffer owned by this object.  Its contents may be
+  // overwritten by the next read into this PinnableSlice.
+  std::string* GetSelf() { return &self_; }
+
+  // Return true iff the referenced data is kept alive by a cleanup
+  // function rather than by this object's own buffer.
+  bool IsPinned() const { return cleanup_ != nullptr; }
+
+  // Release any pinned storage and make this slice empty.
+  void Reset() {
+    if (cleanup_ != nullptr) {
+      (*cleanup_)(arg1_, arg2_);
+      cleanup_ = nullptr;
+    }
+    clear();
+  }
+
+ private:
+  std::string self_;
+  CleanupFunction cleanup_;
+  void* arg1_;
+  void* arg2_;
+};
+
+}  // namespace leveldb
+
+#endif  // STORAGE_LEVELDB_INCLUDE_PINNABLE_SLICE_H_
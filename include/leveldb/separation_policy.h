@@ -0,0 +1,71 @@
+// A database can be configured with a custom SeparationPolicy object.
+// It decides, value by value, which values are stored apart from their
+// keys in a VTable and which stay inline in the table.  Inline values are
+// read together with their key, separated ones are not rewritten by
+// compactions.
+//
+// Without a policy, values of at least Options::kv_sep_size bytes are
+// separated (see NewSizeSeparationPolicy() below).
+
+#ifndef STORAGE_LEVELDB_INCLUDE_SEPARATION_POLICY_H_
+#define STORAGE_LEVELDB_INCLUDE_SEPARATION_POLICY_H_
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+#include "leveldb/export.h"
+
+namespace leveldb {
+
+class Slice;
+
+class LEVELDB_EXPORT SeparationPolicy {
+ public:
+  virtual ~SeparationPolicy();
+
+  // Return the name of this policy.
+  virtual const char* Name() const = 0;
+
+  // "value" is the encoded Fields stored under user key "key".  Return
+  // true to store it in a VTable, false to keep it inline.
+  //
+  // The decision is taken when the value is first written to disk, by a
+  // memtable flush or, with Options::kv_sep_on_write, by DB::Write.
+  // Changing the policy does not move values already written.
+  virtual bool ShouldSeparate(const Slice& key, const Slice& value) const = 0;
+
+  // Consulted for every field of a value ShouldSeparate() keeps inline:
+  // return true to store field "name" with value "value" in a VTable
+  // while the other fields stay inline.  Reads that only touch inline
+  // fields then skip the VTable.  The fields separated from one value
+  // are stored together.
+  //
+  // The default separates no field.
+  virtual bool ShouldSeparateField(const Slice& key, const Slice& name,
+                                   const Slice& value) const;
+};
+
+// Return a new policy that separates values of at least min_size bytes.
+//
+// Callers must delete the result after any database that is using the
+// result has been closed.
+LEVELDB_EXPORT const SeparationPolicy* NewSizeSeparationPolicy(
+    size_t min_size);
+
+// Return a new policy that separates values of at least min_size bytes
+// whose key starts with one of "prefixes".  Values under other keys stay
+// inline whatever their size.
+LEVELDB_EXPORT const SeparationPolicy* NewKeyPrefixSeparationPolicy(
+    const std::vector<std::string>& prefixes, size_t min_size);
+
+// Return a new policy that separates the fields named in "field_names"
+// whose value has at least min_size bytes, e.g. a large attachment, and
+// keeps the other fields inline.  An empty "field_names" separates every
+// field of at least min_size bytes.
+LEVELDB_EXPORT const SeparationPolicy* NewFieldSeparationPolicy(
+    const std::vector<std::string>& field_names, size_t min_size);
+
+}  // namespace leveldb
+
+#endif  // STORAGE_LEVELDB_INCLUDE_SEPARATION_POLICY_H_
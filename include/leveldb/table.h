@@ -48,6 +48,8 @@ class LEVELDB_EXPORT Table {
   // Returns a new iterator over the table contents.
   // The result of NewIterator() is initially invalid (caller must
   // call one of the Seek methods on the iterator before using it).
+  // With ReadOptions::predicate set, the iterator may leave out the
+  // data blocks whose zone map shows they hold no match.
   Iterator* NewIterator(const ReadOptions&) const;
 
   // Given a key, return an approximate byte offset in the file where
@@ -75,6 +77,7 @@ class LEVELDB_EXPORT Table {
 
   void ReadMeta(const Footer& footer);
   void ReadFilter(const Slice& filter_handle_value);
+  void ReadZoneMap(const Slice& zone_map_handle_value);
 
   Rep* const rep_;
 };
@@ -101,6 +101,27 @@ bool Zstd_GetUncompressedLength(const char* input, size_t length,
 // Zstd_GetUncompressedLength.
 bool Zstd_Uncompress(const char* input_data, size_t input_length, char* output);
 
+// Train a zstd dictionary of at most "max_dict_size" bytes on the
+// concatenated "samples", whose lengths are given by "sample_lengths".
+// Returns false if zstd is not supported or training fails.
+bool Zstd_TrainDictionary(const std::string& samples,
+                          const std::vector<size_t>& sample_lengths,
+                          size_t max_dict_size, std::string* dict);
+
+// A zstd dictionary digested once, for the many small inputs compressed
+// with it.  Compress() and Uncompress() follow Zstd_Compress() and
+// Zstd_Uncompress(), and fail if zstd is not supported.
+class ZstdDictionary {
+ public:
+  // Digest "dict" for uncompression only.
+  ZstdDictionary(const char* dict, size_t length);
+  // Digest "dict" for compression at "level" as well.
+  ZstdDictionary(const char* dict, size_t length, int level);
+
+  bool Compress(const char* input, size_t length, std::string* output) const;
+  bool Uncompress(const char* input, size_t length, char* output) const;
+};
+
 // ------------------ Miscellaneous -------------------
 
 // If heap profiling is not supported, returns false.
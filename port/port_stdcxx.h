@@ -30,6 +30,7 @@
 #endif  // HAVE_SNAPPY
 #if HAVE_ZSTD
 #define ZSTD_STATIC_LINKING_ONLY  // For ZSTD_compressionParameters.
+#include <zdict.h>
 #include <zstd.h>
 #endif  // HAVE_ZSTD
 
@@ -39,6 +40,7 @@
 #include <cstdint>
 #include <mutex>  // NOLINT
 #include <string>
+#include <vector>
 
 #include "port/thread_annotations.h"
 
@@ -198,6 +200,152 @@ inline bool Zstd_Uncompress(const char* input, size_t length, char* output) {
 #endif  // HAVE_ZSTD
 }
 
+inline bool Zstd_TrainDictionary(const std::string& samples,
+                                 const std::vector<size_t>& sample_lengths,
+                                 size_t max_dict_size, std::string* dict) {
+#if HAVE_ZSTD
+  dict->resize(max_dict_size);
+  size_t length = ZDICT_trainFromBuffer(
+      &(*dict)[0], max_dict_size, samples.data(), sample_lengths.data(),
+      static_cast<unsigned>(sample_lengths.size()));
+  if (ZDICT_isError(length)) {
+    dict->clear();
+    return false;
+  }
+  dict->resize(length);
+  return true;
+#else
+  // Silence compiler warnings about unused arguments.
+  (void)samples;
+  (void)sample_lengths;
+  (void)max_dict_size;
+  (void)dict;
+  return false;
+#endif  // HAVE_ZSTD
+}
+
+// A zstd dictionary digested once, for the many small inputs compressed
+// with it.  Each thread reuses one compression and one uncompression
+// context across all dictionaries.
+class ZstdDictionary {
+ public:
+  // Digest "dict" for uncompression only.
+  ZstdDictionary(const char* dict, size_t length) {
+#if HAVE_ZSTD
+    ddict_ = ZSTD_createDDict(dict, length);
+#else
+    // Silence compiler warnings about unused arguments.
+    (void)dict;
+    (void)length;
+#endif  // HAVE_ZSTD
+  }
+
+  // Digest "dict" for compression at "level" as well.
+  ZstdDictionary(const char* dict, size_t length, int level)
+      : ZstdDictionary(dict, length) {
+#if HAVE_ZSTD
+    cdict_ = ZSTD_createCDict(dict, length, level);
+#else
+    // Silence compiler warnings about unused arguments.
+    (void)level;
+#endif  // HAVE_ZSTD
+  }
+
+  ZstdDictionary(const ZstdDictionary&) = delete;
+  ZstdDictionary& operator=(const ZstdDictionary&) = delete;
+
+  ~ZstdDictionary() {
+#if HAVE_ZSTD
+    ZSTD_freeCDict(cdict_);
+    ZSTD_freeDDict(ddict_);
+#endif  // HAVE_ZSTD
+  }
+
+  // Same as Zstd_Compress(), with the dictionary.
+  bool Compress(const char* input, size_t length, std::string* output) const {
+#if HAVE_ZSTD
+    if (cdict_ == nullptr) {
+      return false;
+    }
+    size_t outlen = ZSTD_compressBound(length);
+    if (ZSTD_isError(outlen)) {
+      return false;
+    }
+    ZSTD_CCtx* ctx = ThreadCCtx();
+    if (ctx == nullptr) {
+      return false;
+    }
+    output->resize(outlen);
+    outlen = ZSTD_compress_usingCDict(ctx, &(*output)[0], output->size(),
+                                      input, length, cdict_);
+    if (ZSTD_isError(outlen)) {
+      return false;
+    }
+    output->resize(outlen);
+    return true;
+#else
+    // Silence compiler warnings about unused arguments.
+    (void)input;
+    (void)length;
+    (void)output;
+    return false;
+#endif  // HAVE_ZSTD
+  }
+
+  // Same as Zstd_Uncompress(), with the dictionary.
+  bool Uncompress(const char* input, size_t length, char* output) const {
+#if HAVE_ZSTD
+    size_t outlen;
+    if (ddict_ == nullptr ||
+        !Zstd_GetUncompressedLength(input, length, &outlen)) {
+      return false;
+    }
+    ZSTD_DCtx* ctx = ThreadDCtx();
+    if (ctx == nullptr) {
+      return false;
+    }
+    outlen = ZSTD_decompress_usingDDict(ctx, output, outlen, input, length,
+                                        ddict_);
+    if (ZSTD_isError(outlen)) {
+      return false;
+    }
+    return true;
+#else
+    // Silence compiler warnings about unused arguments.
+    (void)input;
+    (void)length;
+    (void)output;
+    return false;
+#endif  // HAVE_ZSTD
+  }
+
+ private:
+#if HAVE_ZSTD
+  // The contexts of the calling thread, freed when it exits.  Creating a
+  // context costs more than compressing a small value with it.
+  static ZSTD_CCtx* ThreadCCtx() {
+    struct Holder {
+      ZSTD_CCtx* const ctx = ZSTD_createCCtx();
+      ~Holder() { ZSTD_freeCCtx(ctx); }
+    };
+    static thread_local Holder holder;
+    return holder.ctx;
+  }
+
+  static ZSTD_DCtx* ThreadDCtx() {
+    struct Holder {
+      ZSTD_DCtx* const ctx = ZSTD_createDCtx();
+      ~Holder() { ZSTD_freeDCtx(ctx); }
+    };
+    static thread_local Holder holder;
+    return holder.ctx;
+  }
+
+  ZSTD_CDict* cdict_ = nullptr;
+  ZSTD_DDict* ddict_ = nullptr;
+#endif  // HAVE_ZSTD
+};
+
 inline bool GetHeapProfile(void (*func)(void*, const char*, int), void* arg) {
   // Silence compiler warnings about unused arguments.
   (void)func;
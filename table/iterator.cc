@@ -38,6 +38,18 @@ void Iterator::RegisterCleanup(CleanupFunction func, void* arg1, void* arg2) {
   node->arg2 = arg2;
 }
 
+uint64_t Iterator::value_size() const { return value().size(); }
+
+Status Iterator::fields_view(FieldsView* view) const {
+  view->Reset(Slice());
+  return Status::NotSupported("fields view");
+}
+
+bool Iterator::value_handle(uint64_t* file_number, uint64_t* offset,
+                            uint64_t* size) const {
+  return false;
+}
+
 namespace {
 
 class EmptyIterator : public Iterator {
@@ -13,6 +13,7 @@
 #include "table/filter_block.h"
 #include "table/format.h"
 #include "table/two_level_iterator.h"
+#include "table/zone_map.h"
 #include "util/coding.h"
 
 namespace leveldb {
@@ -21,6 +22,8 @@ struct Table::Rep {
   ~Rep() {
     delete filter;
     delete[] filter_data;
+    delete zone_map;
+    delete[] zone_map_data;
     delete index_block;
   }
 
@@ -30,6 +33,8 @@ struct Table::Rep {
   uint64_t cache_id;
   FilterBlockReader* filter;
   const char* filter_data;
+  ZoneMapReader* zone_map;
+  const char* zone_map_data;
 
   BlockHandle metaindex_handle;  // Handle to metaindex_block: saved from footer
   Block* index_block;
@@ -72,6 +77,8 @@ Status Table::Open(const Options& options, RandomAccessFile* file,
     rep->cache_id = (options.block_cache ? options.block_cache->NewId() : 0);
     rep->filter_data = nullptr;
     rep->filter = nullptr;
+    rep->zone_map_data = nullptr;
+    rep->zone_map = nullptr;
     *table = new Table(rep);
     (*table)->ReadMeta(footer);
   }
@@ -80,7 +87,8 @@ Status Table::Open(const Options& options, RandomAccessFile* file,
 }
 
 void Table::ReadMeta(const Footer& footer) {
-  if (rep_->options.filter_policy == nullptr) {
+  if (rep_->options.filter_policy == nullptr &&
+      rep_->options.zone_map_fields.empty()) {
     return;  // Do not need any metadata
   }
 
@@ -98,11 +106,19 @@ void Table::ReadMeta(const Footer& footer) {
   Block* meta = new Block(contents);
 
   Iterator* iter = meta->NewIterator(BytewiseComparator());
-  std::string key = "filter.";
-  key.append(rep_->options.filter_policy->Name());
-  iter->Seek(key);
-  if (iter->Valid() && iter->key() == Slice(key)) {
-    ReadFilter(iter->value());
+  if (rep_->options.filter_policy != nullptr) {
+    std::string key = "filter.";
+    key.append(rep_->options.filter_policy->Name());
+    iter->Seek(key);
+    if (iter->Valid() && iter->key() == Slice(key)) {
+      ReadFilter(iter->value());
+    }
+  }
+  if (!rep_->options.zone_map_fields.empty()) {
+    iter->Seek(kZoneMapKey);
+    if (iter->Valid() && iter->key() == Slice(kZoneMapKey)) {
+      ReadZoneMap(iter->value());
+    }
   }
   delete iter;
   delete meta;
@@ -131,6 +147,26 @@ void Table::ReadFilter(const Slice& filter_handle_value) {
   rep_->filter = new FilterBlockReader(rep_->options.filter_policy, block.data);
 }
 
+void Table::ReadZoneMap(const Slice& zone_map_handle_value) {
+  Slice v = zone_map_handle_value;
+  BlockHandle zone_map_handle;
+  if (!zone_map_handle.DecodeFrom(&v).ok()) {
+    return;
+  }
+  ReadOptions opt;
+  if (rep_->options.paranoid_checks) {
+    opt.verify_checksums = true;
+  }
+  BlockContents block;
+  if (!ReadBlock(rep_->file, opt, zone_map_handle, &block).ok()) {
+    return;
+  }
+  if (block.heap_allocated) {
+    rep_->zone_map_data = block.data.data();  // Will need to delete later
+  }
+  rep_->zone_map = new ZoneMapReader(block.data);
+}
+
 Table::~Table() { delete rep_; }
 
 static void DeleteBlock(void* arg, void* ignored) {
@@ -206,9 +242,19 @@ Iterator* Table::BlockReader(void* arg, const ReadOptions& options,
 }
 
 Iterator* Table::NewIterator(const ReadOptions& options) const {
-  return NewTwoLevelIterator(
-      rep_->index_block->NewIterator(rep_->options.comparator),
-      &Table::BlockReader, const_cast<Table*>(this), options);
+  Iterator* index_iter =
+      rep_->index_block->NewIterator(rep_->options.comparator);
+  if (options.predicate != nullptr && rep_->zone_map != nullptr) {
+    // Pass over the data blocks, or the whole table, that hold no match
+    if (!rep_->zone_map->TableMayMatch(*options.predicate)) {
+      delete index_iter;
+      return NewEmptyIterator();
+    }
+    index_iter =
+        NewZoneMapIterator(index_iter, rep_->zone_map, options.predicate);
+  }
+  return NewTwoLevelIterator(index_iter, &Table::BlockReader,
+                             const_cast<Table*>(this), options);
 }
 
 Status Table::InternalGet(const ReadOptions& options, const Slice& k, void* arg,
@@ -13,6 +13,7 @@
 #include "table/block_builder.h"
 #include "table/filter_block.h"
 #include "table/format.h"
+#include "table/zone_map.h"
 #include "util/coding.h"
 #include "util/crc32c.h"
 
@@ -31,6 +32,9 @@ struct TableBuilder::Rep {
         filter_block(opt.filter_policy == nullptr
                          ? nullptr
                          : new FilterBlockBuilder(opt.filter_policy)),
+        zone_map(opt.zone_map_fields.empty()
+                     ? nullptr
+                     : new ZoneMapBuilder(opt.zone_map_fields)),
         pending_index_entry(false) {
     index_block_options.block_restart_interval = 1;
   }
@@ -46,6 +50,7 @@ struct TableBuilder::Rep {
   int64_t num_entries;
   bool closed;  // Either Finish() or Abandon() has been called.
   FilterBlockBuilder* filter_block;
+  ZoneMapBuilder* zone_map;
 
   // We do not emit the index entry for a block until we have seen the
   // first key for the next data block.  This allows us to use shorter
@@ -72,6 +77,7 @@ TableBuilder::TableBuilder(const Options& options, WritableFile* file)
 TableBuilder::~TableBuilder() {
   assert(rep_->closed);  // Catch errors where caller forgot to call Finish()
   delete rep_->filter_block;
+  delete rep_->zone_map;
   delete rep_;
 }
 
@@ -111,6 +117,9 @@ void TableBuilder::Add(const Slice& key, const Slice& value) {
   if (r->filter_block != nullptr) {
     r->filter_block->AddKey(key);
   }
+  if (r->zone_map != nullptr) {
+    r->zone_map->AddEntry(key, value);
+  }
 
   r->last_key.assign(key.data(), key.size());
   r->num_entries++;
@@ -133,6 +142,9 @@ void TableBuilder::Flush() {
     r->pending_index_entry = true;
     r->status = r->file->Flush();
   }
+  if (r->zone_map != nullptr) {
+    r->zone_map->FinishBlock(r->pending_handle.offset());
+  }
   if (r->filter_block != nullptr) {
     r->filter_block->StartBlock(r->offset);
   }
@@ -217,6 +229,7 @@ Status TableBuilder::Finish() {
   r->closed = true;
 
   BlockHandle filter_block_handle, metaindex_block_handle, index_block_handle;
+  BlockHandle zone_map_handle;
 
   // Write filter block
   if (ok() && r->filter_block != nullptr) {
@@ -224,6 +237,11 @@ Status TableBuilder::Finish() {
                   &filter_block_handle);
   }
 
+  // Write zone map block
+  if (ok() && r->zone_map != nullptr) {
+    WriteRawBlock(r->zone_map->Finish(), kNoCompression, &zone_map_handle);
+  }
+
   // Write metaindex block
   if (ok()) {
     BlockBuilder meta_index_block(&r->options);
@@ -235,6 +253,11 @@ Status TableBuilder::Finish() {
       filter_block_handle.EncodeTo(&handle_encoding);
       meta_index_block.Add(key, handle_encoding);
     }
+    if (r->zone_map != nullptr) {
+      std::string handle_encoding;
+      zone_map_handle.EncodeTo(&handle_encoding);
+      meta_index_block.Add(kZoneMapKey, handle_encoding);
+    }
 
     // TODO(postrelease): Add stats and other meta blocks
     WriteBlock(&meta_index_block, &metaindex_block_handle);
@@ -1,37 +1,122 @@
 #include "table/vtable_builder.h"
 
 #include "leveldb/env.h"
+#include "util/crc32c.h"
 
 namespace leveldb {
 
 VTableBuilder::VTableBuilder(const Options& options, WritableFile* file)
   : file_(file),
-    encoder_() {}
+    options_(options),
+    sampling_(options.vtable_compression == kZstdCompression &&
+              options.vtable_zstd_dict_size > 0),
+    encoder_(options.vtable_compression, options.zstd_compression_level) {
+  buffer_.reserve(kVTableBlockSize);
+  // The file header goes out with the first block
+  PutFixed32(&buffer_, kVTableFileMark);
+  PutFixed32(&buffer_, kCurrentVTableFormat);
+  file_size_ = buffer_.size();
+}
 
 void VTableBuilder::Add(const VTableRecord& record, VTableHandle* handle) {
   if (!ok()) return;
 
+  // Flush() may cut blocks short, they are indexed once full
+  std::vector<uint64_t>& offsets = properties_.block_offsets;
+  if (buffer_.empty() &&
+      (offsets.empty() || file_size_ - offsets.back() >= kVTableBlockSize)) {
+    offsets.push_back(file_size_);
+  }
+  if (record_number_ == 0 ||
+      record.key.compare(properties_.smallest_key) < 0) {
+    properties_.smallest_key.assign(record.key.data(), record.key.size());
+  }
+  if (record_number_ == 0 ||
+      record.key.compare(properties_.largest_key) > 0) {
+    properties_.largest_key.assign(record.key.data(), record.key.size());
+  }
+
+  // Records added before the dictionary exists are compressed without
+  if (sampling_) {
+    Sample(record.value);
+  }
+
   encoder_.Encode(record);
   handle->offset = file_size_;
   handle->size = encoder_.GetEncodedSize();
   file_size_ += encoder_.GetEncodedSize();
 
-  status_ = file_->Append(encoder_.GetHeader().ToString() +
-                          encoder_.GetRecord().ToString());
-
+  Slice header = encoder_.GetHeader();
+  Slice encoded = encoder_.GetRecord();
+  buffer_.append(header.data(), header.size());
+  buffer_.append(encoded.data(), encoded.size());
   record_number_ += 1;
-  assert(ok());
-  //TODO: meta info support in the future
+
+  if (buffer_.size() >= kVTableBlockSize) {
+    WriteBuffer();
+  }
+}
+
+void VTableBuilder::Sample(const Slice& value) {
+  samples_.append(value.data(), value.size());
+  sample_lengths_.push_back(value.size());
+  if (sample_lengths_.size() <
+      static_cast<size_t>(options_.vtable_zstd_dict_samples)) {
+    return;
+  }
+
+  sampling_ = false;
+  std::string dict;
+  if (port::Zstd_TrainDictionary(samples_, sample_lengths_,
+                                 options_.vtable_zstd_dict_size, &dict)) {
+    dict_.reset(new port::ZstdDictionary(dict.data(), dict.size(),
+                                         options_.zstd_compression_level));
+    encoder_.SetDictionary(dict_.get());
+    properties_.compression_dict = std::move(dict);
+  }
+  std::string().swap(samples_);
+  std::vector<size_t>().swap(sample_lengths_);
+}
+
+void VTableBuilder::WriteBuffer() {
+  if (!ok() || buffer_.empty()) return;
+  status_ = file_->Append(buffer_);
+  buffer_.clear();
+}
+
+Status VTableBuilder::Flush() {
+  WriteBuffer();
+  if (ok()) {
+    status_ = file_->Flush();
+  }
+  return status();
 }
 
 Status VTableBuilder::Finish() {
+  WriteBuffer();
   if (!ok()) return status();
 
-  status_ = file_->Flush();
+  properties_.data_size = file_size_;
+  properties_.records_num = record_number_;
+  std::string properties;
+  properties_.Encode(&properties);
+
+  VTableFooter footer;
+  footer.properties_offset = file_size_;
+  footer.properties_size = static_cast<uint32_t>(properties.size());
+  footer.properties_crc =
+      crc32c::Mask(crc32c::Value(properties.data(), properties.size()));
+  footer.Encode(&properties);
+
+  status_ = file_->Append(properties);
+  if (ok()) {
+    file_size_ += properties.size();
+    status_ = file_->Flush();
+  }
 
   return status();
 }
 
-void VTableBuilder::Abandon() { }
+void VTableBuilder::Abandon() { buffer_.clear(); }
 
-} // namespace leveldb
\ No newline at end of file
+} // namespace leveldb
@@ -1,6 +1,9 @@
 #ifndef VTABLE_BUILDER_H
 #define VTABLE_BUILDER_H
 
+#include <memory>
+#include <vector>
+
 #include "leveldb/options.h"
 #include "leveldb/slice.h"
 #include "table/vtable_format.h"
@@ -18,21 +21,43 @@ class VTableBuilder {
     // Builder status, return non-ok iff some error occurs
     Status status() const { return status_; }
 
-    // Finish building the vTable
+    // Append the buffered records to the file and flush it, so they can
+    // be read before the vTable is finished
+    Status Flush();
+
+    // Flush the buffered records and write the properties and footer
     Status Finish();
 
-    // Abandon building the vTable
+    // Abandon building the vTable, buffered records are dropped
     void Abandon();
 
+    // Size of the file header and the records added so far, plus
+    // properties and footer once finished
     uint64_t FileSize() const { return file_size_; }
 
     uint64_t RecordNumber() const { return record_number_; }
   private:
     bool ok() const { return status().ok(); }
 
+    // Append the buffered block to the file
+    void WriteBuffer();
+
+    // Keep the value as a dictionary sample, train the dictionary once
+    // there are enough
+    void Sample(const Slice& value);
+
     WritableFile* file_;
     uint64_t file_size_{0};
     uint64_t record_number_{0};
+    std::string buffer_;
+    VTableProperties properties_;
+
+    // Dictionary training, see Options::vtable_zstd_dict_size
+    const Options options_;
+    bool sampling_;
+    std::string samples_;
+    std::vector<size_t> sample_lengths_;
+    std::unique_ptr<port::ZstdDictionary> dict_;
 
     Status status_;
 
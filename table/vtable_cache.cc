@@ -0,0 +1,338 @@
+#include "table/vtable_cache.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include "db/filename.h"
+#include "leveldb/env.h"
+
+#include "table/vtable_manager.h"
+#include "table/vtable_reader.h"
+#include "util/coding.h"
+
+namespace leveldb {
+
+// Records at most this many bytes apart are fetched by the same read in
+// MultiGet, up to kMaxRunBytes per read
+static const uint64_t kMaxGapBytes = 4 * 1024;
+static const uint64_t kMaxRunBytes = 1024 * 1024;
+
+struct VTableAndBudget {
+  VTableReader* reader;
+  // Non-null iff the reader maps its file, in which case the slot is
+  // returned here when the entry is evicted
+  std::atomic<int>* mmaps_available;
+};
+
+static void DeleteEntry(const Slice& key, void* value) {
+  VTableAndBudget* vb = reinterpret_cast<VTableAndBudget*>(value);
+  // Drops the reference taken on the vtable in VTableReader::Open
+  vb->reader->Close();
+  delete vb->reader;
+  if (vb->mmaps_available != nullptr) {
+    vb->mmaps_available->fetch_add(1, std::memory_order_relaxed);
+  }
+  delete vb;
+}
+
+static void ReleaseHandle(void* arg1, void* arg2) {
+  Cache* cache = reinterpret_cast<Cache*>(arg1);
+  Cache::Handle* h = reinterpret_cast<Cache::Handle*>(arg2);
+  cache->Release(h);
+}
+
+static void DeleteScratch(void* arg1, void* arg2) {
+  delete[] reinterpret_cast<char*>(arg1);
+}
+
+// A record copied into the blob cache
+struct CachedRecord {
+  std::string key;
+  std::string value;
+};
+
+static void DeleteCachedRecord(const Slice& key, void* value) {
+  delete reinterpret_cast<CachedRecord*>(value);
+}
+
+// Buffer of one coalesced read, freed once every value pinning it is reset
+struct SharedScratch {
+  // Starts with the reference held by the reader filling it
+  explicit SharedScratch(size_t n) : data(new char[n]), refs(1) {}
+  ~SharedScratch() { delete[] data; }
+
+  char* const data;
+  std::atomic<int> refs;
+};
+
+static void UnrefScratch(void* arg1, void* arg2) {
+  SharedScratch* scratch = reinterpret_cast<SharedScratch*>(arg1);
+  if (scratch->refs.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+    delete scratch;
+  }
+}
+
+VTableCache::VTableCache(const std::string& dbname, const Options& options,
+                         int entries, VTableManager* manager)
+    : env_(options.env),
+      dbname_(dbname),
+      options_(options),
+      manager_(manager),
+      cache_(NewLRUCache(entries)),
+      mmaps_available_(options.max_vtable_mmaps),
+      blob_cache_(options.blob_cache),
+      blob_cache_id_(blob_cache_ != nullptr ? blob_cache_->NewId() : 0) {}
+
+VTableCache::~VTableCache() { delete cache_; }
+
+bool VTableCache::AcquireMmap() {
+  int available = mmaps_available_.load(std::memory_order_relaxed);
+  while (available > 0) {
+    if (mmaps_available_.compare_exchange_weak(available, available - 1,
+                                               std::memory_order_relaxed)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+Status VTableCache::FindVTable(uint64_t file_number, Cache::Handle** handle) {
+  Status s;
+  char buf[sizeof(file_number)];
+  EncodeFixed64(buf, file_number);
+  Slice key(buf, sizeof(buf));
+  *handle = cache_->Lookup(key);
+  if (*handle == nullptr) {
+    std::string fname = VTableFileName(dbname_, file_number);
+    // Registered vtables are sealed and safe to map, a value log still
+    // grows
+    bool use_mmap = (manager_ == nullptr || manager_->HasVTable(file_number)) &&
+                    AcquireMmap();
+    auto reader = new VTableReader(file_number);
+    s = reader->Open(options_, fname, use_mmap, RandomAccessFile::kRandom);
+    if (!s.ok()) {
+      reader->Close();
+      delete reader;
+      if (use_mmap) {
+        mmaps_available_.fetch_add(1, std::memory_order_relaxed);
+      }
+      // We do not cache error results so that if the error is transient,
+      // or somebody repairs the file, we recover automatically.
+    } else {
+      VTableAndBudget* vb = new VTableAndBudget;
+      vb->reader = reader;
+      vb->mmaps_available = use_mmap ? &mmaps_available_ : nullptr;
+      *handle = cache_->Insert(key, vb, 1, &DeleteEntry);
+    }
+  }
+  return s;
+}
+
+static void EncodeBlobKey(uint64_t cache_id, const VTableIndex& index,
+                          char* buf) {
+  EncodeFixed64(buf, cache_id);
+  EncodeFixed64(buf + 8, index.file_number);
+  EncodeFixed64(buf + 16, index.vtable_handle.offset);
+}
+
+bool VTableCache::LookupBlob(const VTableIndex& index, VTableRecord* record,
+                             PinnableSlice* value) {
+  char buf[24];
+  EncodeBlobKey(blob_cache_id_, index, buf);
+  Cache::Handle* handle = blob_cache_->Lookup(Slice(buf, sizeof(buf)));
+  if (handle == nullptr) {
+    return false;
+  }
+  auto cached = reinterpret_cast<CachedRecord*>(blob_cache_->Value(handle));
+  record->key = cached->key;
+  record->value = cached->value;
+  value->PinSlice(record->value, &ReleaseHandle, blob_cache_, handle);
+  return true;
+}
+
+void VTableCache::InsertBlob(const VTableIndex& index, VTableRecord* record,
+                             PinnableSlice* value) {
+  CachedRecord* cached = new CachedRecord;
+  cached->key = record->key.ToString();
+  cached->value = record->value.ToString();
+  char buf[24];
+  EncodeBlobKey(blob_cache_id_, index, buf);
+  Cache::Handle* handle =
+      blob_cache_->Insert(Slice(buf, sizeof(buf)), cached,
+                          cached->value.size(), &DeleteCachedRecord);
+
+  // Drop whatever held the record so far and pin the cached copy
+  value->Reset();
+  record->key = cached->key;
+  record->value = cached->value;
+  value->PinSlice(record->value, &ReleaseHandle, blob_cache_, handle);
+}
+
+Status VTableCache::Get(const ReadOptions& options, const VTableIndex& index,
+                        VTableRecord* record, PinnableSlice* value) {
+  value->Reset();
+  if (blob_cache_ != nullptr && LookupBlob(index, record, value)) {
+    return Status::OK();
+  }
+  Cache::Handle* handle = nullptr;
+  Status s = FindVTable(index.file_number, &handle);
+  if (!s.ok()) {
+    return s;
+  }
+
+  VTableReader* reader =
+      reinterpret_cast<VTableAndBudget*>(cache_->Value(handle))->reader;
+  // Left uninitialized: the read overwrites all of it
+  char* scratch = new char[index.vtable_handle.size];
+  s = reader->Get(index.vtable_handle, record, scratch, value->GetSelf(),
+                  options.verify_checksums);
+  if (!s.ok()) {
+    delete[] scratch;
+    cache_->Release(handle);
+    return s;
+  }
+
+  const char* data = record->key.data();
+  if (data >= scratch && data <= scratch + index.vtable_handle.size) {
+    // Read into scratch, which now owns the record (or its key, when the
+    // value was uncompressed into the slice's own buffer)
+    cache_->Release(handle);
+    value->PinSlice(record->value, &DeleteScratch, scratch, nullptr);
+  } else {
+    // The record lives in the file's mapping, keep the reader alive
+    delete[] scratch;
+    value->PinSlice(record->value, &ReleaseHandle, cache_, handle);
+  }
+  if (blob_cache_ != nullptr && options.fill_cache) {
+    InsertBlob(index, record, value);
+  }
+  return s;
+}
+
+void VTableCache::MultiGet(const ReadOptions& options,
+                           std::vector<Read>* reads) {
+  if (blob_cache_ != nullptr) {
+    // Serve what the blob cache holds, read the rest
+    size_t misses = 0;
+    for (size_t i = 0; i < reads->size(); i++) {
+      Read& read = (*reads)[i];
+      VTableRecord record;
+      read.value->Reset();
+      if (LookupBlob(read.index, &record, read.value)) {
+        *read.status = Status::OK();
+      } else {
+        (*reads)[misses++] = read;
+      }
+    }
+    reads->resize(misses);
+  }
+
+  std::sort(reads->begin(), reads->end(), [](const Read& a, const Read& b) {
+    if (a.index.file_number != b.index.file_number) {
+      return a.index.file_number < b.index.file_number;
+    }
+    return a.index.vtable_handle.offset < b.index.vtable_handle.offset;
+  });
+
+  const size_t n = reads->size();
+  size_t i = 0;
+  while (i < n) {
+    const uint64_t file_number = (*reads)[i].index.file_number;
+    size_t file_end = i + 1;
+    while (file_end < n && (*reads)[file_end].index.file_number == file_number) {
+      file_end++;
+    }
+
+    Cache::Handle* handle = nullptr;
+    Status s = FindVTable(file_number, &handle);
+    if (!s.ok()) {
+      for (; i < file_end; i++) {
+        (*reads)[i].value->Reset();
+        *(*reads)[i].status = s;
+      }
+      continue;
+    }
+
+    VTableAndBudget* vb =
+        reinterpret_cast<VTableAndBudget*>(cache_->Value(handle));
+    if (vb->mmaps_available != nullptr) {
+      // Mapped reads cost neither a syscall nor a copy, so there is
+      // nothing to gain from merging them
+      for (; i < file_end; i++) {
+        const Read& read = (*reads)[i];
+        VTableRecord record;
+        *read.status = Get(options, read.index, &record, read.value);
+      }
+    } else {
+      while (i < file_end) {
+        const VTableHandle& first = (*reads)[i].index.vtable_handle;
+        uint64_t run_begin = first.offset;
+        uint64_t run_end = first.offset + first.size;
+        size_t run_last = i + 1;
+        while (run_last < file_end) {
+          const VTableHandle& next = (*reads)[run_last].index.vtable_handle;
+          uint64_t next_end = std::max(run_end, next.offset + next.size);
+          if (next.offset > run_end + kMaxGapBytes ||
+              next_end - run_begin > kMaxRunBytes) {
+            break;
+          }
+          run_end = next_end;
+          run_last++;
+        }
+        ReadRun(options, vb->reader, *reads, i, run_last, run_begin,
+                run_end - run_begin);
+        i = run_last;
+      }
+    }
+    cache_->Release(handle);
+  }
+}
+
+void VTableCache::ReadRun(const ReadOptions& options,
+                          const VTableReader* reader,
+                          const std::vector<Read>& reads, size_t begin,
+                          size_t end, uint64_t offset, uint64_t size) {
+  SharedScratch* scratch = new SharedScratch(size);
+  Slice input;
+  Status s = reader->Read(offset, size, &input, scratch->data);
+  if (s.ok() && input.size() != size) {
+    s = Status::Corruption("Short read of vtable records");
+  }
+  if (s.ok() && input.data() != scratch->data) {
+    // The file handed out its own memory, which only lives as long as the
+    // reader; copy it so the values do not depend on the cache entry
+    std::memcpy(scratch->data, input.data(), size);
+    input = Slice(scratch->data, size);
+  }
+
+  for (size_t i = begin; i < end; i++) {
+    const Read& read = reads[i];
+    read.value->Reset();
+    if (!s.ok()) {
+      *read.status = s;
+      continue;
+    }
+    const VTableHandle& handle = read.index.vtable_handle;
+    VTableRecord record;
+    *read.status = reader->ParseRecord(
+        Slice(input.data() + (handle.offset - offset), handle.size), &record,
+        read.value->GetSelf(), options.verify_checksums);
+    if (read.status->ok()) {
+      scratch->refs.fetch_add(1, std::memory_order_relaxed);
+      read.value->PinSlice(record.value, &UnrefScratch, scratch, nullptr);
+      if (blob_cache_ != nullptr && options.fill_cache) {
+        InsertBlob(read.index, &record, read.value);
+      }
+    }
+  }
+
+  UnrefScratch(scratch, nullptr);
+}
+
+void VTableCache::Evict(uint64_t file_number) {
+  char buf[sizeof(file_number)];
+  EncodeFixed64(buf, file_number);
+  cache_->Erase(Slice(buf, sizeof(buf)));
+}
+
+}  // namespace leveldb
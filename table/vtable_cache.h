@@ -0,0 +1,108 @@
+// Thread-safe (provides internal synchronization)
+
+#ifndef VTABLE_CACHE_H
+#define VTABLE_CACHE_H
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "leveldb/cache.h"
+#include "leveldb/options.h"
+#include "leveldb/pinnable_slice.h"
+#include "leveldb/status.h"
+#include "port/port.h"
+
+#include "table/vtable_format.h"
+
+namespace leveldb {
+
+class Env;
+class VTableReader;
+class VTableManager;
+
+// Keeps VTableReaders (and the RandomAccessFiles under them) open across
+// reads, keyed by VTable number.  Caching a reader does not keep its file:
+// gc deletes a vtable only once no read sequence can reach it, and evicts
+// its reader then.
+//
+// If options.blob_cache is set, the records read are cached there too,
+// keyed by vtable number and offset.  VTable numbers are never reused,
+// so the records of a collected vtable are left to age out of it.
+//
+// Up to options.max_vtable_mmaps of the cached readers memory-map their
+// file; the others read with pread.
+class VTableCache {
+ public:
+  VTableCache(const std::string& dbname, const Options& options, int entries,
+              VTableManager* manager);
+
+  VTableCache(const VTableCache&) = delete;
+  VTableCache& operator=(const VTableCache&) = delete;
+
+  ~VTableCache();
+
+  // Read the record addressed by "index" into *record and point *value at
+  // record->value.  The record is read straight into a buffer owned by
+  // *value or, if the VTable is memory-mapped, not copied at all; in the
+  // latter case *value pins the cached reader.  The slices in *record stay
+  // valid until *value is reset.
+  Status Get(const ReadOptions& options, const VTableIndex& index,
+             VTableRecord* record, PinnableSlice* value);
+
+  // One record to read in a batch, and where its result goes
+  struct Read {
+    VTableIndex index;
+    PinnableSlice* value;
+    Status* status;
+  };
+
+  // Perform the reads in *reads, leaving each like Get would.  The reads
+  // are issued per vtable in offset order, and records that lie close
+  // together in the same file are fetched with a single read into a
+  // buffer the resulting values share.  Reorders *reads.
+  void MultiGet(const ReadOptions& options, std::vector<Read>* reads);
+
+  // Evict any entry for the specified file number, dropping the
+  // reference the cached reader holds on it
+  void Evict(uint64_t file_number);
+
+ private:
+  Status FindVTable(uint64_t file_number, Cache::Handle** handle);
+
+  // Serve reads[begin,end-1], which all lie within [offset, offset+size)
+  // of the vtable read by "reader", with one read
+  void ReadRun(const ReadOptions& options, const VTableReader* reader,
+               const std::vector<Read>& reads, size_t begin, size_t end,
+               uint64_t offset, uint64_t size);
+
+  // If the record at "index" is in the blob cache, point *record and
+  // *value at the cached copy and return true
+  bool LookupBlob(const VTableIndex& index, VTableRecord* record,
+                  PinnableSlice* value);
+
+  // Copy *record into the blob cache and repoint *record and *value at
+  // the cached copy
+  void InsertBlob(const VTableIndex& index, VTableRecord* record,
+                  PinnableSlice* value);
+
+  // Try to claim one slot of the mmap budget
+  bool AcquireMmap();
+
+  Env* const env_;
+  const std::string dbname_;
+  const Options& options_;
+  VTableManager* const manager_;
+  Cache* cache_;
+
+  // Number of mmap slots still available
+  std::atomic<int> mmaps_available_;
+
+  Cache* const blob_cache_;
+  const uint64_t blob_cache_id_;
+};
+
+}  // namespace leveldb
+
+#endif  // VTABLE_CACHE_H
@@ -1,8 +1,11 @@
 #include "table/vtable_format.h"
 
-#include <locale>
+#include <algorithm>
+#include <limits>
 
+#include "port/port.h"
 #include "util/coding.h"
+#include "util/crc32c.h"
 
 namespace leveldb {
 
@@ -35,26 +38,132 @@ Status VTableRecord::Decode(Slice* input) {
 void RecordEncoder::Encode(const VTableRecord& record) {
   record_buff_.clear();
 
-  record.Encode(&record_buff_);
+  Slice value = record.value;
+  unsigned char type = kNoCompression;
+  switch (compression_) {
+    case kNoCompression:
+      break;
+
+    case kSnappyCompression:
+      if (port::Snappy_Compress(value.data(), value.size(),
+                                &compressed_buff_) &&
+          compressed_buff_.size() < value.size() - (value.size() / 8u)) {
+        value = compressed_buff_;
+        type = kSnappyCompression;
+      }
+      break;
+
+    case kZstdCompression:
+      if (dict_ != nullptr) {
+        if (dict_->Compress(value.data(), value.size(), &compressed_buff_) &&
+            compressed_buff_.size() < value.size() - (value.size() / 8u)) {
+          value = compressed_buff_;
+          type = kZstdDictCompression;
+        }
+      } else if (port::Zstd_Compress(zstd_compression_level_, value.data(),
+                                     value.size(), &compressed_buff_) &&
+                 compressed_buff_.size() <
+                     value.size() - (value.size() / 8u)) {
+        value = compressed_buff_;
+        type = kZstdCompression;
+      }
+      break;
+  }
+
+  PutLengthPrefixedSlice(&record_buff_, record.key);
+  PutLengthPrefixedSlice(&record_buff_, value);
   record_ = Slice(record_buff_.data(), record_buff_.size());
 
-  assert(record.size() < std::numeric_limits<uint32_t>::max());
+  assert(record_.size() < std::numeric_limits<uint32_t>::max());
 
   EncodeFixed32(header_, static_cast<uint32_t>(record_.size()));
+  header_[8] = static_cast<char>(type);
+  uint32_t crc = crc32c::Value(&header_[8], 1);
+  crc = crc32c::Extend(crc, record_.data(), record_.size());
+  EncodeFixed32(header_ + 4, crc32c::Mask(crc));
 }
 
 Status RecordDecoder::DecodeHeader(Slice* input) {
-  if (!GetFixed32(input, &record_size_)) {
+  if (format_version_ == kLegacyVTableFormat) {
+    if (!GetFixed32(input, &record_size_)) {
+      return Status::Corruption("Error decode record header");
+    }
+    compression_ = kNoCompression;
+    return Status::OK();
+  }
+  if (!GetFixed32(input, &record_size_) || !GetFixed32(input, &crc_) ||
+      !GetChar(input, &compression_)) {
     return Status::Corruption("Error decode record header");
   }
   return Status::OK();
 }
 
-Status RecordDecoder::DecodeRecord(Slice* input, VTableRecord* record) const {
+Status RecordDecoder::DecodeRecord(Slice* input, VTableRecord* record,
+                                   std::string* buffer, bool verify_checksum,
+                                   const port::ZstdDictionary* dict) const {
   Slice record_input(input->data(), record_size_);
   input->remove_prefix(record_size_);
 
-  return DecodeSrcIntoObj(record_input, record);
+  // Legacy records have no checksum
+  if (verify_checksum && format_version_ != kLegacyVTableFormat) {
+    const char type = static_cast<char>(compression_);
+    uint32_t actual = crc32c::Value(&type, 1);
+    actual = crc32c::Extend(actual, record_input.data(), record_input.size());
+    if (crc32c::Unmask(crc_) != actual) {
+      return Status::Corruption("vtable record checksum mismatch");
+    }
+  }
+  if (compression_ > kZstdDictCompression) {
+    return Status::Corruption("bad vtable record compression type");
+  }
+
+  Status s = DecodeSrcIntoObj(record_input, record);
+  if (!s.ok() || compression_ == kNoCompression) {
+    return s;
+  }
+
+  const Slice& value = record->value;
+  size_t ulength = 0;
+  switch (compression_) {
+    case kSnappyCompression:
+      if (!port::Snappy_GetUncompressedLength(value.data(), value.size(),
+                                              &ulength)) {
+        return Status::Corruption("corrupted snappy compressed value length");
+      }
+      buffer->resize(ulength);
+      if (!port::Snappy_Uncompress(value.data(), value.size(),
+                                   &(*buffer)[0])) {
+        return Status::Corruption("corrupted snappy compressed value");
+      }
+      break;
+    case kZstdCompression:
+      if (!port::Zstd_GetUncompressedLength(value.data(), value.size(),
+                                            &ulength)) {
+        return Status::Corruption("corrupted zstd compressed value length");
+      }
+      buffer->resize(ulength);
+      if (!port::Zstd_Uncompress(value.data(), value.size(), &(*buffer)[0])) {
+        return Status::Corruption("corrupted zstd compressed value");
+      }
+      break;
+    case kZstdDictCompression:
+      if (dict == nullptr) {
+        return Status::Corruption("zstd dictionary of vtable missing");
+      }
+      if (!port::Zstd_GetUncompressedLength(value.data(), value.size(),
+                                            &ulength)) {
+        return Status::Corruption("corrupted zstd compressed value length");
+      }
+      buffer->resize(ulength);
+      if (!dict->Uncompress(value.data(), value.size(), &(*buffer)[0])) {
+        return Status::Corruption("corrupted zstd compressed value");
+      }
+      break;
+    default:
+      break;
+  }
+  record->value = Slice(buffer->data(), ulength);
+  return s;
 }
 
 void VTableHandle::Encode(std::string* target) const {
@@ -69,6 +178,93 @@ Status VTableHandle::Decode(Slice* input) {
   return Status::OK();
 }
 
+uint64_t ValueSizeFromHandle(const VTableHandle& handle, uint64_t key_size) {
+  uint64_t overhead = kRecordHeaderSize + VarintLength(key_size) + key_size;
+  if (handle.size <= overhead) {
+    return 0;
+  }
+  // The rest holds the value prefixed by its varint length
+  uint64_t rest = handle.size - overhead;
+  uint64_t value_size = rest > 1 ? rest - 1 : 0;
+  while (value_size > 0 && value_size + VarintLength(value_size) > rest) {
+    value_size--;
+  }
+  return value_size;
+}
+
+void VTableProperties::Encode(std::string* target) const {
+  PutVarint32(target, format_version);
+  PutVarint64(target, data_size);
+  PutVarint64(target, records_num);
+  PutLengthPrefixedSlice(target, smallest_key);
+  PutLengthPrefixedSlice(target, largest_key);
+  PutVarint64(target, block_offsets.size());
+  uint64_t last = 0;
+  for (uint64_t offset : block_offsets) {
+    PutVarint64(target, offset - last);
+    last = offset;
+  }
+  if (!compression_dict.empty()) {
+    PutLengthPrefixedSlice(target, compression_dict);
+  }
+}
+
+Status VTableProperties::Decode(Slice* input) {
+  Slice smallest, largest;
+  uint64_t num_offsets;
+  if (!GetVarint32(input, &format_version) ||
+      !GetVarint64(input, &data_size) || !GetVarint64(input, &records_num) ||
+      !GetLengthPrefixedSlice(input, &smallest) ||
+      !GetLengthPrefixedSlice(input, &largest) ||
+      !GetVarint64(input, &num_offsets) || num_offsets > input->size()) {
+    return Status::Corruption("Error decode VTableProperties");
+  }
+  smallest_key = smallest.ToString();
+  largest_key = largest.ToString();
+  block_offsets.clear();
+  block_offsets.reserve(num_offsets);
+  uint64_t offset = 0;
+  for (uint64_t i = 0; i < num_offsets; i++) {
+    uint64_t delta;
+    if (!GetVarint64(input, &delta)) {
+      return Status::Corruption("Error decode VTableProperties");
+    }
+    offset += delta;
+    block_offsets.push_back(offset);
+  }
+  compression_dict.clear();
+  if (!input->empty()) {
+    Slice dict;
+    if (!GetLengthPrefixedSlice(input, &dict)) {
+      return Status::Corruption("Error decode VTableProperties");
+    }
+    compression_dict = dict.ToString();
+  }
+  return Status::OK();
+}
+
+void VTableFooter::Encode(std::string* target) const {
+  PutFixed64(target, properties_offset);
+  PutFixed32(target, properties_size);
+  PutFixed32(target, properties_crc);
+  PutFixed64(target, kVTableMagicNumber);
+}
+
+Status VTableFooter::Decode(Slice* input) {
+  if (input->size() < kEncodedLength) {
+    return Status::Corruption("Error decode VTableFooter");
+  }
+  const char* p = input->data();
+  if (DecodeFixed64(p + 16) != kVTableMagicNumber) {
+    return Status::NotFound("not a vtable with footer");
+  }
+  properties_offset = DecodeFixed64(p);
+  properties_size = DecodeFixed32(p + 8);
+  properties_crc = DecodeFixed32(p + 12);
+  input->remove_prefix(kEncodedLength);
+  return Status::OK();
+}
+
 void VTableIndex::Encode(std::string* target) const {
   target->push_back(kVTableIndex);
   PutVarint64(target, file_number);
@@ -89,4 +285,64 @@ Status VTableIndex::Decode(Slice* input) {
   return s;
 }
 
+void FieldsIndex::Encode(std::string* target) const {
+  target->push_back(kFieldsIndex);
+  PutVarint64(target, index.file_number);
+  index.vtable_handle.Encode(target);
+  PutVarint32(target, static_cast<uint32_t>(separated_names.size()));
+  for (const Slice& name : separated_names) {
+    PutLengthPrefixedSlice(target, name);
+  }
+  target->append(inline_fields.data(), inline_fields.size());
+}
+
+Status FieldsIndex::Decode(Slice* input) {
+  unsigned char type;
+  uint32_t count;
+  if (!GetChar(input, &type) || type != kFieldsIndex ||
+      !GetVarint64(input, &index.file_number) ||
+      !index.vtable_handle.Decode(input).ok() ||
+      !GetVarint32(input, &count)) {
+    return Status::Corruption("Error decode FieldsIndex");
+  }
+  separated_names.clear();
+  for (uint32_t i = 0; i < count; i++) {
+    Slice name;
+    if (!GetLengthPrefixedSlice(input, &name)) {
+      return Status::Corruption("Error decode FieldsIndex names");
+    }
+    separated_names.push_back(name);
+  }
+  inline_fields = *input;
+  input->remove_prefix(input->size());
+  return Status::OK();
+}
+
+bool FieldsIndex::IsSeparated(const Slice& field_name) const {
+  return std::binary_search(
+      separated_names.begin(), separated_names.end(), field_name,
+      [](const Slice& a, const Slice& b) { return a.compare(b) < 0; });
+}
+
+bool GetVTableIndex(const Slice& value, VTableIndex* index) {
+  if (value.empty()) {
+    return false;
+  }
+  Slice input = value;
+  switch (static_cast<unsigned char>(value[0])) {
+    case VTableIndex::kVTableIndex:
+      return index->Decode(&input).ok();
+    case FieldsIndex::kFieldsIndex: {
+      FieldsIndex fields_index;
+      if (!fields_index.Decode(&input).ok()) {
+        return false;
+      }
+      *index = fields_index.index;
+      return true;
+    }
+    default:
+      return false;
+  }
+}
+
 } // namespace leveldb
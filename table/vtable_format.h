@@ -1,13 +1,51 @@
 #ifndef VTABLE_FORMAT_H
 #define VTABLE_FORMAT_H
 
+#include <vector>
+
+#include "leveldb/options.h"
+#include "port/port.h"
 #include "leveldb/slice.h"
 #include "leveldb/status.h"
 #include "table/format.h"
 
 namespace leveldb {
 
-const uint64_t kRecordHeaderSize = 4;
+// VTable文件的格式版本，写在文件头和properties中。读取时按文件头的版本解码，
+// 比当前版本新的文件无法读取
+enum VTableFormatVersion : uint32_t {
+  // 旧格式：没有文件头和footer，record的header只有fixed32的record长度，
+  // 没有crc，value不压缩
+  kLegacyVTableFormat = 0,
+  kCurrentVTableFormat = 1,
+};
+
+// 文件头：fixed32的kVTableFileMark，加上fixed32的格式版本。旧格式的文件
+// 以第一条record的长度开头，不可能等于kVTableFileMark
+const uint64_t kVTableFileHeaderSize = 8;
+const uint32_t kVTableFileMark = 0xffffffffu;
+
+// record的header：fixed32的record长度，fixed32的masked crc32c，
+// 加上1字节的value压缩类型，即CompressionType或kZstdDictCompression。
+// crc覆盖压缩类型和record
+const uint64_t kRecordHeaderSize = 9;
+// 旧格式record的header：只有fixed32的record长度
+const uint64_t kLegacyRecordHeaderSize = 4;
+
+// 格式版本为format_version的VTable中record header的长度
+inline uint64_t RecordHeaderSize(uint32_t format_version) {
+  return format_version == kLegacyVTableFormat ? kLegacyRecordHeaderSize
+                                               : kRecordHeaderSize;
+}
+
+// 用VTable的zstd字典压缩，只出现在record的header中
+const unsigned char kZstdDictCompression = 0x3;
+
+// VTable的数据区按块缓冲写入，每块写满后才落盘
+const uint64_t kVTableBlockSize = 64 * 1024;
+
+// 写在VTable文件末尾的魔数，没有它的文件是旧格式，只有数据区
+static const uint64_t kVTableMagicNumber = 0x767461626c655f31ull;
 
 // VTable最基本的存储单位，表示存储的一个key和一个value
 struct VTableRecord {
@@ -29,8 +67,14 @@ struct VTableRecord {
 
 class RecordEncoder {
   public:
-    // TODO: Support compression while encoding a record
-    RecordEncoder() = default;
+    // 按compression压缩record的value，压缩不划算时保存原始的value
+    explicit RecordEncoder(CompressionType compression = kNoCompression,
+                           int zstd_compression_level = 1)
+      : compression_(compression),
+        zstd_compression_level_(zstd_compression_level) {}
+
+    // 之后的zstd压缩使用字典dict，它的生命周期须长于encoder
+    void SetDictionary(const port::ZstdDictionary* dict) { dict_ = dict; }
 
     // 编码一条vTable record
     void Encode(const VTableRecord& record);
@@ -44,26 +88,43 @@ class RecordEncoder {
     // 获得编码后的record
     Slice GetRecord() const { return record_; }
   private:
+    const CompressionType compression_;
+    const int zstd_compression_level_;
+    const port::ZstdDictionary* dict_{nullptr};
+
     char header_[kRecordHeaderSize];
     Slice record_;
 
     std::string record_buff_;
+    std::string compressed_buff_;
 };
 
 class RecordDecoder {
   public:
+    // 解码格式版本为format_version的VTable中的record
+    explicit RecordDecoder(uint32_t format_version = kCurrentVTableFormat)
+      : format_version_(format_version) {}
 
     // 解码出record的header
     Status DecodeHeader(Slice* input);
 
-    // 解码出record
-    Status DecodeRecord(Slice* input, VTableRecord* record) const;
+    // 解码出record，压缩过的value解压到buffer中，record的value指向buffer。
+    // verify_checksum时先校验crc。用字典压缩的value需要VTable的字典dict
+    Status DecodeRecord(Slice* input, VTableRecord* record,
+                        std::string* buffer, bool verify_checksum,
+                        const port::ZstdDictionary* dict = nullptr) const;
 
     // 获得解码后的record size
     size_t GetDecodedSize() const { return record_size_; }
 
+    // 获得value的压缩类型
+    unsigned char GetCompression() const { return compression_; }
+
   private:
+    const uint32_t format_version_;
     uint32_t record_size_{0};
+    uint32_t crc_{0};
+    unsigned char compression_{kNoCompression};
 };
 
 struct VTableHandle {
@@ -96,6 +157,77 @@ struct VTableIndex {
   }
 };
 
+// 部分字段分离的value：较大的字段编码成Fields，作为一条record存入VTable，
+// 其余字段留在sstable中，只读取内联字段时不必读VTable。编码为
+//   [kFieldsIndex][varint file_number][VTableHandle]
+//   [varint 分离字段数][length-prefixed 字段名...][内联字段的Fields]
+struct FieldsIndex {
+  enum Type : unsigned char {
+    kFieldsIndex = 3,
+  };
+
+  // 分离出的字段所在的record
+  VTableIndex index;
+  // 分离出的字段名，按字段名排序
+  std::vector<Slice> separated_names;
+  // 编码后的内联字段
+  Slice inline_fields;
+
+  void Encode(std::string* target) const;
+  // 解码后的Slice指向input的内容
+  Status Decode(Slice* input);
+
+  // 字段field_name是否被分离到VTable中
+  bool IsSeparated(const Slice& field_name) const;
+};
+
+// 取出value（含类型字节）指向的VTable record，value是kVTableIndex或
+// kFieldsIndex时返回true
+bool GetVTableIndex(const Slice& value, VTableIndex* index);
+
+// VTable文件的格式：
+//   [file header]                定长的文件头，见kVTableFileHeaderSize
+//   [record 1] ... [record N]    数据区
+//   [properties]                 VTableProperties
+//   [footer]                     定长的VTableFooter
+// 写入中的value log和恢复出的value log没有properties和footer
+struct VTableProperties {
+  // 与文件头中的格式版本相同
+  uint32_t format_version{kCurrentVTableFormat};
+  // 数据区的字节数，即properties的起始偏移
+  uint64_t data_size{0};
+  uint64_t records_num{0};
+  // 文件中按字节序最小和最大的user key，没有record时为空
+  std::string smallest_key;
+  std::string largest_key;
+  // 稀疏索引：每个块中第一条record的偏移，可以从任意一项开始顺序扫描
+  std::vector<uint64_t> block_offsets;
+  // 训练得到的zstd字典，没有时为空
+  std::string compression_dict;
+
+  void Encode(std::string* target) const;
+  Status Decode(Slice* input);
+};
+
+struct VTableFooter {
+  // properties的位置和crc
+  uint64_t properties_offset{0};
+  uint32_t properties_size{0};
+  uint32_t properties_crc{0};
+
+  // footer编码后的固定长度
+  enum { kEncodedLength = 8 + 4 + 4 + 8 };
+
+  void Encode(std::string* target) const;
+  // 魔数不符时返回NotFound，说明是旧格式的文件
+  Status Decode(Slice* input);
+};
+
+// 根据record的handle和key的长度推算value的长度，不读取VTable。
+// 对压缩过的value得到的是压缩后的长度，对旧格式的record少算了header
+// 少出的5字节
+uint64_t ValueSizeFromHandle(const VTableHandle& handle, uint64_t key_size);
+
 // 便利的调用解码方法的函数
 template <typename T>
 Status DecodeSrcIntoObj(const Slice& src, T* target) {
@@ -1,33 +1,28 @@
 #include "table/vtable_manager.h"
 
-#include "db/dbformat.h"
-#include "db/filename.h"
-#include <iostream>
-#include <ostream>
+#include <algorithm>
 
 #include "leveldb/env.h"
 #include "leveldb/status.h"
 
+#include "table/vtable_cache.h"
 #include "util/coding.h"
+#include "util/mutexlock.h"
 
 namespace leveldb {
 
-struct GCInfo {
-  std::string dbname;
-  std::vector<uint64_t> file_list;
-  Env* env = nullptr;
-};
-
 void VTableMeta::Encode(std::string* target) const {
   PutVarint64(target, number);
   PutVarint64(target, records_num);
   PutVarint64(target, invalid_num);
   PutVarint64(target, table_size);
+  PutVarint64(target, invalid_size);
 }
 
 Status VTableMeta::Decode(Slice* input) {
   if (!GetVarint64(input, &number) || !GetVarint64(input, &records_num) ||
-      !GetVarint64(input, &invalid_num) || !GetVarint64(input, &table_size)) {
+      !GetVarint64(input, &invalid_num) || !GetVarint64(input, &table_size) ||
+      !GetVarint64(input, &invalid_size)) {
     return Status::Corruption("Error Decode VTable meta");
   }
   return Status::OK();
@@ -35,161 +30,151 @@ Status VTableMeta::Decode(Slice* input) {
 
 
 
+void VTableManager::UpdateCandidate(VTableState* state) {
+  const VTableMeta& meta = state->meta;
+  bool candidate = !state->picked && meta.invalid_num < meta.records_num &&
+                   meta.table_size > 0 &&
+                   meta.invalid_size >= gc_garbage_ratio_ * meta.table_size;
+  if (candidate != state->gc_candidate) {
+    state->gc_candidate = candidate;
+    gc_candidates_.fetch_add(candidate ? 1 : -1, std::memory_order_release);
+  }
+}
+
 void VTableManager::AddVTable(const VTableMeta& vtable_meta) {
-  vtables_[vtable_meta.number] = vtable_meta;
+  {
+    Shard* shard = GetShard(vtable_meta.number);
+    MutexLock l(&shard->mutex);
+    VTableState* state = &shard->vtables[vtable_meta.number];
+    state->meta = vtable_meta;
+    UpdateCandidate(state);
+  }
+  if (vtable_meta.records_num > 0 &&
+      vtable_meta.invalid_num >= vtable_meta.records_num) {
+    // Recovered entirely invalid, waiting to be dropped
+    MutexLock l(&invalid_mutex_);
+    invalid_.push_back(vtable_meta);
+  }
 }
 
-void VTableManager::RemoveVTable(uint64_t file_num) {
-  const auto it = vtables_.find(file_num);
-  if (it == vtables_.end()) { return; }
-  vtables_.erase(it);
+bool VTableManager::HasVTable(uint64_t file_num) const {
+  Shard* shard = GetShard(file_num);
+  MutexLock l(&shard->mutex);
+  return shard->vtables.find(file_num) != shard->vtables.end();
 }
 
-Status VTableManager::AddInvalid(uint64_t file_num) {
-  const auto it = vtables_.find(file_num);
-  if (it == vtables_.end()) {
-    return Status::Corruption("Invalid VTable number");
+void VTableManager::RemoveVTable(uint64_t file_num) {
+  {
+    Shard* shard = GetShard(file_num);
+    MutexLock l(&shard->mutex);
+    const auto it = shard->vtables.find(file_num);
+    if (it == shard->vtables.end()) { return; }
+    if (it->second.gc_candidate) {
+      gc_candidates_.fetch_sub(1, std::memory_order_release);
+    }
+    shard->vtables.erase(it);
   }
-
-  vtables_[file_num].invalid_num += 1;
-  if (vtables_[file_num].invalid_num >= vtables_[file_num].records_num) {
-    invalid_.emplace_back(file_num);
+  if (vtable_cache_ != nullptr) {
+    // Not under the shard mutex, closing the reader may take a while
+    vtable_cache_->Evict(file_num);
   }
-
-  MaybeScheduleGarbageCollect();
-
-  return Status::OK();
 }
 
-Status VTableManager::SaveVTableMeta() const {
-  auto fname = VTableManagerFileName(dbname_);
-  WritableFile* file;
-  Status s = env_->NewWritableFile(fname, &file);
-  if (!s.ok()) {
-    return Status::Corruption("Failed to open vTable manager file");
+Status VTableManager::AddInvalid(uint64_t file_num, uint64_t size,
+                                 uint64_t count) {
+  VTableMeta all_invalid_meta;
+  bool all_invalid;
+  {
+    Shard* shard = GetShard(file_num);
+    MutexLock l(&shard->mutex);
+    const auto it = shard->vtables.find(file_num);
+    if (it == shard->vtables.end()) {
+      return Status::Corruption("Invalid VTable number");
+    }
+    VTableMeta& meta = it->second.meta;
+    // Only report the transition, later records of the file change nothing
+    all_invalid = meta.invalid_num < meta.records_num &&
+                  meta.invalid_num + count >= meta.records_num;
+    meta.invalid_num += count;
+    meta.invalid_size += size;
+    UpdateCandidate(&it->second);
+    all_invalid_meta = meta;
   }
 
-  const auto vtable_num = vtables_.size();
-  std::string target;
-  PutVarint64(&target, vtable_num);
-  for (auto & vtable : vtables_) {
-    vtable.second.Encode(&target);
-  }
-  s = file->Append(target);
-  if (!s.ok()) {
-    return Status::Corruption("Failed to append vTable manager file");
-  }
-  s = file->Flush();
-  if (s.ok()) {
-    s = file->Sync();
-  }
-  if (s.ok()) {
-    s = file->Close();
-  }
-  delete file;
-  file = nullptr;
-  if (!s.ok()) {
-    return Status::Corruption("Failed to write vTable meta file");
+  if (all_invalid) {
+    MutexLock l(&invalid_mutex_);
+    invalid_.push_back(all_invalid_meta);
   }
+
   return Status::OK();
 }
 
-Status VTableManager::LoadVTableMeta() {
-  auto fname = VTableManagerFileName(dbname_);
-  if (!env_->FileExists(fname)) {
-    return Status::OK();
-  }
-  SequentialFile* file;
-  Status s = env_->NewSequentialFile(fname, &file);
-  if (!s.ok()) {
-    return Status::Corruption("Failed to open vTable manager file");
-  }
-  uint64_t file_size;
-  s = env_->GetFileSize(fname, &file_size);
-  if (!s.ok()) {
-    return Status::Corruption("Failed to get vTable manager file size");
-  }
-  auto buf = new char[file_size];
-  Slice input;
-  s = file->Read(file_size, &input, buf);
-  if (!s.ok()) {
-    return Status::Corruption("Failed to read vTable manager file");
-  }
-
-  uint64_t vtable_num;
-  if(!GetVarint64(&input, &vtable_num)) {
-    return Status::Corruption("Failed to get vTable num");
-  }
-
-  for (int i = 0; i < vtable_num; i++) {
-    VTableMeta vtable_meta;
-    s = vtable_meta.Decode(&input);
-    if (s.ok()) {
-      if (vtable_meta.number == 0) {
-        continue;
-      }
-      AddVTable(vtable_meta);
-      if (vtable_meta.invalid_num >= vtable_meta.records_num) {
-        invalid_.emplace_back(vtable_meta.number);
-      }
-    } else {
-      return s;
+void VTableManager::GetVTableMetas(std::vector<VTableMeta>* metas) const {
+  metas->clear();
+  for (int i = 0; i < kNumShards; i++) {
+    MutexLock l(&shards_[i].mutex);
+    for (auto & vtable : shards_[i].vtables) {
+      metas->push_back(vtable.second.meta);
     }
   }
-
-  return s;
+  std::sort(metas->begin(), metas->end(),
+            [](const VTableMeta& a, const VTableMeta& b) {
+              return a.number < b.number;
+            });
 }
 
-void VTableManager::MaybeScheduleGarbageCollect() {
-  size_t size = 0;
-  auto delete_list = std::vector<uint64_t>();
-  if (!invalid_.empty()) {
-    auto invalid = std::set<uint64_t>(invalid_.begin(), invalid_.end());
-    invalid_ = std::vector<uint64_t>(invalid.begin(), invalid.end());
-    for (auto & file_num : invalid) {
-      if (vtables_.find(file_num) != vtables_.end() && vtables_[file_num].ref <= 0) {
-        size += vtables_[file_num].table_size;
-        delete_list.emplace_back(file_num);
-      }
-    }
-    if (size >= gc_threshold_) {
-      for (auto & file_num : delete_list) {
-        auto it = std::remove(invalid_.begin(), invalid_.end(), file_num);
-        RemoveVTable(file_num);
+void VTableManager::PickGarbageCollect(uint64_t max_bytes,
+                                       std::vector<VTableMeta>* picked) {
+  picked->clear();
+  if (!NeedsGarbageCollect()) {
+    return;
+  }
+  std::vector<VTableMeta> candidates;
+  for (int i = 0; i < kNumShards; i++) {
+    MutexLock l(&shards_[i].mutex);
+    for (auto & vtable : shards_[i].vtables) {
+      if (vtable.second.gc_candidate) {
+        candidates.push_back(vtable.second.meta);
       }
-      auto* gc_info = new GCInfo;
-      gc_info->dbname = dbname_;
-      gc_info->file_list = delete_list;
-      gc_info->env = env_;
-      env_->StartThread(&VTableManager::BackgroudGC, gc_info);
-      // for (auto & file_num : gc_info->file_list) {
-      //   RemoveVTable(file_num);
-      //   auto it = std::remove(invalid_.begin(), invalid_.end(), file_num);
-      // }
     }
   }
-}
-
-void VTableManager::BackgroudGC(void* gc_info) {
-  auto info = reinterpret_cast<GCInfo*>(gc_info);
-  std::cout << "gc starts..." << std::endl;
-  auto start_time = std::chrono::steady_clock::now();
-  for (auto & file_num : info->file_list) {
-    // if (file_num <= 0) {continue;}
-    auto fname = VTableFileName(info->dbname, file_num);
-    info->env->RemoveFile(fname);
+  // Most garbage first
+  std::sort(candidates.begin(), candidates.end(),
+            [](const VTableMeta& a, const VTableMeta& b) {
+              return static_cast<double>(a.invalid_size) / a.table_size >
+                     static_cast<double>(b.invalid_size) / b.table_size;
+            });
+
+  uint64_t bytes = 0;
+  for (auto & meta : candidates) {
+    if (!picked->empty() && bytes + meta.table_size > max_bytes) {
+      break;
+    }
+    Shard* shard = GetShard(meta.number);
+    MutexLock l(&shard->mutex);
+    const auto it = shard->vtables.find(meta.number);
+    if (it == shard->vtables.end() || !it->second.gc_candidate) {
+      continue;
+    }
+    it->second.picked = true;
+    UpdateCandidate(&it->second);
+    bytes += meta.table_size;
+    picked->push_back(it->second.meta);
   }
-  auto end_time = std::chrono::steady_clock::now();
-  auto duration = std::chrono::duration_cast<std::chrono::microseconds>(end_time - start_time).count();
-  std::cout << "gc lasts: " << duration << " micros" << std::endl;
-}
-
-void VTableManager::RefVTable(uint64_t file_num) {
-  vtables_[file_num].ref += 1;
 }
 
-void VTableManager::UnrefVTable(uint64_t file_num) {
-  vtables_[file_num].ref -= 1;
+void VTableManager::TakeInvalidVTables(std::vector<VTableMeta>* metas) {
+  metas->clear();
+  {
+    MutexLock l(&invalid_mutex_);
+    metas->swap(invalid_);
+  }
+  // Some may have been dropped meanwhile, e.g. by a later MANIFEST record
+  metas->erase(std::remove_if(metas->begin(), metas->end(),
+                              [this](const VTableMeta& meta) {
+                                return !HasVTable(meta.number);
+                              }),
+               metas->end());
 }
 
 } // namespace leveldb
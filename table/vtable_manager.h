@@ -1,15 +1,21 @@
 #ifndef VTABLE_MANAGER_H
 #define VTABLE_MANAGER_H
 
+#include <atomic>
 #include <map>
 #include <set>
+#include <vector>
 
 #include "leveldb/env.h"
 #include "leveldb/slice.h"
 #include "leveldb/status.h"
+#include "port/port.h"
+#include "port/thread_annotations.h"
 
 namespace leveldb {
 
+class VTableCache;
+
 struct VTableMeta {
   uint64_t number;
 
@@ -19,56 +25,106 @@ struct VTableMeta {
 
   uint64_t table_size;
 
-  uint64_t ref = 0;
+  // bytes taken by the invalid records
+  uint64_t invalid_size;
+
+  // bytes taken by the records still referenced, plus the footer while
+  // any record is
+  uint64_t live_size() const {
+    if (records_num > 0 && invalid_num >= records_num) {
+      return 0;
+    }
+    return invalid_size < table_size ? table_size - invalid_size : 0;
+  }
 
   void Encode(std::string* target) const;
   Status Decode(Slice* input);
 
-  VTableMeta() : number(0), records_num(0), invalid_num(0), table_size(0) {}
+  VTableMeta()
+      : number(0),
+        records_num(0),
+        invalid_num(0),
+        table_size(0),
+        invalid_size(0) {}
 };
 
+// Thread-safe (provides internal synchronization).  The vtable metadata
+// is split into shards by file number, each behind its own mutex, so
+// readers looking up a vtable do not contend with compactions updating
+// the invalid counts of others.  It does not track readers: DBImpl only
+// removes a vtable once no read sequence can still reach it.
 class VTableManager {
   public:
-    explicit VTableManager(const std::string& dbname, Env* env, size_t gc_threshold) :
-  dbname_(dbname),
-  env_(env),
-  gc_threshold_(gc_threshold) {}
+    explicit VTableManager(double gc_garbage_ratio = 1.0) :
+  gc_garbage_ratio_(gc_garbage_ratio) {}
 
     ~VTableManager() = default;
 
+    // set the cache holding the vtable readers, removed vtables are evicted
+    void SetVTableCache(VTableCache* vtable_cache) { vtable_cache_ = vtable_cache; }
+
     // sign a vtable to meta
     void AddVTable(const VTableMeta& vtable_meta);
 
-    // remove a vtable from meta
+    // remove a vtable from meta and close its cached reader.  The caller
+    // makes sure no read still needs it, its file is then obsolete.
     void RemoveVTable(uint64_t file_num);
 
-    // add an invalid num to a vtable
-    Status AddInvalid(uint64_t file_num);
-
-    // save meta info to disk
-    Status SaveVTableMeta() const;
+    // whether a vtable is known
+    bool HasVTable(uint64_t file_num) const;
 
-    // recover meta info from disk
-    Status LoadVTableMeta();
+    // mark "count" records taking "size" bytes in a vtable invalid
+    Status AddInvalid(uint64_t file_num, uint64_t size, uint64_t count = 1);
 
-    // reference a vtable
-    void RefVTable(uint64_t file_num);
+    // whether some vtable has enough garbage to be worth rewriting
+    bool NeedsGarbageCollect() const {
+      return gc_candidates_.load(std::memory_order_acquire) > 0;
+    }
 
-    // unref a vtable
-    void UnrefVTable(uint64_t file_num);
+    // pick the vtables with the highest garbage ratio, up to about
+    // "max_bytes" of them, for rewriting.  They are not picked again.
+    void PickGarbageCollect(uint64_t max_bytes, std::vector<VTableMeta>* picked);
 
-    // maybe schedule backgroud gc
-    void MaybeScheduleGarbageCollect();
+    // move the metas of the vtables that became entirely invalid since the
+    // last call into *metas.  They stay registered until removed.
+    void TakeInvalidVTables(std::vector<VTableMeta>* metas);
 
-    // do backgroud gc work
-    static void BackgroudGC(void* gc_info);
+    // copy the meta of every vtable, ordered by file number
+    void GetVTableMetas(std::vector<VTableMeta>* metas) const;
 
   private:
-    std::string dbname_;
-    Env* env_;
-    std::map<uint64_t, VTableMeta> vtables_;
-    std::vector<uint64_t> invalid_;
-    size_t gc_threshold_;
+    static const int kNumShardBits = 4;
+    static const int kNumShards = 1 << kNumShardBits;
+
+    struct VTableState {
+      VTableMeta meta;
+      // Counted in gc_candidates_
+      bool gc_candidate{false};
+      // Handed out by PickGarbageCollect
+      bool picked{false};
+    };
+
+    struct Shard {
+      port::Mutex mutex;
+      std::map<uint64_t, VTableState> vtables GUARDED_BY(mutex);
+    };
+
+    // Update state->gc_candidate and gc_candidates_ after its meta changed
+    void UpdateCandidate(VTableState* state);
+
+    Shard* GetShard(uint64_t file_num) const {
+      return &shards_[file_num & (kNumShards - 1)];
+    }
+
+    mutable Shard shards_[kNumShards];
+
+    // Guards the vtables that became entirely invalid, see
+    // TakeInvalidVTables; never held while acquiring a shard mutex
+    port::Mutex invalid_mutex_;
+    std::vector<VTableMeta> invalid_ GUARDED_BY(invalid_mutex_);
+    const double gc_garbage_ratio_;
+    std::atomic<int> gc_candidates_{0};
+    VTableCache* vtable_cache_{nullptr};
 };
 
 } // namespace leveldb
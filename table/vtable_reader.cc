@@ -4,27 +4,63 @@
 
 #include "table/vtable_reader.h"
 
+#include "util/crc32c.h"
+
 namespace leveldb {
-  Status VTableReader::Open(const Options& options, std::string fname) {
+  Status VTableReader::Open(const Options& options, std::string fname,
+                            bool use_mmap,
+                            RandomAccessFile::AccessPattern pattern) {
     options_ = options;
-    Status s = options_.env->NewRandomAccessFile(fname, &file_);
-    if (manager_ != nullptr) {
-      manager_->RefVTable(fnum_);
+    fname_ = fname;
+    Status s;
+    if (use_mmap) {
+      s = options_.env->NewMmapReadableFile(fname, &file_);
+    } else {
+      s = options_.env->NewRandomAccessFile(fname, &file_);
+    }
+    if (s.ok()) {
+      file_->Hint(pattern);
+      s = ReadFileHeader();
+    }
+    if (s.ok()) {
+      VTableProperties properties;
+      if (ReadProperties(&properties).ok() &&
+          !properties.compression_dict.empty()) {
+        const std::string& dict = properties.compression_dict;
+        dict_.reset(new port::ZstdDictionary(dict.data(), dict.size()));
+      }
     }
     return s;
   }
 
-  Status VTableReader::Get(const VTableHandle& handle,
-                           VTableRecord* record) const {
-    auto buf = new char[handle.size];
+  Status VTableReader::ReadFileHeader() {
+    char header[kVTableFileHeaderSize];
     Slice input;
-    Status s;
-    if (file_ != nullptr) {
-      s = file_->Read(handle.offset, handle.size, &input, buf);
+    Status s = Read(0, kVTableFileHeaderSize, &input, header);
+    if (!s.ok()) {
+      return s;
+    }
+    if (input.empty()) {
+      // A value log nothing has been flushed to yet
+      format_version_ = kCurrentVTableFormat;
+    } else if (input.size() < kVTableFileHeaderSize ||
+               DecodeFixed32(input.data()) != kVTableFileMark) {
+      format_version_ = kLegacyVTableFormat;
     } else {
-      s = Status::TimeOutRead("Get for another time");
+      format_version_ = DecodeFixed32(input.data() + 4);
+      if (format_version_ == kLegacyVTableFormat ||
+          format_version_ > kCurrentVTableFormat) {
+        return Status::NotSupported("unknown vtable format version", fname_);
+      }
     }
+    return Status::OK();
+  }
 
+  Status VTableReader::Get(const VTableHandle& handle, VTableRecord* record,
+                           char* scratch, std::string* buffer,
+                           bool verify_checksum) const {
+    Slice input;
+    Status s = Read(handle.offset, handle.size, &input, scratch);
     if (!s.ok()) {
       return s;
     }
@@ -33,22 +69,109 @@ namespace leveldb {
                                 std::to_string(input.size()) + ":" +
                                 std::to_string(handle.size));
     }
+    return ParseRecord(input, record, buffer, verify_checksum);
+  }
+
+  Status VTableReader::Read(uint64_t offset, size_t n, Slice* result,
+                            char* scratch) const {
+    if (file_ == nullptr) {
+      return Status::TimeOutRead("Get for another time");
+    }
+    return file_->Read(offset, n, result, scratch);
+  }
+
+  Status VTableReader::ReadRecord(uint64_t offset, uint64_t limit,
+                                  VTableHandle* handle,
+                                  VTableRecord* record, std::string* scratch,
+                                  std::string* buffer) const {
+    const uint64_t header_size = RecordHeaderSize(format_version_);
+    char header[kRecordHeaderSize];
+    Slice input;
+    Status s = Read(offset, header_size, &input, header);
+    if (!s.ok()) {
+      return s;
+    }
+    if (input.size() != header_size) {
+      return Status::Corruption("truncated vtable record", fname_);
+    }
+    handle->offset = offset;
+    handle->size = header_size + DecodeFixed32(input.data());
+    if (handle->size > limit - offset) {
+      return Status::Corruption("vtable record past end of data", fname_);
+    }
+    scratch->resize(handle->size);
+    return Get(*handle, record, &(*scratch)[0], buffer,
+               /*verify_checksum=*/true);
+  }
+
+  Status VTableReader::ReadProperties(VTableProperties* properties) const {
+    if (format_version_ == kLegacyVTableFormat) {
+      return Status::NotFound("legacy vtable without footer", fname_);
+    }
+    uint64_t file_size;
+    Status s = options_.env->GetFileSize(fname_, &file_size);
+    if (!s.ok()) {
+      return s;
+    }
+    if (file_size < VTableFooter::kEncodedLength) {
+      return Status::NotFound("not a vtable with footer", fname_);
+    }
 
-    RecordDecoder decoder;
-    s = decoder.DecodeHeader(&input);
+    char footer_space[VTableFooter::kEncodedLength];
+    Slice input;
+    s = Read(file_size - VTableFooter::kEncodedLength,
+             VTableFooter::kEncodedLength, &input, footer_space);
+    if (!s.ok()) {
+      return s;
+    }
+    VTableFooter footer;
+    s = footer.Decode(&input);
     if (!s.ok()) {
       return s;
     }
+    if (footer.properties_offset + footer.properties_size +
+            VTableFooter::kEncodedLength != file_size) {
+      return Status::Corruption("bad vtable footer", fname_);
+    }
 
-    s = decoder.DecodeRecord(&input, record);
+    std::string scratch(footer.properties_size, '\0');
+    s = Read(footer.properties_offset, footer.properties_size, &input,
+             &scratch[0]);
+    if (!s.ok()) {
+      return s;
+    }
+    if (input.size() != footer.properties_size ||
+        crc32c::Unmask(footer.properties_crc) !=
+            crc32c::Value(input.data(), input.size())) {
+      return Status::Corruption("vtable properties checksum mismatch",
+                                fname_);
+    }
+    s = DecodeSrcIntoObj(input, properties);
+    if (s.ok() && (properties->data_size != footer.properties_offset ||
+                   properties->format_version != format_version_)) {
+      s = Status::Corruption("bad vtable properties", fname_);
+    }
     return s;
   }
 
+  Status VTableReader::ParseRecord(Slice input, VTableRecord* record,
+                                   std::string* buffer,
+                                   bool verify_checksum) const {
+    RecordDecoder decoder(format_version_);
+    Status s = decoder.DecodeHeader(&input);
+    if (!s.ok()) {
+      return s;
+    }
+    if (decoder.GetDecodedSize() != input.size()) {
+      return Status::Corruption("Record size mismatch");
+    }
+    return decoder.DecodeRecord(&input, record, buffer, verify_checksum,
+                                dict_.get());
+  }
+
   void VTableReader::Close() {
+    delete file_;
     file_ = nullptr;
-    if (manager_ != nullptr) {
-      manager_->UnrefVTable(fnum_);
-    }
   }
 
 } // namespace leveldb
\ No newline at end of file
@@ -19,21 +19,78 @@ class VTableReader {
   public:
     VTableReader() = default;
 
-    VTableReader(uint64_t fnum, VTableManager *manager) :
-      fnum_(fnum),
-      manager_(manager) {};
+    explicit VTableReader(uint64_t fnum) : fnum_(fnum) {}
 
-    Status Open(const Options& options, std::string fname);
+    VTableReader(const VTableReader&) = delete;
+    VTableReader& operator=(const VTableReader&) = delete;
 
-    Status Get(const VTableHandle& handle,
-               VTableRecord* record) const ;
+    ~VTableReader() { delete file_; }
 
+    // Open the vtable "fname".  If "use_mmap" is set the file is read
+    // through a memory mapping, which is only safe for sealed vtables.
+    // "pattern" tells the file how it is going to be read.  The zstd
+    // dictionary of the vtable, if any, is loaded once here, and so is the
+    // format version from the file header.  A vtable without the header
+    // was written in the legacy format.
+    Status Open(const Options& options, std::string fname,
+                bool use_mmap = false,
+                RandomAccessFile::AccessPattern pattern =
+                    RandomAccessFile::kRandom);
+
+    // Read the record at "handle".  "scratch" must hold at least
+    // handle.size bytes.  On success the key in *record points either
+    // into scratch or into memory owned by the file (e.g. an mmap region),
+    // so it stays valid as long as both scratch and this reader do.  The
+    // value does too, unless it was compressed: then it is uncompressed
+    // into "buffer".  The record checksum is verified if
+    // "verify_checksum" is set and the vtable is not legacy, whose
+    // records carry none.
+    Status Get(const VTableHandle& handle, VTableRecord* record,
+               char* scratch, std::string* buffer,
+               bool verify_checksum) const;
+
+    // Read "n" raw bytes starting at "offset", which may span several
+    // records.  Same contract as RandomAccessFile::Read.
+    Status Read(uint64_t offset, size_t n, Slice* result, char* scratch) const;
+
+    // Read the record starting at "offset" without knowing its size, as
+    // a sequential scan of the data ending at "limit" does.  *handle is
+    // set to where the record lies.  The checksum is always verified.
+    Status ReadRecord(uint64_t offset, uint64_t limit, VTableHandle* handle,
+                      VTableRecord* record, std::string* scratch,
+                      std::string* buffer) const;
+
+    // Read the properties from the footer of the vtable.  Returns NotFound
+    // for a vtable without footer: a legacy vtable or a value log, whose
+    // records then run from DataOffset() to the end of the file.
+    Status ReadProperties(VTableProperties* properties) const;
+
+    // Format version of the vtable, see VTableFormatVersion
+    uint32_t FormatVersion() const { return format_version_; }
+
+    // Offset of the first record, past the file header if there is one
+    uint64_t DataOffset() const {
+      return format_version_ == kLegacyVTableFormat ? 0
+                                                    : kVTableFileHeaderSize;
+    }
+
+    // Decode the record whose encoded form, header included, is exactly
+    // "input".  A compressed value is uncompressed into "buffer".
+    Status ParseRecord(Slice input, VTableRecord* record, std::string* buffer,
+                       bool verify_checksum) const;
+
+    // Close the file and drop the reference taken on the vtable by Open
     void Close();
   private:
+    // Set format_version_ from the file header
+    Status ReadFileHeader();
+
     Options options_;
+    std::string fname_;
     uint64_t fnum_;
     RandomAccessFile* file_{nullptr};
-    VTableManager* manager_{nullptr};
+    uint32_t format_version_{kCurrentVTableFormat};
+    std::unique_ptr<port::ZstdDictionary> dict_;
 };
 
 } // namespace leveldb
@@ -0,0 +1,304 @@
+#include "table/zone_map.h"
+
+#include <algorithm>
+#include <cassert>
+
+#include "db/dbformat.h"
+#include "db/fields.h"
+#include "leveldb/field_predicate.h"
+#include "leveldb/iterator.h"
+#include "table/format.h"
+#include "table/vtable_format.h"
+#include "util/coding.h"
+
+namespace leveldb {
+
+const char kZoneMapKey[] = "zonemap";
+
+void ZoneMapBuilder::Bounds::Add(const Slice& value) {
+  if (state == kEmpty) {
+    state = kBounded;
+    smallest.assign(value.data(), value.size());
+    largest.assign(value.data(), value.size());
+  } else if (state == kBounded) {
+    if (value.compare(smallest) < 0) {
+      smallest.assign(value.data(), value.size());
+    } else if (value.compare(largest) > 0) {
+      largest.assign(value.data(), value.size());
+    }
+  }
+}
+
+void ZoneMapBuilder::Bounds::Merge(const Bounds& other) {
+  if (other.state == kEmpty || state == kUnbounded) {
+    return;
+  }
+  if (other.state == kUnbounded) {
+    state = kUnbounded;
+  } else {
+    Add(other.smallest);
+    Add(other.largest);
+  }
+}
+
+ZoneMapBuilder::ZoneMapBuilder(const std::vector<std::string>& field_names)
+    : field_names_(field_names),
+      block_bounds_(field_names.size()),
+      table_bounds_(field_names.size()),
+      block_empty_(true),
+      has_pending_(false),
+      pending_offset_(0),
+      num_blocks_(0) {}
+
+void ZoneMapBuilder::AddEntry(const Slice& key, const Slice& value) {
+  enum Type : unsigned char {
+    kNonIndexValue = 2,
+  };
+  const Slice user_key = ExtractUserKey(key);
+  if (block_empty_) {
+    if (has_pending_ && user_key == Slice(last_user_key_)) {
+      for (Bounds& bounds : pending_bounds_) {
+        bounds.state = kUnbounded;
+      }
+    }
+    EncodePendingBlock();
+    block_empty_ = false;
+  }
+  last_user_key_.assign(user_key.data(), user_key.size());
+
+  if (value.empty()) {
+    return;  // A deletion, it has no fields
+  }
+  const unsigned char type = static_cast<unsigned char>(value[0]);
+  Slice fields;
+  FieldsIndex fields_index;
+  Slice input = value;
+  if (type == kNonIndexValue) {
+    fields = Slice(value.data() + 1, value.size() - 1);
+  } else if (type == FieldsIndex::kFieldsIndex &&
+             fields_index.Decode(&input).ok()) {
+    fields = fields_index.inline_fields;
+  } else {
+    // Stored in a VTable as a whole
+    for (Bounds& bounds : block_bounds_) {
+      bounds.state = kUnbounded;
+    }
+    return;
+  }
+  Slice field_value;
+  for (size_t i = 0; i < field_names_.size(); i++) {
+    if (type == FieldsIndex::kFieldsIndex &&
+        fields_index.IsSeparated(field_names_[i])) {
+      block_bounds_[i].state = kUnbounded;
+    } else if (FindField(fields, field_names_[i], &field_value)) {
+      block_bounds_[i].Add(field_value);
+    }
+  }
+}
+
+void ZoneMapBuilder::FinishBlock(uint64_t block_offset) {
+  if (block_empty_) {
+    return;
+  }
+  for (size_t i = 0; i < field_names_.size(); i++) {
+    table_bounds_[i].Merge(block_bounds_[i]);
+  }
+  pending_bounds_.swap(block_bounds_);
+  block_bounds_.assign(field_names_.size(), Bounds());
+  pending_offset_ = block_offset;
+  has_pending_ = true;
+  block_empty_ = true;
+}
+
+void ZoneMapBuilder::EncodePendingBlock() {
+  if (!has_pending_) {
+    return;
+  }
+  PutVarint64(&blocks_, pending_offset_);
+  EncodeBounds(pending_bounds_, &blocks_);
+  num_blocks_++;
+  has_pending_ = false;
+}
+
+void ZoneMapBuilder::EncodeBounds(const std::vector<Bounds>& bounds,
+                                  std::string* dst) {
+  for (const Bounds& b : bounds) {
+    dst->push_back(b.state);
+    if (b.state == kBounded) {
+      PutLengthPrefixedSlice(dst, b.smallest);
+      PutLengthPrefixedSlice(dst, b.largest);
+    }
+  }
+}
+
+Slice ZoneMapBuilder::Finish() {
+  EncodePendingBlock();
+  result_.clear();
+  PutVarint32(&result_, field_names_.size());
+  for (const std::string& name : field_names_) {
+    PutLengthPrefixedSlice(&result_, name);
+  }
+  PutVarint32(&result_, num_blocks_);
+  result_.append(blocks_);
+  EncodeBounds(table_bounds_, &result_);
+  return Slice(result_);
+}
+
+ZoneMapReader::ZoneMapReader(const Slice& contents) : ok_(false) {
+  Slice input = contents;
+  uint32_t num_fields, num_blocks;
+  if (!GetVarint32(&input, &num_fields) || num_fields > input.size()) {
+    return;
+  }
+  field_names_.resize(num_fields);
+  for (Slice& name : field_names_) {
+    if (!GetLengthPrefixedSlice(&input, &name)) {
+      return;
+    }
+  }
+  // Every data block takes a byte at least
+  if (!GetVarint32(&input, &num_blocks) || num_blocks > input.size()) {
+    return;
+  }
+  block_offsets_.resize(num_blocks);
+  bounds_.resize((num_blocks + 1) * num_fields);
+  size_t pos = 0;
+  for (uint32_t b = 0; b <= num_blocks; b++) {
+    if (b < num_blocks && !GetVarint64(&input, &block_offsets_[b])) {
+      return;
+    }
+    for (uint32_t i = 0; i < num_fields; i++) {
+      if (!DecodeBounds(&input, &bounds_[pos++])) {
+        return;
+      }
+    }
+  }
+  ok_ = true;
+}
+
+bool ZoneMapReader::DecodeBounds(Slice* input, Bounds* bounds) {
+  if (input->empty()) {
+    return false;
+  }
+  bounds->state = static_cast<unsigned char>((*input)[0]);
+  input->remove_prefix(1);
+  return bounds->state != 1 ||
+         (GetLengthPrefixedSlice(input, &bounds->smallest) &&
+          GetLengthPrefixedSlice(input, &bounds->largest));
+}
+
+int ZoneMapReader::FieldIndex(const FieldPredicate& predicate) const {
+  for (size_t i = 0; i < field_names_.size(); i++) {
+    if (field_names_[i] == predicate.field_name()) {
+      return static_cast<int>(i);
+    }
+  }
+  return -1;
+}
+
+bool ZoneMapReader::MayMatch(const Bounds& bounds,
+                             const FieldPredicate& predicate) const {
+  switch (bounds.state) {
+    case 0:  // No value
+      return false;
+    case 1:
+      return predicate.MayMatch(bounds.smallest, bounds.largest);
+    default:
+      return true;
+  }
+}
+
+bool ZoneMapReader::TableMayMatch(const FieldPredicate& predicate) const {
+  const int field = ok_ ? FieldIndex(predicate) : -1;
+  if (field < 0) {
+    return true;
+  }
+  return MayMatch(bounds_[block_offsets_.size() * field_names_.size() + field],
+                  predicate);
+}
+
+bool ZoneMapReader::BlockMayMatch(uint64_t block_offset,
+                                  const FieldPredicate& predicate) const {
+  const int field = ok_ ? FieldIndex(predicate) : -1;
+  if (field < 0) {
+    return true;
+  }
+  auto pos = std::lower_bound(block_offsets_.begin(), block_offsets_.end(),
+                              block_offset);
+  if (pos == block_offsets_.end() || *pos != block_offset) {
+    return true;
+  }
+  const size_t block = pos - block_offsets_.begin();
+  return MayMatch(bounds_[block * field_names_.size() + field], predicate);
+}
+
+namespace {
+
+class ZoneMapIterator : public Iterator {
+ public:
+  ZoneMapIterator(Iterator* index_iter, const ZoneMapReader* zone_map,
+                  const FieldPredicate* predicate)
+      : iter_(index_iter), zone_map_(zone_map), predicate_(predicate) {}
+
+  ~ZoneMapIterator() override { delete iter_; }
+
+  bool Valid() const override { return iter_->Valid(); }
+  void Seek(const Slice& target) override {
+    iter_->Seek(target);
+    SkipForward();
+  }
+  void SeekToFirst() override {
+    iter_->SeekToFirst();
+    SkipForward();
+  }
+  void SeekToLast() override {
+    iter_->SeekToLast();
+    SkipBackward();
+  }
+  void Next() override {
+    iter_->Next();
+    SkipForward();
+  }
+  void Prev() override {
+    iter_->Prev();
+    SkipBackward();
+  }
+  Slice key() const override { return iter_->key(); }
+  Slice value() const override { return iter_->value(); }
+  Fields fields() const override { assert(false); }
+  Status status() const override { return iter_->status(); }
+
+ private:
+  bool BlockMayMatch() const {
+    Slice input = iter_->value();
+    BlockHandle handle;
+    return !handle.DecodeFrom(&input).ok() ||
+           zone_map_->BlockMayMatch(handle.offset(), *predicate_);
+  }
+
+  void SkipForward() {
+    while (iter_->Valid() && !BlockMayMatch()) {
+      iter_->Next();
+    }
+  }
+
+  void SkipBackward() {
+    while (iter_->Valid() && !BlockMayMatch()) {
+      iter_->Prev();
+    }
+  }
+
+  Iterator* const iter_;
+  const ZoneMapReader* const zone_map_;
+  const FieldPredicate* const predicate_;
+};
+
+}  // namespace
+
+Iterator* NewZoneMapIterator(Iterator* index_iter,
+                             const ZoneMapReader* zone_map,
+                             const FieldPredicate* predicate) {
+  return new ZoneMapIterator(index_iter, zone_map, predicate);
+}
+
+}  // namespace leveldb
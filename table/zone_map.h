@@ -0,0 +1,138 @@
+// A zone map block is stored near the end of a Table file, next to the
+// filter block.  For every data block, and for the table as a whole, it
+// holds the smallest and the largest value of each field named in
+// Options::zone_map_fields.  A scan with a FieldPredicate on one of them
+// can then pass over the blocks, or the whole table, that cannot hold a
+// match.
+//
+// The block is made of:
+//    varint32 number of fields, then each name length prefixed
+//    varint32 number of data blocks
+//    per data block: varint64 offset, then the bounds of each field
+//    the bounds of each field for the whole table
+// where bounds are a state byte followed, if kBounded, by the length
+// prefixed smallest and largest value.
+
+#ifndef STORAGE_LEVELDB_TABLE_ZONE_MAP_H_
+#define STORAGE_LEVELDB_TABLE_ZONE_MAP_H_
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "leveldb/slice.h"
+
+namespace leveldb {
+
+class FieldPredicate;
+class Iterator;
+
+// Key of the zone map block in the meta index block
+extern const char kZoneMapKey[];
+
+// A ZoneMapBuilder collects the bounds of the fields of a Table.
+//
+// The sequence of calls to ZoneMapBuilder must match the regexp:
+//      (AddEntry* FinishBlock)* Finish
+class ZoneMapBuilder {
+ public:
+  explicit ZoneMapBuilder(const std::vector<std::string>& field_names);
+
+  ZoneMapBuilder(const ZoneMapBuilder&) = delete;
+  ZoneMapBuilder& operator=(const ZoneMapBuilder&) = delete;
+
+  // Add the entry with internal key "key" and raw value "value" to the
+  // current data block.
+  void AddEntry(const Slice& key, const Slice& value);
+  // The current data block was written at "block_offset".
+  void FinishBlock(uint64_t block_offset);
+  Slice Finish();
+
+ private:
+  enum State : unsigned char {
+    kEmpty = 0,      // No value seen
+    kBounded = 1,    // Every value lies in [smallest, largest]
+    kUnbounded = 2,  // Some value is unknown, e.g. stored in a VTable
+  };
+
+  struct Bounds {
+    State state = kEmpty;
+    std::string smallest;
+    std::string largest;
+
+    void Add(const Slice& value);
+    void Merge(const Bounds& other);
+  };
+
+  static void EncodeBounds(const std::vector<Bounds>& bounds,
+                           std::string* dst);
+  // Append the previous data block to blocks_
+  void EncodePendingBlock();
+
+  const std::vector<std::string> field_names_;
+  std::vector<Bounds> block_bounds_;  // Of the current data block
+  std::vector<Bounds> table_bounds_;
+  bool block_empty_;
+  std::string last_user_key_;  // Of the last entry added
+
+  // The previous data block is only encoded once the next one starts:
+  // if its last user key goes on there, skipping it could expose older
+  // entries of that key, so it gets unbounded.
+  bool has_pending_;
+  uint64_t pending_offset_;
+  std::vector<Bounds> pending_bounds_;
+
+  uint32_t num_blocks_;
+  std::string blocks_;  // Encoded data blocks
+  std::string result_;
+};
+
+class ZoneMapReader {
+ public:
+  // REQUIRES: "contents" stays live while *this is live.
+  explicit ZoneMapReader(const Slice& contents);
+
+  ZoneMapReader(const ZoneMapReader&) = delete;
+  ZoneMapReader& operator=(const ZoneMapReader&) = delete;
+
+  // Return false if the zone map is corrupted.
+  bool ok() const { return ok_; }
+
+  // Return false only if no entry of the table satisfies "predicate".
+  bool TableMayMatch(const FieldPredicate& predicate) const;
+
+  // Return false only if no entry of the data block at "block_offset"
+  // satisfies "predicate".
+  bool BlockMayMatch(uint64_t block_offset,
+                     const FieldPredicate& predicate) const;
+
+ private:
+  struct Bounds {
+    unsigned char state;
+    Slice smallest;
+    Slice largest;
+  };
+
+  bool DecodeBounds(Slice* input, Bounds* bounds);
+  // Index of the field "predicate" tests, or -1 if it has no bounds
+  int FieldIndex(const FieldPredicate& predicate) const;
+  bool MayMatch(const Bounds& bounds, const FieldPredicate& predicate) const;
+
+  bool ok_;
+  std::vector<Slice> field_names_;
+  std::vector<uint64_t> block_offsets_;
+  // Bounds of field i of data block b at [b * field_names_.size() + i],
+  // those of the table at [block_offsets_.size() * field_names_.size() + i]
+  std::vector<Bounds> bounds_;
+};
+
+// Return an iterator over the entries of "index_iter", an index block
+// iterator, that skips the data blocks "zone_map" rules out for
+// "predicate".  Takes ownership of "index_iter".
+Iterator* NewZoneMapIterator(Iterator* index_iter,
+                             const ZoneMapReader* zone_map,
+                             const FieldPredicate* predicate);
+
+}  // namespace leveldb
+
+#endif  // STORAGE_LEVELDB_TABLE_ZONE_MAP_H_
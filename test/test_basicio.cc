@@ -1,6 +1,12 @@
+#include <algorithm>
+#include <atomic>
+#include <thread>
+
 #include "gtest/gtest.h"
 #include "leveldb/env.h"
 #include "leveldb/db.h"
+#include "leveldb/separation_policy.h"
+#include "leveldb/write_batch.h"
 using namespace leveldb;
 
 constexpr int value_size = 2048;
@@ -44,6 +50,10 @@ TEST(TestBasicIO, PointGet) {
     std::string value;
     db->Get(readOptions, iter->first, &value);
     ASSERT_TRUE(value == iter->second);
+
+    PinnableSlice pinned;
+    ASSERT_TRUE(db->Get(readOptions, iter->first, &pinned).ok());
+    ASSERT_TRUE(pinned == iter->second);
   }
 
   delete db;
@@ -69,6 +79,1058 @@ TEST(TestBasicIO, RangeQuery) {
   }
 }
 
+TEST(TestBasicIO, PrefetchRangeQuery) {
+  DB *db;
+  if(OpenDB("testdb_prefetch", &db).ok() == false) {
+    std::cerr << "open db failed" << std::endl;
+    abort();
+  }
+
+  // Distinct values, so that records sliced out of a merged read are
+  // told apart
+  std::map<std::string, std::string> expected;
+  WriteOptions writeOptions;
+  for (int i = 0; i < 4096; i++) {
+    std::string key = std::to_string(i);
+    std::string value(value_size, 'a' + i % 26);
+    value.replace(0, key.size(), key);
+    ASSERT_TRUE(db->Put(writeOptions, key, value).ok());
+    expected[key] = value;
+  }
+
+  ReadOptions readOptions;
+  readOptions.prefetch_values = 16;
+  auto iter = db->NewIterator(readOptions);
+  auto it = expected.begin();
+  for (iter->SeekToFirst(); iter->Valid(); iter->Next(), ++it) {
+    ASSERT_TRUE(it != expected.end());
+    ASSERT_EQ(iter->key().ToString(), it->first);
+    ASSERT_EQ(iter->fields()["1"], it->second);
+  }
+  ASSERT_TRUE(it == expected.end());
+
+  // Change direction in the middle of a prefetched batch
+  iter->Seek("2000");
+  iter->Next();
+  ASSERT_EQ(iter->key().ToString(), "2001");
+  iter->Prev();
+  ASSERT_EQ(iter->key().ToString(), "2000");
+  iter->Next();
+  iter->Next();
+  ASSERT_EQ(iter->key().ToString(), "2002");
+  ASSERT_EQ(iter->fields()["1"], expected["2002"]);
+
+  delete iter;
+  delete db;
+}
+
+TEST(TestBasicIO, IteratorReportsLostValues) {
+  Options options;
+  options.create_if_missing = true;
+  DestroyDB("testdb_lost_values", options);
+  DB *db;
+  ASSERT_TRUE(DB::Open(options, "testdb_lost_values", &db).ok());
+  WriteOptions writeOptions;
+  for (int i = 0; i < 100; i++) {
+    std::string value(value_size, 'a' + i % 26);
+    ASSERT_TRUE(db->Put(writeOptions, std::to_string(i), value).ok());
+  }
+  db->CompactRange(nullptr, nullptr);
+  delete db;
+
+  std::vector<std::string> children;
+  Env::Default()->GetChildren("testdb_lost_values", &children);
+  for (const auto& child : children) {
+    if (child.size() > 4 && child.compare(child.size() - 4, 4, ".vtb") == 0) {
+      ASSERT_TRUE(
+          Env::Default()->RemoveFile("testdb_lost_values/" + child).ok());
+    }
+  }
+  ASSERT_TRUE(DB::Open(options, "testdb_lost_values", &db).ok());
+
+  // With and without prefetching, the values that cannot be read show up
+  // in status()
+  for (int prefetch : {0, 16}) {
+    ReadOptions readOptions;
+    readOptions.prefetch_values = prefetch;
+    Iterator *iter = db->NewIterator(readOptions);
+    int count = 0;
+    for (iter->SeekToFirst(); iter->Valid(); iter->Next(), count++) {
+      ASSERT_TRUE(iter->fields()["1"].empty());
+    }
+    ASSERT_EQ(count, 100);
+    ASSERT_FALSE(iter->status().ok()) << prefetch;
+    delete iter;
+  }
+  delete db;
+  DestroyDB("testdb_lost_values", options);
+}
+
+TEST(TestBasicIO, KeysOnlyIteration) {
+  Options options;
+  options.create_if_missing = true;
+  // Flush early so that most values end up separated
+  options.write_buffer_size = 64 << 10;
+  DB *db;
+  ASSERT_TRUE(DB::Open(options, "testdb_keysonly", &db).ok());
+
+  std::map<std::string, uint64_t> expected;
+  WriteOptions writeOptions;
+  for (int i = 0; i < 1024; i++) {
+    std::string key = std::to_string(i);
+    std::string value(value_size + i, 'x');
+    ASSERT_TRUE(db->Put(writeOptions, key, value).ok());
+    Fields fields;
+    fields["1"] = value;
+    expected[key] = fields.Serialize().size();
+  }
+
+  ReadOptions readOptions;
+  readOptions.keys_only = true;
+  auto iter = db->NewIterator(readOptions);
+  int separated = 0;
+  auto it = expected.begin();
+  for (iter->SeekToFirst(); iter->Valid(); iter->Next(), ++it) {
+    ASSERT_TRUE(it != expected.end());
+    ASSERT_EQ(iter->key().ToString(), it->first);
+    ASSERT_EQ(iter->value_size(), it->second);
+    ASSERT_EQ(iter->fields().size(), 0);
+    uint64_t file_number, offset, size;
+    if (iter->value_handle(&file_number, &offset, &size)) {
+      ASSERT_GT(size, iter->value_size());
+      separated++;
+    }
+  }
+  ASSERT_TRUE(it == expected.end());
+  ASSERT_GT(separated, 0);
+
+  delete iter;
+  delete db;
+}
+
+TEST(TestBasicIO, MultiGet) {
+  Options options;
+  options.create_if_missing = true;
+  options.write_buffer_size = 64 << 10;
+  DB *db;
+  ASSERT_TRUE(DB::Open(options, "testdb_multiget", &db).ok());
+
+  WriteOptions writeOptions;
+  for (int i = 0; i < 512; i++) {
+    std::string key = std::to_string(i);
+    std::string value(value_size, 'a' + i % 26);
+    value.replace(0, key.size(), key);
+    ASSERT_TRUE(db->Put(writeOptions, key, value).ok());
+  }
+  // A small value that stays inline
+  ASSERT_TRUE(db->Put(writeOptions, "small", "tiny").ok());
+
+  std::vector<Slice> keys = {"7", "300", "missing", "small", "7", "511"};
+  std::vector<std::string> values;
+  std::vector<Status> statuses = db->MultiGet(ReadOptions(), keys, &values);
+  ASSERT_EQ(statuses.size(), keys.size());
+  ASSERT_EQ(values.size(), keys.size());
+  for (size_t i = 0; i < keys.size(); i++) {
+    std::string expected;
+    Status s = db->Get(ReadOptions(), keys[i], &expected);
+    ASSERT_EQ(statuses[i].ok(), s.ok());
+    ASSERT_EQ(statuses[i].IsNotFound(), s.IsNotFound());
+    ASSERT_EQ(values[i], expected);
+  }
+  ASSERT_TRUE(statuses[2].IsNotFound());
+  ASSERT_EQ(values[3], "tiny");
+
+  std::vector<Fields> fields;
+  statuses = db->MultiGet(ReadOptions(), keys, &fields);
+  ASSERT_EQ(fields[1]["1"], values[1]);
+  ASSERT_EQ(fields[5]["1"], values[5]);
+
+  delete db;
+}
+
+// Total size of the vtable files of "dbname"
+uint64_t VTableBytes(const std::string& dbname) {
+  Env* env = Env::Default();
+  std::vector<std::string> children;
+  env->GetChildren(dbname, &children);
+  uint64_t total = 0;
+  for (const auto& child : children) {
+    if (child.size() > 4 && child.substr(child.size() - 4) == ".vtb") {
+      uint64_t size = 0;
+      if (env->GetFileSize(dbname + "/" + child, &size).ok()) {
+        total += size;
+      }
+    }
+  }
+  return total;
+}
+
+TEST(TestBasicIO, GarbageCollect) {
+  Options options;
+  options.create_if_missing = true;
+  options.write_buffer_size = 64 << 10;
+  options.gc_size_threshold = 0;
+  options.gc_garbage_ratio = 0.3;
+  DestroyDB("testdb_gc", options);
+  DB *db;
+  ASSERT_TRUE(DB::Open(options, "testdb_gc", &db).ok());
+
+  // Overwrite every other key a few times, so that most vtables hold a
+  // mix of live and dead records
+  std::map<std::string, std::string> expected;
+  WriteOptions writeOptions;
+  for (int round = 0; round < 4; round++) {
+    for (int i = 0; i < 1024; i++) {
+      if (round > 0 && i % 2 == 0) continue;
+      std::string key = std::to_string(i);
+      std::string value(value_size, 'a' + (i + round) % 26);
+      value.replace(0, key.size(), key);
+      ASSERT_TRUE(db->Put(writeOptions, key, value).ok());
+      expected[key] = value;
+    }
+  }
+  db->CompactRange(nullptr, nullptr);
+
+  const uint64_t live_bytes = 1024 * value_size;
+  for (int i = 0; i < 100 && VTableBytes("testdb_gc") > 2 * live_bytes; i++) {
+    Env::Default()->SleepForMicroseconds(100000);
+  }
+  ASSERT_LE(VTableBytes("testdb_gc"), 2 * live_bytes);
+
+  for (const auto& kv : expected) {
+    std::string value;
+    ASSERT_TRUE(db->Get(ReadOptions(), kv.first, &value).ok());
+    ASSERT_EQ(value, kv.second);
+  }
+  delete db;
+
+  // The repointed keys survive a reopen
+  ASSERT_TRUE(DB::Open(options, "testdb_gc", &db).ok());
+  for (const auto& kv : expected) {
+    std::string value;
+    ASSERT_TRUE(db->Get(ReadOptions(), kv.first, &value).ok());
+    ASSERT_EQ(value, kv.second);
+  }
+  delete db;
+}
+
+TEST(TestBasicIO, GarbageCollectUnderIterator) {
+  Options options;
+  options.create_if_missing = true;
+  options.write_buffer_size = 64 << 10;
+  options.gc_size_threshold = 0;
+  options.gc_garbage_ratio = 0.3;
+  DestroyDB("testdb_gc_iter", options);
+  DB *db;
+  ASSERT_TRUE(DB::Open(options, "testdb_gc_iter", &db).ok());
+
+  std::map<std::string, std::string> expected;
+  WriteOptions writeOptions;
+  for (int round = 0; round < 4; round++) {
+    for (int i = 0; i < 1024; i++) {
+      if (round > 0 && i % 2 == 0) continue;
+      std::string key = std::to_string(i);
+      std::string value(value_size, 'a' + (i + round) % 26);
+      ASSERT_TRUE(db->Put(writeOptions, key, value).ok());
+      expected[key] = value;
+    }
+  }
+  // The iterator pins its sequence before gc relocates any record
+  Iterator *iter = db->NewIterator(ReadOptions());
+  std::string before;
+  ASSERT_TRUE(db->GetProperty("leveldb.vtables", &before));
+  db->CompactRange(nullptr, nullptr);
+  std::string after = before;
+  for (int i = 0; i < 100 && after == before; i++) {
+    Env::Default()->SleepForMicroseconds(100000);
+    ASSERT_TRUE(db->GetProperty("leveldb.vtables", &after));
+  }
+
+  // The relocated vtables are kept for the iterator
+  auto it = expected.begin();
+  for (iter->SeekToFirst(); iter->Valid(); iter->Next(), ++it) {
+    ASSERT_TRUE(it != expected.end());
+    ASSERT_EQ(iter->key().ToString(), it->first);
+    ASSERT_EQ(iter->fields()["1"], it->second);
+  }
+  ASSERT_TRUE(iter->status().ok());
+  ASSERT_TRUE(it == expected.end());
+  delete iter;
+
+  // and dropped once it is gone
+  const uint64_t live_bytes = 1024 * value_size;
+  for (int i = 0; i < 100 && VTableBytes("testdb_gc_iter") > 2 * live_bytes;
+       i++) {
+    Env::Default()->SleepForMicroseconds(100000);
+  }
+  ASSERT_LE(VTableBytes("testdb_gc_iter"), 2 * live_bytes);
+  delete db;
+  DestroyDB("testdb_gc_iter", options);
+}
+
+TEST(TestBasicIO, OverwriteUnderIterator) {
+  Options options;
+  options.create_if_missing = true;
+  options.gc_size_threshold = 0;
+  DestroyDB("testdb_overwrite_iter", options);
+  DB *db;
+  ASSERT_TRUE(DB::Open(options, "testdb_overwrite_iter", &db).ok());
+
+  WriteOptions writeOptions;
+  for (int i = 0; i < 100; i++) {
+    std::string value(value_size, 'a' + i % 26);
+    ASSERT_TRUE(db->Put(writeOptions, std::to_string(i), value).ok());
+  }
+  db->CompactRange(nullptr, nullptr);
+
+  // Compacting the overwrites leaves the first vtable entirely garbage,
+  // it is kept as long as the iterator may read from it
+  Iterator *iter = db->NewIterator(ReadOptions());
+  for (int i = 0; i < 100; i++) {
+    std::string value(value_size, 'A' + i % 26);
+    ASSERT_TRUE(db->Put(writeOptions, std::to_string(i), value).ok());
+  }
+  db->CompactRange(nullptr, nullptr);
+  Env::Default()->SleepForMicroseconds(100000);
+  int count = 0;
+  for (iter->SeekToFirst(); iter->Valid(); iter->Next(), count++) {
+    const int i = std::stoi(iter->key().ToString());
+    ASSERT_EQ(iter->fields()["1"], std::string(value_size, 'a' + i % 26));
+  }
+  ASSERT_TRUE(iter->status().ok());
+  ASSERT_EQ(count, 100);
+  const uint64_t before = VTableBytes("testdb_overwrite_iter");
+  delete iter;
+
+  // and dropped once the iterator is gone
+  for (int i = 0; i < 100 && VTableBytes("testdb_overwrite_iter") >= before;
+       i++) {
+    Env::Default()->SleepForMicroseconds(100000);
+  }
+  ASSERT_LT(VTableBytes("testdb_overwrite_iter"), before);
+  for (int i = 0; i < 100; i++) {
+    std::string value;
+    ASSERT_TRUE(db->Get(ReadOptions(), std::to_string(i), &value).ok());
+    ASSERT_EQ(value, std::string(value_size, 'A' + i % 26));
+  }
+  delete db;
+  DestroyDB("testdb_overwrite_iter", options);
+}
+
+TEST(TestBasicIO, DroppedVTableAfterReopen) {
+  Options options;
+  options.create_if_missing = true;
+  options.gc_size_threshold = 0;
+  DestroyDB("testdb_dropped", options);
+  DB *db;
+  ASSERT_TRUE(DB::Open(options, "testdb_dropped", &db).ok());
+
+  WriteOptions writeOptions;
+  for (int round = 0; round < 2; round++) {
+    for (int i = 0; i < 100; i++) {
+      std::string value(value_size, 'a' + round);
+      ASSERT_TRUE(db->Put(writeOptions, std::to_string(i), value).ok());
+    }
+    db->CompactRange(nullptr, nullptr);
+  }
+  std::string live, garbage;
+  for (int i = 0; i < 100; i++) {
+    ASSERT_TRUE(db->GetProperty("leveldb.vtable-garbage-bytes", &garbage));
+    if (garbage == "0") break;
+    Env::Default()->SleepForMicroseconds(100000);
+  }
+  ASSERT_EQ(garbage, "0");
+  delete db;
+
+  // The dropped vtable must not come back from the MANIFEST
+  ASSERT_TRUE(DB::Open(options, "testdb_dropped", &db).ok());
+  std::string vtables;
+  ASSERT_TRUE(db->GetProperty("leveldb.vtables", &vtables));
+  ASSERT_EQ(vtables.find("invalid=100"), std::string::npos) << vtables;
+  ASSERT_TRUE(db->GetProperty("leveldb.vtable-live-bytes", &live));
+  ASSERT_TRUE(db->GetProperty("leveldb.vtable-garbage-bytes", &garbage));
+  ASSERT_EQ(std::stoull(live) + std::stoull(garbage),
+            VTableBytes("testdb_dropped"));
+  delete db;
+  DestroyDB("testdb_dropped", options);
+}
+
+TEST(TestBasicIO, VTableStats) {
+  Options options;
+  options.create_if_missing = true;
+  options.write_buffer_size = 64 << 10;
+  // Keep the garbage around to be counted
+  options.gc_garbage_ratio = 2;
+  DestroyDB("testdb_stats", options);
+  DB *db;
+  ASSERT_TRUE(DB::Open(options, "testdb_stats", &db).ok());
+
+  WriteOptions writeOptions;
+  for (int round = 0; round < 2; round++) {
+    for (int i = 0; i < 512; i++) {
+      std::string value(value_size * (round + 1), 'v');
+      ASSERT_TRUE(db->Put(writeOptions, std::to_string(i), value).ok());
+    }
+  }
+  db->CompactRange(nullptr, nullptr);
+
+  std::string live, garbage, stats;
+  ASSERT_TRUE(db->GetProperty("leveldb.vtable-live-bytes", &live));
+  ASSERT_TRUE(db->GetProperty("leveldb.vtable-garbage-bytes", &garbage));
+  ASSERT_TRUE(db->GetProperty("leveldb.vtable-stats", &stats));
+  ASSERT_NE(stats.find("Live bytes"), std::string::npos);
+  // Every vtable byte is either live or garbage, and the first round's
+  // values are garbage by now
+  ASSERT_EQ(std::stoull(live) + std::stoull(garbage),
+            VTableBytes("testdb_stats"));
+  ASSERT_GE(std::stoull(live), 512ull * 2 * value_size);
+  ASSERT_GT(std::stoull(garbage), 0);
+
+  delete db;
+}
+
+TEST(TestBasicIO, VTableMetaRecovery) {
+  Options options;
+  options.create_if_missing = true;
+  options.write_buffer_size = 64 << 10;
+  options.gc_garbage_ratio = 2;
+  DestroyDB("testdb_recovery", options);
+  DB *db;
+  ASSERT_TRUE(DB::Open(options, "testdb_recovery", &db).ok());
+
+  WriteOptions writeOptions;
+  for (int round = 0; round < 2; round++) {
+    for (int i = 0; i < 512; i++) {
+      std::string value(value_size, 'a' + round);
+      ASSERT_TRUE(db->Put(writeOptions, std::to_string(i), value).ok());
+    }
+  }
+  db->CompactRange(nullptr, nullptr);
+  std::string before;
+  ASSERT_TRUE(db->GetProperty("leveldb.vtables", &before));
+  ASSERT_FALSE(before.empty());
+  delete db;
+
+  // The vtables and their garbage are recovered from the MANIFEST
+  ASSERT_TRUE(DB::Open(options, "testdb_recovery", &db).ok());
+  std::string after;
+  ASSERT_TRUE(db->GetProperty("leveldb.vtables", &after));
+  ASSERT_EQ(before, after);
+  for (int i = 0; i < 512; i++) {
+    std::string value;
+    ASSERT_TRUE(db->Get(ReadOptions(), std::to_string(i), &value).ok());
+    ASSERT_EQ(value, std::string(value_size, 'b'));
+  }
+  delete db;
+}
+
+TEST(TestBasicIO, ManifestCheckpoint) {
+  Options options;
+  options.create_if_missing = true;
+  options.write_buffer_size = 64 << 10;
+  options.max_manifest_file_size = 4 << 10;
+  options.gc_garbage_ratio = 2;
+  DestroyDB("testdb_manifest", options);
+  DB *db;
+  ASSERT_TRUE(DB::Open(options, "testdb_manifest", &db).ok());
+
+  WriteOptions writeOptions;
+  for (int round = 0; round < 4; round++) {
+    for (int i = 0; i < 512; i++) {
+      std::string value(value_size, 'a' + round);
+      ASSERT_TRUE(db->Put(writeOptions, std::to_string(i), value).ok());
+    }
+  }
+  db->CompactRange(nullptr, nullptr);
+  std::string before;
+  ASSERT_TRUE(db->GetProperty("leveldb.vtables", &before));
+  delete db;
+
+  // Only the latest checkpoint survives, and it stays small
+  std::vector<std::string> children;
+  Env::Default()->GetChildren("testdb_manifest", &children);
+  int manifests = 0;
+  for (const auto& child : children) {
+    if (child.compare(0, 9, "MANIFEST-") == 0) {
+      uint64_t size;
+      ASSERT_TRUE(Env::Default()
+                      ->GetFileSize("testdb_manifest/" + child, &size)
+                      .ok());
+      ASSERT_LT(size, 64 << 10);
+      manifests++;
+    }
+  }
+  ASSERT_EQ(manifests, 1);
+
+  ASSERT_TRUE(DB::Open(options, "testdb_manifest", &db).ok());
+  std::string after;
+  ASSERT_TRUE(db->GetProperty("leveldb.vtables", &after));
+  ASSERT_EQ(before, after);
+  for (int i = 0; i < 512; i++) {
+    std::string value;
+    ASSERT_TRUE(db->Get(ReadOptions(), std::to_string(i), &value).ok());
+    ASSERT_EQ(value, std::string(value_size, 'd'));
+  }
+  delete db;
+}
+
+TEST(TestBasicIO, RepairVTables) {
+  Options options;
+  options.create_if_missing = true;
+  options.write_buffer_size = 64 << 10;
+  options.gc_garbage_ratio = 2;
+  DestroyDB("testdb_repair", options);
+  DB *db;
+  ASSERT_TRUE(DB::Open(options, "testdb_repair", &db).ok());
+
+  WriteOptions writeOptions;
+  for (int i = 0; i < 512; i++) {
+    std::string value(value_size, 'a' + i % 26);
+    ASSERT_TRUE(db->Put(writeOptions, std::to_string(i), value).ok());
+  }
+  delete db;
+
+  // Lose the MANIFEST, the vtables are found again from their footers
+  std::vector<std::string> children;
+  Env::Default()->GetChildren("testdb_repair", &children);
+  for (const auto& child : children) {
+    if (child.compare(0, 9, "MANIFEST-") == 0) {
+      ASSERT_TRUE(Env::Default()->RemoveFile("testdb_repair/" + child).ok());
+    }
+  }
+  ASSERT_TRUE(RepairDB("testdb_repair", options).ok());
+
+  ASSERT_TRUE(DB::Open(options, "testdb_repair", &db).ok());
+  std::string vtables;
+  ASSERT_TRUE(db->GetProperty("leveldb.vtables", &vtables));
+  ASSERT_FALSE(vtables.empty());
+  for (int i = 0; i < 512; i++) {
+    std::string value;
+    ASSERT_TRUE(db->Get(ReadOptions(), std::to_string(i), &value).ok());
+    ASSERT_EQ(value, std::string(value_size, 'a' + i % 26));
+  }
+  delete db;
+}
+
+TEST(TestBasicIO, SeparateOnWrite) {
+  Options options;
+  options.create_if_missing = true;
+  options.kv_sep_on_write = true;
+  DestroyDB("testdb_sep_on_write", options);
+  DB *db;
+  ASSERT_TRUE(DB::Open(options, "testdb_sep_on_write", &db).ok());
+
+  WriteOptions writeOptions;
+  for (int i = 0; i < 512; i++) {
+    std::string value(value_size, 'a' + i % 26);
+    ASSERT_TRUE(db->Put(writeOptions, std::to_string(i), value).ok());
+  }
+  ASSERT_TRUE(db->Put(writeOptions, "small", "value").ok());
+
+  // The log only holds the indexes of the large values
+  std::vector<std::string> children;
+  Env::Default()->GetChildren("testdb_sep_on_write", &children);
+  uint64_t log_size = 0;
+  for (const auto& child : children) {
+    if (child.size() > 4 && child.compare(child.size() - 4, 4, ".log") == 0) {
+      uint64_t size;
+      ASSERT_TRUE(
+          Env::Default()->GetFileSize("testdb_sep_on_write/" + child, &size)
+              .ok());
+      log_size += size;
+    }
+  }
+  ASSERT_LT(log_size, 512 * value_size / 10);
+  for (int i = 0; i < 512; i++) {
+    std::string value;
+    ASSERT_TRUE(db->Get(ReadOptions(), std::to_string(i), &value).ok());
+    ASSERT_EQ(value, std::string(value_size, 'a' + i % 26));
+  }
+  delete db;
+
+  // Replaying the log registers its value log as a vtable
+  ASSERT_TRUE(DB::Open(options, "testdb_sep_on_write", &db).ok());
+  std::string vtables;
+  ASSERT_TRUE(db->GetProperty("leveldb.vtables", &vtables));
+  ASSERT_FALSE(vtables.empty());
+  for (int i = 0; i < 512; i++) {
+    std::string value;
+    ASSERT_TRUE(db->Get(ReadOptions(), std::to_string(i), &value).ok());
+    ASSERT_EQ(value, std::string(value_size, 'a' + i % 26));
+  }
+
+  // Value logs sealed by memtable flushes survive compactions
+  for (int i = 0; i < 512; i++) {
+    std::string value(value_size, 'A' + i % 26);
+    ASSERT_TRUE(db->Put(writeOptions, std::to_string(i), value).ok());
+  }
+  db->CompactRange(nullptr, nullptr);
+  delete db;
+
+  options.kv_sep_on_write = false;
+  ASSERT_TRUE(DB::Open(options, "testdb_sep_on_write", &db).ok());
+  for (int i = 0; i < 512; i++) {
+    std::string value;
+    ASSERT_TRUE(db->Get(ReadOptions(), std::to_string(i), &value).ok());
+    ASSERT_EQ(value, std::string(value_size, 'A' + i % 26));
+  }
+  std::string value;
+  ASSERT_TRUE(db->Get(ReadOptions(), "small", &value).ok());
+  ASSERT_EQ(value, "value");
+  delete db;
+}
+
+TEST(TestBasicIO, TruncatedValueLog) {
+  Options options;
+  options.create_if_missing = true;
+  options.kv_sep_on_write = true;
+  DestroyDB("testdb_torn_vlog", options);
+  DB *db;
+  ASSERT_TRUE(DB::Open(options, "testdb_torn_vlog", &db).ok());
+  WriteOptions writeOptions;
+  for (int i = 0; i < 100; i++) {
+    std::string value(value_size, 'a' + i % 26);
+    ASSERT_TRUE(db->Put(writeOptions, std::to_string(1000 + i), value).ok());
+  }
+  ASSERT_TRUE(db->Put(writeOptions, "small", "value").ok());
+  delete db;
+
+  // Cut the value log in half, as a crash before it was synced may
+  std::vector<std::string> children;
+  Env::Default()->GetChildren("testdb_torn_vlog", &children);
+  std::string vlog;
+  for (const auto& child : children) {
+    if (child.size() > 4 && child.compare(child.size() - 4, 4, ".log") == 0) {
+      vlog = "testdb_torn_vlog/" + child.substr(0, child.size() - 4) + ".vtb";
+    }
+  }
+  std::string contents;
+  ASSERT_TRUE(ReadFileToString(Env::Default(), vlog, &contents).ok());
+  contents.resize(contents.size() / 2);
+  ASSERT_TRUE(WriteStringToFile(Env::Default(), contents, vlog).ok());
+
+  // Recovery stops at the first batch whose value is lost, later ones are
+  // dropped too, even those without separated values
+  ASSERT_TRUE(DB::Open(options, "testdb_torn_vlog", &db).ok());
+  int found = 0;
+  std::string value;
+  while (found < 100 &&
+         db->Get(ReadOptions(), std::to_string(1000 + found), &value).ok()) {
+    ASSERT_EQ(value, std::string(value_size, 'a' + found % 26));
+    found++;
+  }
+  ASSERT_GT(found, 0);
+  ASSERT_LT(found, 100);
+  for (int i = found; i < 100; i++) {
+    ASSERT_TRUE(
+        db->Get(ReadOptions(), std::to_string(1000 + i), &value).IsNotFound());
+  }
+  ASSERT_TRUE(db->Get(ReadOptions(), "small", &value).IsNotFound());
+  std::string vtables;
+  ASSERT_TRUE(db->GetProperty("leveldb.vtables", &vtables));
+  ASSERT_NE(vtables.find("records=" + std::to_string(found) + " "),
+            std::string::npos);
+  delete db;
+  DestroyDB("testdb_torn_vlog", options);
+}
+
+TEST(TestBasicIO, SeparationPolicy) {
+  const SeparationPolicy* policy = NewFieldSeparationPolicy({"blob"}, 1024);
+  Options options;
+  options.create_if_missing = true;
+  options.separation_policy = policy;
+  DestroyDB("testdb_sep_policy", options);
+  DB *db;
+  ASSERT_TRUE(DB::Open(options, "testdb_sep_policy", &db).ok());
+
+  // Only the records with a large blob field are separated, however
+  // large their other fields
+  WriteOptions writeOptions;
+  for (int i = 0; i < 100; i++) {
+    Fields fields;
+    fields["meta"] = std::string(value_size, 'm');
+    if (i % 2 == 0) {
+      fields["blob"] = std::string(value_size, 'b');
+    }
+    ASSERT_TRUE(db->Put(writeOptions, std::to_string(i), fields).ok());
+  }
+  db->CompactRange(nullptr, nullptr);
+
+  auto iter = db->NewIterator(ReadOptions());
+  int count = 0;
+  for (iter->SeekToFirst(); iter->Valid(); iter->Next(), count++) {
+    const int i = std::stoi(iter->key().ToString());
+    uint64_t file_number, offset, size;
+    ASSERT_EQ(iter->value_handle(&file_number, &offset, &size), i % 2 == 0);
+    Fields fields = iter->fields();
+    ASSERT_EQ(fields["meta"], std::string(value_size, 'm'));
+  }
+  ASSERT_EQ(count, 100);
+  delete iter;
+  delete db;
+  delete policy;
+}
+
+TEST(TestBasicIO, SeparateFields) {
+  const SeparationPolicy* policy =
+      NewFieldSeparationPolicy({"attachment"}, 1024);
+  Options options;
+  options.create_if_missing = true;
+  options.separation_policy = policy;
+  DestroyDB("testdb_sep_fields", options);
+  DB *db;
+  ASSERT_TRUE(DB::Open(options, "testdb_sep_fields", &db).ok());
+
+  WriteOptions writeOptions;
+  for (int i = 0; i < 100; i++) {
+    Fields fields;
+    fields["1"] = "meta" + std::to_string(i);
+    fields["attachment"] = std::string(16 << 10, 'a' + i % 26);
+    ASSERT_TRUE(db->Put(writeOptions, std::to_string(i), fields).ok());
+  }
+  db->CompactRange(nullptr, nullptr);
+
+  auto iter = db->NewIterator(ReadOptions());
+  for (iter->SeekToFirst(); iter->Valid(); iter->Next()) {
+    const int i = std::stoi(iter->key().ToString());
+    uint64_t file_number, offset, size;
+    ASSERT_TRUE(iter->value_handle(&file_number, &offset, &size));
+    Fields fields = iter->fields();
+    ASSERT_EQ(iter->value_size(), fields.Serialize().size());
+    ASSERT_EQ(fields["1"], "meta" + std::to_string(i));
+    ASSERT_EQ(fields["attachment"], std::string(16 << 10, 'a' + i % 26));
+  }
+  delete iter;
+  Field field{"1", "meta7"};
+  ASSERT_EQ(db->FindKeysByField(field), std::vector<std::string>{"7"});
+  delete db;
+
+  // Reading the inline field never touches the vtables
+  std::vector<std::string> children;
+  Env::Default()->GetChildren("testdb_sep_fields", &children);
+  for (const auto& child : children) {
+    if (child.size() > 4 && child.compare(child.size() - 4, 4, ".vtb") == 0) {
+      ASSERT_TRUE(
+          Env::Default()->RemoveFile("testdb_sep_fields/" + child).ok());
+    }
+  }
+  ASSERT_TRUE(DB::Open(options, "testdb_sep_fields", &db).ok());
+  for (int i = 0; i < 100; i++) {
+    std::string value;
+    ASSERT_TRUE(db->Get(ReadOptions(), std::to_string(i), &value).ok());
+    ASSERT_EQ(value, "meta" + std::to_string(i));
+  }
+  Fields fields;
+  ASSERT_FALSE(db->Get(ReadOptions(), "0", &fields).ok());
+  delete db;
+  DestroyDB("testdb_sep_fields", options);
+  delete policy;
+}
+
+TEST(TestBasicIO, ProjectFields) {
+  const SeparationPolicy* policy =
+      NewFieldSeparationPolicy({"attachment"}, 1024);
+  Options options;
+  options.create_if_missing = true;
+  options.separation_policy = policy;
+  DestroyDB("testdb_project", options);
+  DB *db;
+  ASSERT_TRUE(DB::Open(options, "testdb_project", &db).ok());
+
+  WriteOptions writeOptions;
+  for (int i = 0; i < 100; i++) {
+    Fields fields;
+    fields["1"] = "meta" + std::to_string(i);
+    fields["2"] = "tag" + std::to_string(i % 10);
+    fields["attachment"] = std::string(16 << 10, 'a' + i % 26);
+    ASSERT_TRUE(db->Put(writeOptions, std::to_string(i), fields).ok());
+  }
+  db->CompactRange(nullptr, nullptr);
+
+  Fields fields;
+  ASSERT_TRUE(db->Get(ReadOptions(), "5", {"attachment", "missing"},
+                      &fields).ok());
+  ASSERT_EQ(fields.GetFieldArray(),
+            (FieldArray{{"attachment", std::string(16 << 10, 'f')}}));
+
+  const std::vector<std::string> projection = {"2"};
+  ReadOptions readOptions;
+  readOptions.fields = &projection;
+  auto iter = db->NewIterator(readOptions);
+  for (iter->SeekToFirst(); iter->Valid(); iter->Next()) {
+    const int i = std::stoi(iter->key().ToString());
+    ASSERT_EQ(iter->fields().GetFieldArray(),
+              (FieldArray{{"2", "tag" + std::to_string(i % 10)}}));
+  }
+  delete iter;
+  delete db;
+
+  // Projections of inline fields never touch the vtables
+  std::vector<std::string> children;
+  Env::Default()->GetChildren("testdb_project", &children);
+  for (const auto& child : children) {
+    if (child.size() > 4 && child.compare(child.size() - 4, 4, ".vtb") == 0) {
+      ASSERT_TRUE(Env::Default()->RemoveFile("testdb_project/" + child).ok());
+    }
+  }
+  ASSERT_TRUE(DB::Open(options, "testdb_project", &db).ok());
+  for (int i = 0; i < 100; i++) {
+    ASSERT_TRUE(
+        db->Get(ReadOptions(), std::to_string(i), {"1", "2"}, &fields).ok());
+    ASSERT_EQ(fields.GetFieldArray(),
+              (FieldArray{{"1", "meta" + std::to_string(i)},
+                          {"2", "tag" + std::to_string(i % 10)}}));
+  }
+  ASSERT_FALSE(db->Get(ReadOptions(), "0", {"attachment"}, &fields).ok());
+  delete db;
+  DestroyDB("testdb_project", options);
+  delete policy;
+}
+
+TEST(TestBasicIO, SecondaryIndex) {
+  Options options;
+  options.create_if_missing = true;
+  options.indexed_fields = {"2"};
+  DestroyDB("testdb_index", options);
+  DB *db;
+  ASSERT_TRUE(DB::Open(options, "testdb_index", &db).ok());
+
+  WriteOptions writeOptions;
+  for (int i = 0; i < 100; i++) {
+    Fields fields;
+    fields["1"] = "meta" + std::to_string(i);
+    fields["2"] = "tag" + std::to_string(i % 10);
+    ASSERT_TRUE(db->Put(writeOptions, std::to_string(i), fields).ok());
+  }
+  db->CompactRange(nullptr, nullptr);
+  // Move key 3 to another tag and drop key 13, in one batch which also
+  // puts key 23 twice.  Batches hold values as DB::Put stores them.
+  const std::string kValueType(1, 2);
+  WriteBatch batch;
+  Fields fields;
+  fields["2"] = "tag4";
+  batch.Put("3", kValueType + fields.Serialize());
+  batch.Delete("13");
+  batch.Put("23", kValueType + fields.Serialize());
+  fields["2"] = "tag3";
+  batch.Put("23", kValueType + fields.Serialize());
+  ASSERT_TRUE(db->Write(writeOptions, &batch).ok());
+
+  Field field{"2", "tag3"};
+  const std::vector<std::string> tag3 = {"23", "33", "43", "53",
+                                         "63", "73", "83", "93"};
+  ASSERT_EQ(db->FindKeysByField(field), tag3);
+  field.second = "tag4";
+  ASSERT_EQ(db->FindKeysByField(field).size(), 11);
+
+  // Iterators only see the user keys
+  int count = 0;
+  auto iter = db->NewIterator(ReadOptions());
+  for (iter->SeekToFirst(); iter->Valid(); iter->Next()) {
+    count++;
+  }
+  for (iter->SeekToLast(); iter->Valid(); iter->Prev()) {
+    count--;
+  }
+  ASSERT_EQ(count, 0);
+  iter->SeekToLast();
+  ASSERT_EQ(iter->key().ToString(), "99");
+  delete iter;
+  // User keys after the index keys are reached past them
+  const std::string last = "\xff\xff" "z";
+  ASSERT_TRUE(db->Put(writeOptions, last, fields).ok());
+  iter = db->NewIterator(ReadOptions());
+  iter->SeekToLast();
+  ASSERT_EQ(iter->key().ToString(), last);
+  iter->Prev();
+  ASSERT_EQ(iter->key().ToString(), "99");
+  iter->Next();
+  ASSERT_EQ(iter->key().ToString(), last);
+  iter->Seek("\xff\xff" "idx");
+  ASSERT_EQ(iter->key().ToString(), last);
+  delete iter;
+  ASSERT_TRUE(db->Delete(writeOptions, last).ok());
+  delete db;
+
+  // Reopening drops the index on field 2 and builds one on field 1
+  options.indexed_fields = {"1"};
+  ASSERT_TRUE(DB::Open(options, "testdb_index", &db).ok());
+  field = {"1", "meta7"};
+  ASSERT_EQ(db->FindKeysByField(field), std::vector<std::string>{"7"});
+  field = {"1", "meta13"};
+  ASSERT_TRUE(db->FindKeysByField(field).empty());
+  field = {"2", "tag3"};
+  ASSERT_EQ(db->FindKeysByField(field), tag3);
+  delete db;
+  DestroyDB("testdb_index", options);
+}
+
+TEST(TestBasicIO, ParallelFindKeysByField) {
+  Options options;
+  options.create_if_missing = true;
+  options.write_buffer_size = 256 << 10;
+  options.max_file_size = 64 << 10;
+  DestroyDB("testdb_parallel_find", options);
+  DB *db;
+  ASSERT_TRUE(DB::Open(options, "testdb_parallel_find", &db).ok());
+
+  WriteOptions writeOptions;
+  for (int i = 0; i < 20000; i++) {
+    Fields fields;
+    fields["1"] = std::string(100, 'v');
+    fields["2"] = "tag" + std::to_string(i % 7);
+    ASSERT_TRUE(db->Put(writeOptions, std::to_string(i), fields).ok());
+  }
+  db->CompactRange(nullptr, nullptr);
+
+  Field field{"2", "tag3"};
+  Status status;
+  const std::vector<std::string> expected =
+      db->FindKeysByField(field, &status);
+  ASSERT_TRUE(status.ok());
+  ASSERT_EQ(expected.size(), 2857);
+
+  ReadOptions readOptions;
+  readOptions.scan_threads = 8;
+  std::vector<std::string> keys;
+  auto collect = [&keys](const Slice& key) {
+    keys.push_back(key.ToString());
+    return true;
+  };
+  ASSERT_TRUE(db->FindKeysByField(readOptions, field, collect).ok());
+  std::sort(keys.begin(), keys.end());
+  ASSERT_EQ(keys, expected);
+
+  // Stops as soon as the callback asks to
+  int found = 0;
+  ASSERT_TRUE(db->FindKeysByField(readOptions, field, [&found](const Slice&) {
+    return ++found < 5;
+  }).ok());
+  ASSERT_EQ(found, 5);
+
+  // Concurrent searches share the scan workers
+  std::vector<std::thread> searches;
+  std::atomic<int> matching{0};
+  for (int t = 0; t < 6; t++) {
+    searches.emplace_back([&]() {
+      std::vector<std::string> found_keys;
+      Status s = db->FindKeysByField(readOptions, field,
+                                     [&found_keys](const Slice& key) {
+        found_keys.push_back(key.ToString());
+        return true;
+      });
+      std::sort(found_keys.begin(), found_keys.end());
+      if (s.ok() && found_keys == expected) {
+        matching++;
+      }
+    });
+  }
+  for (auto &search : searches) {
+    search.join();
+  }
+  ASSERT_EQ(matching.load(), 6);
+  delete db;
+  DestroyDB("testdb_parallel_find", options);
+}
+
+TEST(TestBasicIO, CompactPastDeletion) {
+  Options options;
+  options.create_if_missing = true;
+  DestroyDB("testdb_compact_delete", options);
+  DB *db;
+  ASSERT_TRUE(DB::Open(options, "testdb_compact_delete", &db).ok());
+
+  WriteOptions writeOptions;
+  for (int i = 0; i < 2000; i++) {
+    ASSERT_TRUE(db->Put(writeOptions, std::to_string(i), "v").ok());
+  }
+  db->CompactRange(nullptr, nullptr);
+  // The deletion marker is kept while older levels still hold the key,
+  // and dropped once it reaches the last one
+  ASSERT_TRUE(db->Delete(writeOptions, "1000").ok());
+  for (int round = 0; round < 2; round++) {
+    db->CompactRange(nullptr, nullptr);
+    int count = 0;
+    Iterator *iter = db->NewIterator(ReadOptions());
+    for (iter->SeekToFirst(); iter->Valid(); iter->Next()) {
+      count++;
+    }
+    ASSERT_TRUE(iter->status().ok());
+    delete iter;
+    ASSERT_EQ(count, 1999);
+    std::string value;
+    ASSERT_TRUE(db->Get(ReadOptions(), "999", &value).ok());
+    ASSERT_TRUE(db->Get(ReadOptions(), "1000", &value).IsNotFound());
+  }
+  delete db;
+  DestroyDB("testdb_compact_delete", options);
+}
+
+// Value of "key<100 + i>" in the legacy DB, "version" 2 for every fourth
+// key.  Even keys hold values large enough to be separated.
+std::string LegacyValue(int i, int version) {
+  const std::string unit =
+      "value" + std::to_string(i) + "v" + std::to_string(version);
+  std::string value;
+  while (value.size() < (i % 2 == 0 ? 1500u : 100u)) {
+    value += unit;
+  }
+  return value;
+}
+
+TEST(TestBasicIO, OpenLegacyDB) {
+  // The fixture was written before VTables had a file header, checksums
+  // or a footer, and kept their metadata in the VTableMeta file
+  Options options;
+  Env *env = options.env;
+  DestroyDB("testdb_legacy", options);
+  ASSERT_TRUE(env->CreateDir("testdb_legacy").ok());
+  std::vector<std::string> files;
+  ASSERT_TRUE(env->GetChildren(LEGACY_VTABLE_DB, &files).ok());
+  for (const std::string &file : files) {
+    if (file == "." || file == "..") continue;
+    std::string contents;
+    ASSERT_TRUE(ReadFileToString(env, std::string(LEGACY_VTABLE_DB) + "/" +
+                                          file, &contents).ok());
+    ASSERT_TRUE(
+        WriteStringToFile(env, contents, "testdb_legacy/" + file).ok());
+  }
+
+  auto check = [](DB *db) {
+    for (int i = 0; i < 40; i++) {
+      std::string value;
+      ASSERT_TRUE(
+          db->Get(ReadOptions(), "key" + std::to_string(100 + i), &value)
+              .ok());
+      ASSERT_EQ(value, LegacyValue(i, i % 4 == 0 ? 2 : 1));
+    }
+  };
+
+  DB *db;
+  ASSERT_TRUE(DB::Open(options, "testdb_legacy", &db).ok());
+  check(db);
+  std::string vtables;
+  ASSERT_TRUE(db->GetProperty("leveldb.vtables", &vtables));
+  ASSERT_NE(vtables.find("#5 "), std::string::npos);
+  ASSERT_NE(vtables.find("#7 "), std::string::npos);
+  ASSERT_FALSE(env->FileExists("testdb_legacy/VTableMeta"));
+
+  // New vtables sit next to the legacy ones, and compactions keep both
+  WriteOptions writeOptions;
+  for (int i = 0; i < 40; i += 4) {
+    ASSERT_TRUE(db->Put(writeOptions, "key" + std::to_string(100 + i),
+                        LegacyValue(i, 2)).ok());
+  }
+  db->CompactRange(nullptr, nullptr);
+  check(db);
+  delete db;
+
+  ASSERT_TRUE(DB::Open(options, "testdb_legacy", &db).ok());
+  check(db);
+  delete db;
+  DestroyDB("testdb_legacy", options);
+}
+
 int main(int argc, char **argv) {
   testing::InitGoogleTest(&argc, argv);
   return RUN_ALL_TESTS();
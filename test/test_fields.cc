@@ -3,6 +3,9 @@
 
 #include "leveldb/db.h"
 #include "leveldb/env.h"
+#include "leveldb/field_predicate.h"
+#include "db/dbformat.h"
+#include "table/zone_map.h"
 
 using namespace std;
 using namespace leveldb;
@@ -121,6 +124,178 @@ TEST(TestFields, SearchKey) {
   delete db;
 }
 
+TEST(TestFields, FieldsView) {
+  // Enough fields to spill the offset table
+  FieldArray field_array;
+  for (int i = 0; i < 40; i++) {
+    field_array.emplace_back("field" + std::to_string(i), std::to_string(i));
+  }
+  const std::string encoded = Fields(field_array).Serialize();
+  FieldsView view(encoded);
+  ASSERT_EQ(view.size(), 40);
+  Slice value;
+  for (int i = 0; i < 40; i++) {
+    ASSERT_TRUE(view.Get("field" + std::to_string(i), &value));
+    ASSERT_EQ(value.ToString(), std::to_string(i));
+  }
+  ASSERT_FALSE(view.Get("field", &value));
+  ASSERT_FALSE(view.Get("field99", &value));
+
+  // Unsorted encodings are searched in order, a damaged tail is dropped
+  std::string unsorted;
+  PutField(&unsorted, "b", "2");
+  PutField(&unsorted, "a", "1");
+  ASSERT_TRUE(view.Reset(unsorted));
+  ASSERT_TRUE(view.Get("a", &value));
+  ASSERT_EQ(value.ToString(), "1");
+  unsorted.push_back('\x7f');
+  ASSERT_FALSE(view.Reset(unsorted));
+  ASSERT_EQ(view.size(), 2);
+
+  DB *db;
+  ASSERT_TRUE(OpenDB("testdb", &db).ok());
+  FieldArray field_array_1 = {
+    {"name", "Arcueid01"},
+    {"address", "tYpeMuuN"},
+    {"phone", "122-233-4455"}
+  };
+  db->Put(WriteOptions(), "k_1", Fields(field_array_1));
+  ASSERT_TRUE(db->Get(ReadOptions(), "k_1", &view).ok());
+  ASSERT_EQ(view.size(), 3);
+  ASSERT_TRUE(view.Get("phone", &value));
+  ASSERT_EQ(value.ToString(), "122-233-4455");
+  ASSERT_TRUE(db->Get(ReadOptions(), "k_missing", &view).IsNotFound());
+  ASSERT_EQ(view.size(), 0);
+
+  Iterator *iter = db->NewIterator(ReadOptions());
+  iter->Seek("k_1");
+  ASSERT_TRUE(iter->Valid());
+  ASSERT_TRUE(iter->fields_view(&view).ok());
+  ASSERT_TRUE(view.Get("name", &value));
+  ASSERT_EQ(value.ToString(), "Arcueid01");
+  delete iter;
+  delete db;
+}
+
+TEST(TestFields, FieldPredicate) {
+  FieldArray field_array = {{"city", "Paris"}, {"note", "\x04" "cityRome"}};
+  const std::string encoded = Fields(field_array).Serialize();
+  ASSERT_TRUE(FieldPredicate::Equal("city", "Paris").MatchesFields(encoded));
+  // The bytes of a match inside another field do not count
+  ASSERT_FALSE(FieldPredicate::Equal("city", "Rome").MatchesFields(encoded));
+  ASSERT_TRUE(FieldPredicate::Prefix("city", "Pa").MatchesFields(encoded));
+  ASSERT_FALSE(FieldPredicate::Prefix("city", "Ro").MatchesFields(encoded));
+  ASSERT_TRUE(FieldPredicate::Range("city", "P", "Q").MatchesFields(encoded));
+  ASSERT_TRUE(FieldPredicate::Range("city", "P", "").MatchesFields(encoded));
+  ASSERT_FALSE(FieldPredicate::Range("city", "A", "P").MatchesFields(encoded));
+  ASSERT_FALSE(FieldPredicate::Equal("town", "Paris").MatchesFields(encoded));
+
+  DB *db;
+  ASSERT_TRUE(OpenDB("testdb_predicate", &db).ok());
+  for (int i = 0; i < 10; i++) {
+    FieldArray fields = {{"tag", i % 2 == 0 ? "even" : "odd"}};
+    db->Put(WriteOptions(), "p_" + std::to_string(i), Fields(fields));
+  }
+  // Older values that match must not show through
+  db->Put(WriteOptions(), "p_4", Fields(FieldArray{{"tag", "none"}}));
+  db->Delete(WriteOptions(), "p_6");
+
+  const FieldPredicate even = FieldPredicate::Equal("tag", "even");
+  ReadOptions read_options;
+  read_options.predicate = &even;
+  Iterator *iter = db->NewIterator(read_options);
+  std::vector<std::string> keys;
+  for (iter->SeekToFirst(); iter->Valid(); iter->Next()) {
+    keys.push_back(iter->key().ToString());
+  }
+  ASSERT_EQ(keys, (std::vector<std::string>{"p_0", "p_2", "p_8"}));
+  keys.clear();
+  for (iter->SeekToLast(); iter->Valid(); iter->Prev()) {
+    keys.push_back(iter->key().ToString());
+  }
+  ASSERT_EQ(keys, (std::vector<std::string>{"p_8", "p_2", "p_0"}));
+  iter->Seek("p_3");
+  ASSERT_TRUE(iter->Valid());
+  ASSERT_EQ(iter->key().ToString(), "p_8");
+  ASSERT_TRUE(iter->status().ok());
+  delete iter;
+
+  const FieldPredicate some = FieldPredicate::Range("tag", "n", "o");
+  read_options.predicate = &some;
+  iter = db->NewIterator(read_options);
+  iter->SeekToFirst();
+  ASSERT_TRUE(iter->Valid());
+  ASSERT_EQ(iter->key().ToString(), "p_4");
+  iter->Next();
+  ASSERT_FALSE(iter->Valid());
+  delete iter;
+  delete db;
+  DestroyDB("testdb_predicate", Options());
+}
+
+TEST(TestFields, ZoneMap) {
+  auto entry = [](const std::string &key, const std::string &n) {
+    return std::make_pair(InternalKey(key, 1, kTypeValue).Encode().ToString(),
+                          "\x02" + Fields(FieldArray{{"n", n}}).Serialize());
+  };
+  ZoneMapBuilder builder({"n"});
+  auto e = entry("a", "10");
+  builder.AddEntry(e.first, e.second);
+  e = entry("b", "20");
+  builder.AddEntry(e.first, e.second);
+  builder.FinishBlock(0);
+  e = entry("c", "30");
+  builder.AddEntry(e.first, e.second);
+  builder.FinishBlock(100);
+  ZoneMapReader reader(builder.Finish());
+  ASSERT_TRUE(reader.ok());
+  const FieldPredicate low = FieldPredicate::Range("n", "15", "25");
+  ASSERT_TRUE(reader.TableMayMatch(low));
+  ASSERT_TRUE(reader.BlockMayMatch(0, low));
+  ASSERT_FALSE(reader.BlockMayMatch(100, low));
+  ASSERT_FALSE(reader.TableMayMatch(FieldPredicate::Equal("n", "40")));
+  ASSERT_TRUE(reader.TableMayMatch(FieldPredicate::Equal("m", "40")));
+
+  Options options;
+  options.create_if_missing = true;
+  options.block_size = 256;
+  options.zone_map_fields = {"n"};
+  DB *db;
+  ASSERT_TRUE(DB::Open(options, "testdb_zonemap", &db).ok());
+  char buf[16];
+  for (int i = 0; i < 2000; i++) {
+    snprintf(buf, sizeof(buf), "%05d", i);
+    db->Put(WriteOptions(), std::string("z_") + buf,
+            Fields(FieldArray{{"n", buf}}));
+  }
+  db->CompactRange(nullptr, nullptr);
+  // Newer values outside the range hide older ones inside it
+  db->Put(WriteOptions(), "z_01005", Fields(FieldArray{{"n", "99999"}}));
+  db->Delete(WriteOptions(), "z_01006");
+
+  const FieldPredicate range = FieldPredicate::Range("n", "01000", "01010");
+  ReadOptions read_options;
+  read_options.predicate = &range;
+  auto collect = [&]() {
+    std::vector<std::string> keys;
+    Iterator *iter = db->NewIterator(read_options);
+    for (iter->SeekToFirst(); iter->Valid(); iter->Next()) {
+      keys.push_back(iter->key().ToString());
+    }
+    EXPECT_TRUE(iter->status().ok());
+    delete iter;
+    return keys;
+  };
+  const std::vector<std::string> expected = {
+      "z_01000", "z_01001", "z_01002", "z_01003", "z_01004",
+      "z_01007", "z_01008", "z_01009"};
+  ASSERT_EQ(collect(), expected);
+  db->CompactRange(nullptr, nullptr);
+  ASSERT_EQ(collect(), expected);
+  delete db;
+  DestroyDB("testdb_zonemap", options);
+}
+
 int main(int argc, char **argv) {
   testing::InitGoogleTest(&argc, argv);
   return RUN_ALL_TESTS();
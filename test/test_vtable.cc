@@ -1,9 +1,14 @@
 #include <iostream>
+#include <thread>
 #include <gtest/gtest.h>
 
 #include "leveldb/db.h"
 #include "leveldb/env.h"
+#include "db/filename.h"
+#include "port/port.h"
 #include "table/vtable_builder.h"
+#include "table/vtable_cache.h"
+#include "table/vtable_manager.h"
 #include "table/vtable_reader.h"
 #include "table/vtable_format.h"
 
@@ -33,17 +38,473 @@ TEST(TestVTable, BuilderReader) {
   reader.Open(opt, "1.vtb");
 
   VTableRecord res_record;
-  reader.Get(handle2, &res_record);
+  std::string scratch(handle2.size, '\0');
+  std::string buffer;
+  reader.Get(handle2, &res_record, &scratch[0], &buffer, true);
 
   ASSERT_TRUE(res_record.key.ToString() == record2.key.ToString());
   ASSERT_TRUE(res_record.value.ToString() == record2.value.ToString());
 
-  reader.Get(handle1, &res_record);
+  std::string scratch1(handle1.size, '\0');
+  reader.Get(handle1, &res_record, &scratch1[0], &buffer, true);
 
   ASSERT_TRUE(res_record.key.ToString() == record1.key.ToString());
   ASSERT_TRUE(res_record.value.ToString() == record1.value.ToString());
 }
 
+TEST(TestVTable, Checksum) {
+  Options opt;
+  WritableFile *file;
+  opt.env->NewWritableFile("5.vtb", &file);
+  VTableBuilder builder(opt, file);
+  VTableRecord record;
+  record.key = "001";
+  record.value = "value1";
+  VTableHandle handle;
+  builder.Add(record, &handle);
+  builder.Finish();
+  file->Close();
+  delete file;
+
+  // Flip the last byte of the value
+  std::string contents;
+  ASSERT_TRUE(ReadFileToString(opt.env, "5.vtb", &contents).ok());
+  contents[handle.offset + handle.size - 1] ^= 1;
+  ASSERT_TRUE(WriteStringToFile(opt.env, contents, "5.vtb").ok());
+
+  VTableReader reader;
+  ASSERT_TRUE(reader.Open(opt, "5.vtb").ok());
+  VTableRecord res_record;
+  std::string scratch(handle.size, '\0');
+  std::string buffer;
+  ASSERT_TRUE(
+      reader.Get(handle, &res_record, &scratch[0], &buffer, false).ok());
+  ASSERT_EQ(res_record.value.ToString(), "value0");
+  ASSERT_TRUE(reader.Get(handle, &res_record, &scratch[0], &buffer, true)
+                  .IsCorruption());
+  ASSERT_TRUE(reader.ReadRecord(handle.offset, handle.offset + handle.size,
+                                &handle, &res_record, &scratch, &buffer)
+                  .IsCorruption());
+  opt.env->RemoveFile("5.vtb");
+}
+
+TEST(TestVTable, LegacyFormat) {
+  // Records as written before the file header: a fixed32 size, then the
+  // length prefixed key and value, without checksum or footer
+  std::string contents;
+  std::vector<VTableHandle> handles;
+  for (int i = 0; i < 3; i++) {
+    std::string record;
+    PutLengthPrefixedSlice(&record, "key" + std::to_string(i));
+    PutLengthPrefixedSlice(&record, "value" + std::to_string(i));
+    VTableHandle handle;
+    handle.offset = contents.size();
+    handle.size = kLegacyRecordHeaderSize + record.size();
+    handles.push_back(handle);
+    PutFixed32(&contents, static_cast<uint32_t>(record.size()));
+    contents.append(record);
+  }
+  Options opt;
+  ASSERT_TRUE(WriteStringToFile(opt.env, contents, "6.vtb").ok());
+
+  VTableReader reader;
+  ASSERT_TRUE(reader.Open(opt, "6.vtb").ok());
+  ASSERT_EQ(reader.FormatVersion(), kLegacyVTableFormat);
+  ASSERT_EQ(reader.DataOffset(), 0);
+  VTableProperties properties;
+  ASSERT_TRUE(reader.ReadProperties(&properties).IsNotFound());
+
+  std::string scratch, buffer;
+  uint64_t offset = reader.DataOffset();
+  for (int i = 0; i < 3; i++) {
+    VTableHandle handle;
+    VTableRecord record;
+    ASSERT_TRUE(reader.ReadRecord(offset, contents.size(), &handle, &record,
+                                  &scratch, &buffer).ok());
+    ASSERT_EQ(handle.offset, handles[i].offset);
+    ASSERT_EQ(handle.size, handles[i].size);
+    ASSERT_EQ(record.key.ToString(), "key" + std::to_string(i));
+    ASSERT_EQ(record.value.ToString(), "value" + std::to_string(i));
+    offset += handle.size;
+
+    std::string get_scratch(handle.size, '\0');
+    ASSERT_TRUE(reader.Get(handle, &record, &get_scratch[0], &buffer, true)
+                    .ok());
+    ASSERT_EQ(record.value.ToString(), "value" + std::to_string(i));
+  }
+  reader.Close();
+
+  // A format newer than this build is refused
+  contents.clear();
+  PutFixed32(&contents, kVTableFileMark);
+  PutFixed32(&contents, kCurrentVTableFormat + 1);
+  ASSERT_TRUE(WriteStringToFile(opt.env, contents, "6.vtb").ok());
+  VTableReader newer;
+  ASSERT_TRUE(newer.Open(opt, "6.vtb").IsNotSupportedError());
+  opt.env->RemoveFile("6.vtb");
+}
+
+TEST(TestVTable, Properties) {
+  Options opt;
+  WritableFile *file;
+  opt.env->NewWritableFile("2.vtb", &file);
+  VTableBuilder builder(opt, file);
+
+  // Enough records to fill several blocks, added out of key order
+  const int kRecords = 100;
+  const std::string value(4096, 'v');
+  std::vector<VTableHandle> handles(kRecords);
+  for (int i = 0; i < kRecords; i++) {
+    const std::string key = std::to_string(1000 + (i * 37) % kRecords);
+    VTableRecord record;
+    record.key = key;
+    record.value = value;
+    builder.Add(record, &handles[i]);
+  }
+  ASSERT_TRUE(builder.Finish().ok());
+  file->Close();
+  delete file;
+
+  uint64_t file_size;
+  ASSERT_TRUE(opt.env->GetFileSize("2.vtb", &file_size).ok());
+  ASSERT_EQ(builder.FileSize(), file_size);
+
+  VTableReader reader;
+  ASSERT_TRUE(reader.Open(opt, "2.vtb").ok());
+  VTableProperties properties;
+  ASSERT_TRUE(reader.ReadProperties(&properties).ok());
+  ASSERT_EQ(properties.format_version, kCurrentVTableFormat);
+  ASSERT_EQ(properties.records_num, kRecords);
+  ASSERT_EQ(properties.data_size,
+            handles.back().offset + handles.back().size);
+  ASSERT_EQ(properties.smallest_key, "1000");
+  ASSERT_EQ(properties.largest_key, "1099");
+  ASSERT_GT(properties.block_offsets.size(), 1);
+
+  // Every index entry starts a record, a scan from it finds the rest
+  for (uint64_t block_offset : properties.block_offsets) {
+    int found = 0;
+    std::string scratch, buffer;
+    for (uint64_t offset = block_offset; offset < properties.data_size;) {
+      VTableHandle handle;
+      VTableRecord record;
+      ASSERT_TRUE(reader.ReadRecord(offset, properties.data_size, &handle,
+                                    &record, &scratch, &buffer).ok());
+      ASSERT_EQ(record.value.ToString(), value);
+      offset += handle.size;
+      found++;
+    }
+    ASSERT_EQ(handles[kRecords - found].offset, block_offset);
+  }
+  opt.env->RemoveFile("2.vtb");
+}
+
+TEST(TestVTable, Compression) {
+  const CompressionType types[] = {kNoCompression, kSnappyCompression,
+                                   kZstdCompression};
+  for (CompressionType type : types) {
+    Options opt;
+    opt.vtable_compression = type;
+    WritableFile *file;
+    opt.env->NewWritableFile("3.vtb", &file);
+    VTableBuilder builder(opt, file);
+
+    // A compressible value and one that is not, so that a file compressed
+    // at all mixes both kinds of records
+    const std::string compressible(4096, 'c');
+    std::string incompressible;
+    uint32_t seed = 301;
+    for (int i = 0; i < 256; i++) {
+      seed = seed * 1103515245 + 12345;
+      incompressible.push_back(static_cast<char>(seed >> 16));
+    }
+    VTableRecord record1, record2;
+    record1.key = "001";
+    record1.value = compressible;
+    record2.key = "002";
+    record2.value = incompressible;
+    VTableHandle handle1, handle2;
+    builder.Add(record1, &handle1);
+    builder.Add(record2, &handle2);
+    ASSERT_TRUE(builder.Finish().ok());
+    file->Close();
+    delete file;
+
+    std::string compressed;
+    bool supported =
+        (type == kSnappyCompression &&
+         port::Snappy_Compress(compressible.data(), compressible.size(),
+                               &compressed)) ||
+        (type == kZstdCompression &&
+         port::Zstd_Compress(1, compressible.data(), compressible.size(),
+                             &compressed));
+    if (supported) {
+      ASSERT_LT(handle1.size, compressible.size());
+    } else {
+      ASSERT_GT(handle1.size, compressible.size());
+    }
+    ASSERT_GT(handle2.size, incompressible.size());
+
+    VTableReader reader;
+    ASSERT_TRUE(reader.Open(opt, "3.vtb").ok());
+    VTableRecord res_record;
+    std::string scratch1(handle1.size, '\0'), scratch2(handle2.size, '\0');
+    std::string buffer1, buffer2;
+    ASSERT_TRUE(
+        reader.Get(handle1, &res_record, &scratch1[0], &buffer1, true).ok());
+    ASSERT_EQ(res_record.key.ToString(), "001");
+    ASSERT_EQ(res_record.value.ToString(), compressible);
+    ASSERT_TRUE(
+        reader.Get(handle2, &res_record, &scratch2[0], &buffer2, true).ok());
+    ASSERT_EQ(res_record.key.ToString(), "002");
+    ASSERT_EQ(res_record.value.ToString(), incompressible);
+    opt.env->RemoveFile("3.vtb");
+  }
+}
+
+TEST(TestVTable, CompressionDictionary) {
+  Options opt;
+  opt.vtable_compression = kZstdCompression;
+  opt.vtable_zstd_dict_size = 4096;
+  opt.vtable_zstd_dict_samples = 200;
+  WritableFile *file;
+  opt.env->NewWritableFile("4.vtb", &file);
+  VTableBuilder builder(opt, file);
+
+  // Small documents sharing their structure
+  const int kRecords = 400;
+  std::vector<std::string> keys, values;
+  std::vector<VTableHandle> handles(kRecords);
+  for (int i = 0; i < kRecords; i++) {
+    keys.push_back(std::to_string(10000 + i));
+    values.push_back("{\"id\": " + std::to_string(i * 7919) +
+                     ", \"name\": \"user" + std::to_string(i * 31) +
+                     "\", \"email\": \"user" + std::to_string(i * 31) +
+                     "@example.com\", \"active\": " +
+                     (i % 3 ? "true" : "false") + "}");
+  }
+  for (int i = 0; i < kRecords; i++) {
+    VTableRecord record;
+    record.key = keys[i];
+    record.value = values[i];
+    builder.Add(record, &handles[i]);
+  }
+  ASSERT_TRUE(builder.Finish().ok());
+  file->Close();
+  delete file;
+
+  VTableReader reader;
+  ASSERT_TRUE(reader.Open(opt, "4.vtb").ok());
+  VTableProperties properties;
+  ASSERT_TRUE(reader.ReadProperties(&properties).ok());
+  std::string compressed;
+  if (port::Zstd_Compress(1, values[0].data(), values[0].size(),
+                          &compressed)) {
+    // The records after the samples are compressed with the dictionary
+    ASSERT_FALSE(properties.compression_dict.empty());
+    ASSERT_LT(handles.back().size, values.back().size());
+  } else {
+    ASSERT_TRUE(properties.compression_dict.empty());
+  }
+
+  for (int i = 0; i < kRecords; i++) {
+    VTableRecord res_record;
+    std::string scratch(handles[i].size, '\0');
+    std::string buffer;
+    ASSERT_TRUE(
+        reader.Get(handles[i], &res_record, &scratch[0], &buffer, true).ok());
+    ASSERT_EQ(res_record.key.ToString(), keys[i]);
+    ASSERT_EQ(res_record.value.ToString(), values[i]);
+  }
+  opt.env->RemoveFile("4.vtb");
+}
+
+TEST(TestVTable, CacheReader) {
+  Options opt;
+  const std::string dbname = "testvtb";
+  opt.env->CreateDir(dbname);
+
+  WritableFile *file;
+  opt.env->NewWritableFile(VTableFileName(dbname, 1), &file);
+  VTableBuilder builder(opt, file);
+  VTableRecord record;
+  record.key = "001";
+  record.value = "value1";
+  VTableIndex index;
+  index.file_number = 1;
+  builder.Add(record, &index.vtable_handle);
+  builder.Finish();
+  file->Close();
+  delete file;
+
+  VTableManager manager;
+  VTableMeta meta;
+  meta.number = 1;
+  meta.records_num = 1;
+  manager.AddVTable(meta);
+
+  {
+    VTableCache cache(dbname, opt, 10, &manager);
+    manager.SetVTableCache(&cache);
+
+    VTableRecord res_record;
+    PinnableSlice value;
+    ASSERT_TRUE(cache.Get(ReadOptions(), index, &res_record, &value).ok());
+    ASSERT_EQ(value.ToString(), "value1");
+    value.Reset();
+    ASSERT_TRUE(cache.Get(ReadOptions(), index, &res_record, &value).ok());
+    ASSERT_EQ(res_record.key.ToString(), "001");
+    value.Reset();
+
+    index.file_number = 2;
+    ASSERT_FALSE(cache.Get(ReadOptions(), index, &res_record, &value).ok());
+    manager.SetVTableCache(nullptr);
+  }
+  opt.env->RemoveFile(VTableFileName(dbname, 1));
+}
+
+TEST(TestVTable, MmapCacheReader) {
+  Options opt;
+  opt.max_vtable_mmaps = 1;
+  const std::string dbname = "testvtb_mmap";
+  opt.env->CreateDir(dbname);
+
+  VTableIndex indexes[2];
+  for (uint64_t number = 1; number <= 2; number++) {
+    WritableFile *file;
+    opt.env->NewWritableFile(VTableFileName(dbname, number), &file);
+    VTableBuilder builder(opt, file);
+    const std::string key = "00" + std::to_string(number);
+    const std::string value = "value" + std::to_string(number);
+    VTableRecord record;
+    record.key = key;
+    record.value = value;
+    indexes[number - 1].file_number = number;
+    builder.Add(record, &indexes[number - 1].vtable_handle);
+    builder.Finish();
+    file->Close();
+    delete file;
+  }
+
+  // Only registered vtables are sealed and get mapped
+  VTableManager manager;
+  for (uint64_t number = 1; number <= 2; number++) {
+    VTableMeta meta;
+    meta.number = number;
+    meta.records_num = 1;
+    manager.AddVTable(meta);
+  }
+  {
+    VTableCache cache(dbname, opt, 10, &manager);
+
+    // The first vtable takes the only mmap slot, the second uses pread
+    VTableRecord res_record;
+    PinnableSlice value1, value2;
+    ASSERT_TRUE(cache.Get(ReadOptions(), indexes[0], &res_record, &value1).ok());
+    ASSERT_TRUE(cache.Get(ReadOptions(), indexes[1], &res_record, &value2).ok());
+    ASSERT_EQ(value1.ToString(), "value1");
+    ASSERT_EQ(value2.ToString(), "value2");
+    value1.Reset();
+    value2.Reset();
+
+    // Evicting the mapped vtable gives its slot back
+    cache.Evict(1);
+    ASSERT_TRUE(cache.Get(ReadOptions(), indexes[0], &res_record, &value1).ok());
+    ASSERT_EQ(res_record.key.ToString(), "001");
+    ASSERT_EQ(value1.ToString(), "value1");
+  }
+  opt.env->RemoveFile(VTableFileName(dbname, 1));
+  opt.env->RemoveFile(VTableFileName(dbname, 2));
+}
+
+TEST(TestVTable, BlobCache) {
+  Options opt;
+  Cache* blob_cache = NewLRUCache(1 << 20);
+  opt.blob_cache = blob_cache;
+  const std::string dbname = "testvtb_blob";
+  opt.env->CreateDir(dbname);
+
+  WritableFile *file;
+  opt.env->NewWritableFile(VTableFileName(dbname, 1), &file);
+  VTableBuilder builder(opt, file);
+  VTableRecord record;
+  record.key = "001";
+  record.value = "value1";
+  VTableIndex index;
+  index.file_number = 1;
+  builder.Add(record, &index.vtable_handle);
+  builder.Finish();
+  file->Close();
+  delete file;
+
+  VTableManager manager;
+  {
+    VTableCache cache(dbname, opt, 10, &manager);
+
+    VTableRecord res_record;
+    PinnableSlice value;
+    ReadOptions no_fill;
+    no_fill.fill_cache = false;
+    ASSERT_TRUE(cache.Get(no_fill, index, &res_record, &value).ok());
+    ASSERT_EQ(blob_cache->TotalCharge(), 0);
+    value.Reset();
+
+    ASSERT_TRUE(cache.Get(ReadOptions(), index, &res_record, &value).ok());
+    ASSERT_EQ(value.ToString(), "value1");
+    ASSERT_EQ(blob_cache->TotalCharge(), record.value.size());
+    value.Reset();
+
+    // Served from the blob cache even once the file is gone
+    opt.env->RemoveFile(VTableFileName(dbname, 1));
+    ASSERT_TRUE(cache.Get(ReadOptions(), index, &res_record, &value).ok());
+    ASSERT_EQ(res_record.key.ToString(), "001");
+    ASSERT_EQ(value.ToString(), "value1");
+    value.Reset();
+
+    // Its records age out of the blob cache, the file number is never
+    // reused
+    cache.Evict(1);
+    ASSERT_EQ(blob_cache->TotalCharge(), record.value.size());
+  }
+  delete blob_cache;
+}
+
+TEST(TestVTable, ManagerConcurrentAccess) {
+  Options opt;
+  VTableManager manager;
+  const int kFiles = 64;
+  const int kRecords = 1000;
+  for (uint64_t number = 1; number <= kFiles; number++) {
+    VTableMeta meta;
+    meta.number = number;
+    meta.records_num = kRecords;
+    manager.AddVTable(meta);
+  }
+
+  // Readers look up vtables while a "compaction" invalidates records of
+  // every file
+  std::vector<std::thread> threads;
+  for (int t = 0; t < 4; t++) {
+    threads.emplace_back([&manager, t] {
+      for (int i = 0; i < 10000; i++) {
+        uint64_t number = (i + t) % kFiles + 1;
+        ASSERT_TRUE(manager.HasVTable(number));
+      }
+    });
+  }
+  threads.emplace_back([&manager] {
+    for (int i = 0; i < kRecords - 1; i++) {
+      for (uint64_t number = 1; number <= kFiles; number++) {
+        ASSERT_TRUE(manager.AddInvalid(number, 1).ok());
+      }
+    }
+  });
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  ASSERT_FALSE(manager.AddInvalid(kFiles + 1, 1).ok());
+}
+
 int main(int argc, char **argv) {
   testing::InitGoogleTest(&argc, argv);
   return RUN_ALL_TESTS();
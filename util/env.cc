@@ -22,6 +22,11 @@ Status Env::NewAppendableFile(const std::string& fname, WritableFile** result) {
   return Status::NotSupported("NewAppendableFile", fname);
 }
 
+Status Env::NewMmapReadableFile(const std::string& fname,
+                                RandomAccessFile** result) {
+  return NewRandomAccessFile(fname, result);
+}
+
 Status Env::RemoveDir(const std::string& dirname) { return DeleteDir(dirname); }
 Status Env::DeleteDir(const std::string& dirname) { return RemoveDir(dirname); }
 
@@ -32,6 +37,8 @@ SequentialFile::~SequentialFile() = default;
 
 RandomAccessFile::~RandomAccessFile() = default;
 
+void RandomAccessFile::Hint(AccessPattern pattern) {}
+
 WritableFile::~WritableFile() = default;
 
 Logger::~Logger() = default;
@@ -196,6 +196,24 @@ class PosixRandomAccessFile final : public RandomAccessFile {
     }
   }
 
+  void Hint(AccessPattern pattern) override {
+#if defined(POSIX_FADV_RANDOM)
+    if (!has_permanent_fd_) {
+      return;
+    }
+    int advice = POSIX_FADV_NORMAL;
+    if (pattern == kRandom) {
+      advice = POSIX_FADV_RANDOM;
+    } else if (pattern == kSequential) {
+      advice = POSIX_FADV_SEQUENTIAL;
+    }
+    ::posix_fadvise(fd_, 0, 0, advice);
+#else
+    // Silence compiler warnings about unused arguments.
+    (void)pattern;
+#endif  // defined(POSIX_FADV_RANDOM)
+  }
+
   Status Read(uint64_t offset, size_t n, Slice* result,
               char* scratch) const override {
     int fd = fd_;
@@ -243,7 +261,8 @@ class PosixMmapReadableFile final : public RandomAccessFile {
   //
   // |mmap_limiter| must outlive this instance. The caller must have already
   // acquired the right to use one mmap region, which will be released when this
-  // instance is destroyed.
+  // instance is destroyed. |mmap_limiter| may be null if the caller accounts
+  // for the region itself.
   PosixMmapReadableFile(std::string filename, char* mmap_base, size_t length,
                         Limiter* mmap_limiter)
       : mmap_base_(mmap_base),
@@ -253,7 +272,19 @@ class PosixMmapReadableFile final : public RandomAccessFile {
 
   ~PosixMmapReadableFile() override {
     ::munmap(static_cast<void*>(mmap_base_), length_);
-    mmap_limiter_->Release();
+    if (mmap_limiter_ != nullptr) {
+      mmap_limiter_->Release();
+    }
+  }
+
+  void Hint(AccessPattern pattern) override {
+    int advice = MADV_NORMAL;
+    if (pattern == kRandom) {
+      advice = MADV_RANDOM;
+    } else if (pattern == kSequential) {
+      advice = MADV_SEQUENTIAL;
+    }
+    ::madvise(static_cast<void*>(mmap_base_), length_, advice);
   }
 
   Status Read(uint64_t offset, size_t n, Slice* result,
@@ -570,6 +601,37 @@ class PosixEnv : public Env {
     return status;
   }
 
+  Status NewMmapReadableFile(const std::string& filename,
+                             RandomAccessFile** result) override {
+    *result = nullptr;
+    uint64_t file_size;
+    Status status = GetFileSize(filename, &file_size);
+    if (!status.ok()) {
+      return status;
+    }
+    if (file_size == 0) {
+      // Empty regions cannot be mapped.
+      return NewRandomAccessFile(filename, result);
+    }
+
+    int fd = ::open(filename.c_str(), O_RDONLY | kOpenBaseFlags);
+    if (fd < 0) {
+      return PosixError(filename, errno);
+    }
+    void* mmap_base =
+        ::mmap(/*addr=*/nullptr, file_size, PROT_READ, MAP_SHARED, fd, 0);
+    if (mmap_base != MAP_FAILED) {
+      // The caller enforces its own mmap budget.
+      *result = new PosixMmapReadableFile(filename,
+                                          reinterpret_cast<char*>(mmap_base),
+                                          file_size, /*mmap_limiter=*/nullptr);
+    } else {
+      status = PosixError(filename, errno);
+    }
+    ::close(fd);
+    return status;
+  }
+
   Status NewWritableFile(const std::string& filename,
                          WritableFile** result) override {
     int fd = ::open(filename.c_str(),
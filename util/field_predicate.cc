@@ -0,0 +1,107 @@
+#include "leveldb/field_predicate.h"
+
+#include <cstring>
+
+#include "db/fields.h"
+#include "util/coding.h"
+
+namespace leveldb {
+
+namespace {
+
+// Return true iff "needle" occurs in "haystack".  memchr finds the
+// candidates and memcmp checks them, both a few bytes per instruction.
+bool Contains(const Slice& haystack, const Slice& needle) {
+  if (needle.empty()) {
+    return true;
+  }
+  if (haystack.size() < needle.size()) {
+    return false;
+  }
+  const char* p = haystack.data();
+  const char* const last = p + (haystack.size() - needle.size());
+  while (p <= last) {
+    p = static_cast<const char*>(memchr(p, needle[0], last - p + 1));
+    if (p == nullptr) {
+      return false;
+    }
+    if (memcmp(p + 1, needle.data() + 1, needle.size() - 1) == 0) {
+      return true;
+    }
+    p++;
+  }
+  return false;
+}
+
+}  // namespace
+
+FieldPredicate::FieldPredicate(Type type, const Slice& field_name,
+                               const Slice& operand, const Slice& upper)
+    : type_(type),
+      field_name_(field_name.ToString()),
+      operand_(operand.ToString()),
+      upper_(upper.ToString()) {
+  // A field is encoded as its size, its name size, its name and its value
+  PutVarint64(&needle_, field_name.size());
+  needle_.append(field_name.data(), field_name.size());
+  if (type_ != kRange) {
+    needle_.append(operand.data(), operand.size());
+  }
+}
+
+FieldPredicate FieldPredicate::Equal(const Slice& field_name,
+                                     const Slice& value) {
+  return FieldPredicate(kEqual, field_name, value, Slice());
+}
+
+FieldPredicate FieldPredicate::Prefix(const Slice& field_name,
+                                      const Slice& prefix) {
+  return FieldPredicate(kPrefix, field_name, prefix, Slice());
+}
+
+FieldPredicate FieldPredicate::Range(const Slice& field_name,
+                                     const Slice& lower, const Slice& upper) {
+  return FieldPredicate(kRange, field_name, lower, upper);
+}
+
+bool FieldPredicate::Matches(const Slice& field_value) const {
+  switch (type_) {
+    case kEqual:
+      return field_value == operand_;
+    case kPrefix:
+      return field_value.starts_with(operand_);
+    case kRange:
+      return field_value.compare(operand_) >= 0 &&
+             (upper_.empty() || field_value.compare(upper_) < 0);
+  }
+  return false;
+}
+
+bool FieldPredicate::MayMatch(const Slice& smallest,
+                              const Slice& largest) const {
+  if (largest.compare(operand_) < 0) {
+    return false;
+  }
+  switch (type_) {
+    case kEqual:
+      return smallest.compare(operand_) <= 0;
+    case kPrefix:
+      return smallest.compare(operand_) < 0 || smallest.starts_with(operand_);
+    case kRange:
+      return upper_.empty() || smallest.compare(upper_) < 0;
+  }
+  return true;
+}
+
+bool FieldPredicate::MatchesFields(const Slice& fields_str) const {
+  // Most values that do not match lack the bytes of a match altogether,
+  // rule them out before parsing anything
+  if (!Contains(fields_str, needle_)) {
+    return false;
+  }
+  Slice field_value;
+  return FindField(fields_str, field_name_, &field_value) &&
+         Matches(field_value);
+}
+
+}  // namespace leveldb
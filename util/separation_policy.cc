@@ -0,0 +1,103 @@
+#include "leveldb/separation_policy.h"
+
+#include "leveldb/slice.h"
+
+namespace leveldb {
+
+SeparationPolicy::~SeparationPolicy() {}
+
+bool SeparationPolicy::ShouldSeparateField(const Slice& key,
+                                           const Slice& name,
+                                           const Slice& value) const {
+  return false;
+}
+
+namespace {
+class SizeSeparationPolicy : public SeparationPolicy {
+ public:
+  explicit SizeSeparationPolicy(size_t min_size) : min_size_(min_size) {}
+
+  const char* Name() const override { return "leveldb.SizeSeparation"; }
+
+  bool ShouldSeparate(const Slice& key, const Slice& value) const override {
+    return value.size() >= min_size_;
+  }
+
+ private:
+  const size_t min_size_;
+};
+
+class KeyPrefixSeparationPolicy : public SeparationPolicy {
+ public:
+  KeyPrefixSeparationPolicy(const std::vector<std::string>& prefixes,
+                            size_t min_size)
+      : prefixes_(prefixes), min_size_(min_size) {}
+
+  const char* Name() const override { return "leveldb.KeyPrefixSeparation"; }
+
+  bool ShouldSeparate(const Slice& key, const Slice& value) const override {
+    if (value.size() < min_size_) {
+      return false;
+    }
+    for (const std::string& prefix : prefixes_) {
+      if (key.starts_with(prefix)) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+ private:
+  const std::vector<std::string> prefixes_;
+  const size_t min_size_;
+};
+
+class FieldSeparationPolicy : public SeparationPolicy {
+ public:
+  FieldSeparationPolicy(const std::vector<std::string>& field_names,
+                        size_t min_size)
+      : field_names_(field_names), min_size_(min_size) {}
+
+  const char* Name() const override { return "leveldb.FieldSeparation"; }
+
+  bool ShouldSeparate(const Slice& key, const Slice& value) const override {
+    return false;
+  }
+
+  bool ShouldSeparateField(const Slice& key, const Slice& name,
+                           const Slice& value) const override {
+    if (value.size() < min_size_) {
+      return false;
+    }
+    if (field_names_.empty()) {
+      return true;
+    }
+    for (const std::string& field_name : field_names_) {
+      if (name == field_name) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+ private:
+  const std::vector<std::string> field_names_;
+  const size_t min_size_;
+};
+}  // namespace
+
+const SeparationPolicy* NewSizeSeparationPolicy(size_t min_size) {
+  return new SizeSeparationPolicy(min_size);
+}
+
+const SeparationPolicy* NewKeyPrefixSeparationPolicy(
+    const std::vector<std::string>& prefixes, size_t min_size) {
+  return new KeyPrefixSeparationPolicy(prefixes, min_size);
+}
+
+const SeparationPolicy* NewFieldSeparationPolicy(
+    const std::vector<std::string>& field_names, size_t min_size) {
+  return new FieldSeparationPolicy(field_names, min_size);
+}
+
+}  // namespace leveldb